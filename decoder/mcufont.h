@@ -3,12 +3,18 @@
 #ifndef _MCUFONT_H_
 #define _MCUFONT_H_
 
+#include "mf_bwfont.h"
+#include "mf_clip.h"
 #include "mf_config.h"
+#include "mf_effectfont.h"
 #include "mf_encoding.h"
+#include "mf_framebuffer.h"
+#include "mf_glyphcache.h"
 #include "mf_justify.h"
 #include "mf_kerning.h"
 #include "mf_rlefont.h"
 #include "mf_scaledfont.h"
+#include "mf_spans.h"
 #include "mf_wordwrap.h"
 
 #endif
@@ -16,4 +16,9 @@ MFSRC = \
     $(MFDIR)/mf_rlefont.c \
     $(MFDIR)/mf_bwfont.c \
     $(MFDIR)/mf_scaledfont.c \
+    $(MFDIR)/mf_effectfont.c \
+    $(MFDIR)/mf_clip.c \
+    $(MFDIR)/mf_framebuffer.c \
+    $(MFDIR)/mf_glyphcache.c \
+    $(MFDIR)/mf_spans.c \
     $(MFDIR)/mf_wordwrap.c
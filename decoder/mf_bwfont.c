@@ -1,9 +1,13 @@
+#define MF_BWFONT_INTERNALS
 #include "mf_bwfont.h"
+#include "mf_clip.h"
+#include "mf_framebuffer.h"
+#include "mf_spans.h"
 #include <stdbool.h>
 
-/* Find the character range and index that contains a given glyph.. */
-static const struct mf_bwfont_char_range_s *find_char_range(
-    const struct mf_bwfont_s *font, uint16_t character, uint16_t *index_ret)
+/* Find the character range that contains a given glyph. */
+static const struct mf_bwfont_char_range_s *search_char_range(
+    const struct mf_bwfont_s *font, uint16_t character)
 {
     unsigned i, index;
     const struct mf_bwfont_char_range_s *range;
@@ -13,7 +17,6 @@ static const struct mf_bwfont_char_range_s *find_char_range(
         index = character - range->first_char;
         if (character >= range->first_char && index < range->char_count)
         {
-            *index_ret = index;
             return range;
         }
     }
@@ -21,6 +24,34 @@ static const struct mf_bwfont_char_range_s *find_char_range(
     return 0;
 }
 
+/* Find the character range and index that contains a given glyph.
+ * The range is looked up through the glyph lookup cache if enabled. */
+static const struct mf_bwfont_char_range_s *find_char_range(
+    const struct mf_bwfont_s *font, uint16_t character, uint16_t *index_ret)
+{
+    const struct mf_bwfont_char_range_s *range;
+    
+#if MF_GLYPH_LOOKUP_CACHE
+    const void *cached;
+    if (mf_glyph_lookup_get(&font->font, character, &cached))
+    {
+        range = cached;
+    }
+    else
+    {
+        range = search_char_range(font, character);
+        mf_glyph_lookup_put(&font->font, character, range);
+    }
+#else
+    range = search_char_range(font, character);
+#endif
+    
+    if (range)
+        *index_ret = character - range->first_char;
+    
+    return range;
+}
+
 static uint8_t get_width(const struct mf_bwfont_char_range_s *r, uint16_t index)
 {
     if (r->width)
@@ -33,36 +64,64 @@ static uint8_t get_width(const struct mf_bwfont_char_range_s *r, uint16_t index)
     }
 }
 
-static uint8_t render_char(const struct mf_bwfont_char_range_s *r,
-                           int16_t x0, int16_t y0, uint16_t index,
-                           mf_pixel_callback_t callback,
-                           void *state)
+/* Destination of the rendered pixels. */
+struct output_s
 {
-    const uint8_t *data, *p;
-    uint8_t stride, runlen;
-    uint8_t x, y, height, num_cols;
-    uint8_t bit, byte, mask;
-    bool oldstate, newstate;
+    mf_pixel_callback_t callback;
+    void *state;
+#if MF_USE_FRAMEBUFFER
+    const struct mf_framebuffer_s *fb;
+#endif
+#if MF_USE_SPAN_BATCH
+    struct mf_span_batch_s *batch;
+#endif
+#if MF_USE_CLIPPING
+    struct mf_cliprect_s clip;
+#endif
+};
+
+/* Write a run of foreground pixels to the output. */
+static void output_run(const struct output_s *out, int16_t x, int16_t y,
+                       uint8_t count)
+{
+#if MF_USE_CLIPPING
+    if (!mf_clip_run(&out->clip, &x, y, &count))
+        return;
+#endif
     
-    if (r->width)
+#if MF_USE_FRAMEBUFFER
+    if (out->fb)
     {
-        data = r->glyph_data + r->width * index * r->height_bytes;
-        num_cols = r->width;
+        mf_framebuffer_fill(out->fb, x, y, count, 255);
+        return;
     }
-    else
+#endif
+#if MF_USE_SPAN_BATCH
+    if (out->batch)
     {
-        data = r->glyph_data + r->glyph_offsets[index] * r->height_bytes;
-        num_cols = r->glyph_offsets[index + 1] - r->glyph_offsets[index];
+        mf_span_batch_add(out->batch, x, y, count, 255);
+        return;
     }
+#endif
     
-    stride = r->height_bytes;
-    height = r->height_pixels;
-    y0 += r->offset_y;
-    x0 += r->offset_x;
-    bit = 0;
-    byte = 0;
+    out->callback(x, y, count, 255, out->state);
+}
+
+/* Decode the rows y_begin to height-1 of a column-major glyph. */
+static void render_columns(const struct output_s *out, const uint8_t *data,
+                           uint8_t stride, int16_t x0, int16_t y0,
+                           uint8_t y_begin, uint8_t height, uint8_t num_cols)
+{
+    const uint8_t *p;
+    uint8_t runlen;
+    uint8_t x, y;
+    uint8_t bit, byte, mask;
+    bool oldstate, newstate;
+    
+    bit = y_begin & 7;
+    byte = y_begin >> 3;
     
-    for (y = 0; y < height; y++)
+    for (y = y_begin; y < height; y++)
     {
         mask = (1 << bit);
         
@@ -76,7 +135,7 @@ static uint8_t render_char(const struct mf_bwfont_char_range_s *r,
             {
                 if (oldstate && runlen)
                 {
-                    callback(x0 + x - runlen, y0 + y, runlen, 255, state);
+                    output_run(out, x0 + x - runlen, y0 + y, runlen);
                 }
                 
                 oldstate = newstate;
@@ -88,7 +147,7 @@ static uint8_t render_char(const struct mf_bwfont_char_range_s *r,
         
         if (oldstate && runlen)
         {
-            callback(x0 + x - runlen, y0 + y, runlen, 255, state);
+            output_run(out, x0 + x - runlen, y0 + y, runlen);
         }
         
         bit++;
@@ -98,13 +157,187 @@ static uint8_t render_char(const struct mf_bwfont_char_range_s *r,
             byte++;
         }
     }
+}
+
+/* Count the zero bits below the lowest set bit. The value must not be 0.
+ * The long variant of the builtin is used, because int is only 16 bits
+ * wide on targets such as AVR and MSP430. */
+#if defined(__GNUC__)
+#define count_trailing_zeros(w) ((uint8_t)__builtin_ctzl((unsigned long)(w)))
+#else
+static uint8_t count_trailing_zeros(uint32_t w)
+{
+    uint8_t n = 0;
+    
+    uint8_t shift = 16;
+    uint32_t mask = 0xFFFF;
+    
+    /* Binary search for the lowest set bit. */
+    while (shift)
+    {
+        if (!(w & mask))
+        {
+            n += shift;
+            w >>= shift;
+        }
+        
+        shift >>= 1;
+        mask >>= shift;
+    }
+    
+    return n;
+}
+#endif
+
+/* Decode the rows y_begin to height-1 of a row-major glyph. Each row is
+ * read 32 bits at a time, and the runs are located by counting the
+ * trailing zeros and ones of the word. */
+static void render_rows(const struct output_s *out, const uint8_t *data,
+                        uint8_t row_bytes, int16_t x0, int16_t y0,
+                        uint8_t y_begin, uint8_t height)
+{
+    const uint8_t *p;
+    uint8_t y, i, n, pos, chunk, start;
+    bool inrun;
+    uint32_t w;
+    
+    for (y = y_begin; y < height; y++)
+    {
+        p = data + y * row_bytes;
+        inrun = false;
+        start = 0;
+        
+        for (i = 0; i < row_bytes; i += 4, p += 4)
+        {
+            /* Load up to 4 bytes, LSB first. */
+            chunk = row_bytes - i;
+            w = p[0];
+            if (chunk > 1) w |= (uint32_t)p[1] << 8;
+            if (chunk > 2) w |= (uint32_t)p[2] << 16;
+            if (chunk > 3) w |= (uint32_t)p[3] << 24;
+            
+            pos = 0;
+            while (pos < 32)
+            {
+                if (!inrun)
+                {
+                    /* Find the start of the next run. */
+                    if (w == 0)
+                        break;
+                    
+                    n = count_trailing_zeros(w);
+                    w >>= n;
+                    pos += n;
+                    start = i * 8 + pos;
+                    inrun = true;
+                }
+                else
+                {
+                    /* Find the end of the current run. */
+                    if (w == 0xFFFFFFFF)
+                        break;
+                    
+                    n = count_trailing_zeros(~w);
+                    w >>= n;
+                    pos += n;
+                    
+                    /* Runs that reach the top of the word continue in
+                     * the next word. */
+                    if (pos == 32)
+                        break;
+                    
+                    output_run(out, x0 + start, y0 + y, i * 8 + pos - start);
+                    inrun = false;
+                }
+            }
+        }
+        
+        if (inrun)
+        {
+            output_run(out, x0 + start, y0 + y, row_bytes * 8 - start);
+        }
+    }
+}
+
+static uint8_t render_char(const struct mf_bwfont_char_range_s *r,
+                           int16_t x0, int16_t y0, uint16_t index,
+                           mf_pixel_callback_t callback,
+                           void *state)
+{
+    const uint8_t *data;
+    uint8_t y_begin, height, row_bytes;
+    uint16_t num_cols;
+    
+    struct output_s out;
+#if MF_USE_CLIPPING
+    mf_clip_get_rect(&out.clip, &callback, &state);
+#endif
+    out.callback = callback;
+    out.state = state;
+#if MF_USE_FRAMEBUFFER
+    out.fb = (callback == mf_framebuffer_callback) ? state : 0;
+#endif
+#if MF_USE_SPAN_BATCH
+    out.batch = (callback == mf_span_batch_callback) ? state : 0;
+#endif
+    
+    height = r->height_pixels;
+    row_bytes = 0;
+    
+    if (r->row_major)
+    {
+        if (r->width)
+        {
+            row_bytes = (r->width + 7) / 8;
+            data = r->glyph_data + index * height * row_bytes;
+        }
+        else
+        {
+            data = r->glyph_data + r->glyph_offsets[index] * height;
+            row_bytes = r->glyph_offsets[index + 1] - r->glyph_offsets[index];
+        }
+        
+        num_cols = row_bytes * 8;
+    }
+    else if (r->width)
+    {
+        data = r->glyph_data + r->width * index * r->height_bytes;
+        num_cols = r->width;
+    }
+    else
+    {
+        data = r->glyph_data + r->glyph_offsets[index] * r->height_bytes;
+        num_cols = r->glyph_offsets[index + 1] - r->glyph_offsets[index];
+    }
+    
+    y0 += r->offset_y;
+    x0 += r->offset_x;
+    y_begin = 0;
+    
+#if MF_USE_CLIPPING
+    /* Decode only the rows that are inside the clip rectangle. */
+    if (out.clip.x0 >= x0 + num_cols || out.clip.x1 <= x0 ||
+        out.clip.y0 >= y0 + height || out.clip.y1 <= y0)
+        return get_width(r, index);
+    
+    if (out.clip.y0 > y0)
+        y_begin = out.clip.y0 - y0;
+    if (out.clip.y1 < y0 + height)
+        height = out.clip.y1 - y0;
+#endif
+    
+    if (r->row_major)
+        render_rows(&out, data, row_bytes, x0, y0, y_begin, height);
+    else
+        render_columns(&out, data, r->height_bytes, x0, y0,
+                       y_begin, height, num_cols);
     
     return get_width(r, index);
 }
 
 uint8_t mf_bwfont_render_character(const struct mf_font_s *font,
                                    int16_t x0, int16_t y0,
-                                   uint16_t character,
+                                   mf_char character,
                                    mf_pixel_callback_t callback,
                                    void *state)
 {
@@ -119,8 +352,162 @@ uint8_t mf_bwfont_render_character(const struct mf_font_s *font,
     return render_char(range, x0, y0, index, callback, state);
 }
 
+uint8_t mf_bwfont_render_glyph_ref(const struct mf_font_s *font,
+                                   int16_t x0, int16_t y0,
+                                   const struct mf_glyph_ref_s *glyph,
+                                   mf_pixel_callback_t callback,
+                                   void *state)
+{
+    const struct mf_bwfont_s *bwfont = (const struct mf_bwfont_s*)font;
+    const struct mf_bwfont_char_range_s *range;
+    
+    if (glyph->range >= bwfont->char_range_count)
+        return 0;
+    
+    range = &bwfont->char_ranges[glyph->range];
+    if (glyph->index >= range->char_count)
+        return 0;
+    
+    return render_char(range, x0, y0, glyph->index, callback, state);
+}
+
+#if MF_USE_FRAMEBUFFER
+/* Get the bits of page 'page' that are inside the rows y0 to y1-1. */
+static uint8_t page_mask(int16_t page, int16_t y0, int16_t y1)
+{
+    int16_t first = y0 - page * 8;
+    int16_t last = y1 - page * 8;
+    
+    if (first < 0)
+        first = 0;
+    if (last > 8)
+        last = 8;
+    if (first >= last)
+        return 0;
+    
+    return ((1 << last) - 1) & ~((1 << first) - 1);
+}
+
+/* Write the masked bits of one byte in a page framebuffer. */
+static void blit_byte(uint8_t *p, uint8_t bits, uint8_t mask,
+                      uint8_t color, bool opaque)
+{
+    if (opaque)
+    {
+        if (!color)
+            bits = ~bits;
+        
+        *p = (*p & ~mask) | (bits & mask);
+    }
+    else if (color)
+    {
+        *p |= bits & mask;
+    }
+    else
+    {
+        *p &= ~(bits & mask);
+    }
+}
+
+/* Copy the columns of a column-major glyph into the pages. Each byte of a
+ * column covers 8 rows and lands on at most two pages of the target. */
+static void blit_columns(const struct mf_bwfont_char_range_s *r,
+                         const struct mf_framebuffer_s *fb,
+                         int16_t x0, int16_t y0, uint16_t index,
+                         bool opaque)
+{
+    const uint8_t *data, *p;
+    uint8_t stride, height, num_cols, b, shift, valid, lo_mask, hi_mask;
+    uint16_t bits;
+    int16_t x, x_begin, x_end, top, page;
+    int32_t lo, hi;
+    
+    if (r->width)
+    {
+        data = r->glyph_data + r->width * index * r->height_bytes;
+        num_cols = r->width;
+    }
+    else
+    {
+        data = r->glyph_data + r->glyph_offsets[index] * r->height_bytes;
+        num_cols = r->glyph_offsets[index + 1] - r->glyph_offsets[index];
+    }
+    
+    stride = r->height_bytes;
+    height = r->height_pixels;
+    y0 += r->offset_y;
+    x0 += r->offset_x;
+    
+    x_begin = (fb->clip_x0 > x0) ? fb->clip_x0 - x0 : 0;
+    x_end = (fb->clip_x1 < x0 + num_cols) ? fb->clip_x1 - x0 : num_cols;
+    
+    for (b = 0; b < stride && x_begin < x_end; b++)
+    {
+        /* Find the page and bit position of the first row in this byte. */
+        top = y0 + 8 * b;
+        page = (top >= 0) ? top / 8 : -((7 - top) / 8);
+        shift = top - page * 8;
+        
+        /* Mask out the rows past the glyph and outside the clip area. */
+        valid = (height - 8 * b >= 8) ? 0xFF : (1 << (height - 8 * b)) - 1;
+        lo_mask = (valid << shift) & page_mask(page, fb->clip_y0, fb->clip_y1);
+        hi_mask = ((valid << shift) >> 8) &
+                  page_mask(page + 1, fb->clip_y0, fb->clip_y1);
+        
+        lo = (int32_t)fb->stride * page + x0;
+        hi = lo + fb->stride;
+        p = data + x_begin * stride + b;
+        
+        for (x = x_begin; x < x_end; x++, p += stride)
+        {
+            bits = (uint16_t)*p << shift;
+            
+            if (lo_mask)
+            {
+                blit_byte(fb->buffer + (lo + x), bits, lo_mask,
+                          fb->color, opaque);
+            }
+            
+            if (hi_mask)
+            {
+                blit_byte(fb->buffer + (hi + x), bits >> 8, hi_mask,
+                          fb->color, opaque);
+            }
+        }
+    }
+}
+
+uint8_t mf_bwfont_blit_pages(const struct mf_font_s *font,
+                             const struct mf_framebuffer_s *fb,
+                             int16_t x0, int16_t y0,
+                             mf_char character, bool opaque)
+{
+    const struct mf_bwfont_s *bwfont = (const struct mf_bwfont_s*)font;
+    const struct mf_bwfont_char_range_s *range;
+    uint16_t index;
+    
+    if (fb->format != MF_PIXFMT_PAGES ||
+        font->render_character != mf_bwfont_render_character)
+    {
+        return mf_framebuffer_render_character(font, fb, x0, y0, character);
+    }
+    
+    range = find_char_range(bwfont, character, &index);
+    if (!range)
+        range = find_char_range(bwfont, font->fallback_character, &index);
+    if (!range)
+        return 0;
+    
+    if (range->row_major)
+        return mf_framebuffer_render_character(font, fb, x0, y0, character);
+    
+    blit_columns(range, fb, x0, y0, index, opaque);
+    return get_width(range, index);
+}
+#endif
+
 uint8_t mf_bwfont_character_width(const struct mf_font_s *font,
-                                  uint16_t character)
+                                  mf_char character)
 {
     const struct mf_bwfont_s *bwfont = (const struct mf_bwfont_s*)font;
     const struct mf_bwfont_char_range_s *range;
@@ -132,3 +519,19 @@ uint8_t mf_bwfont_character_width(const struct mf_font_s *font,
     
     return get_width(range, index);
 }
+
+#if MF_USE_KERNING
+const uint8_t *mf_bwfont_kerning_edges(const struct mf_font_s *font,
+                                       mf_char character)
+{
+    const struct mf_bwfont_s *bwfont = (const struct mf_bwfont_s*)font;
+    const struct mf_bwfont_char_range_s *range;
+    uint16_t index;
+    
+    range = find_char_range(bwfont, character, &index);
+    if (!range || !range->kerning_edges)
+        return 0;
+    
+    return range->kerning_edges + index * MF_KERNING_EDGE_BYTES;
+}
+#endif
@@ -10,6 +10,9 @@
 /* Versions of the BW font format that are supported. */
 #define MF_BWFONT_VERSION_4_SUPPORTED 1
 
+/* The decoder supports glyph data stored row-by-row. */
+#define MF_BWFONT_ROW_MAJOR_SUPPORTED 1
+
 /* Structure for a range of characters. */
 struct mf_bwfont_char_range_s
 {
@@ -24,7 +27,8 @@ struct mf_bwfont_char_range_s
     uint8_t offset_x;
     uint8_t offset_y;
     
-    /* Column height for glyphs in this range, in bytes and pixels. */
+    /* Column height for glyphs in this range, in bytes and pixels.
+     * The height in bytes is only used for column-major data. */
     uint8_t height_bytes;
     uint8_t height_pixels;
     
@@ -37,14 +41,25 @@ struct mf_bwfont_char_range_s
     
     /* Lookup table for the character offsets.  Multiply by height_bytes
      * to get the byte offset. Also allows lookup of the number of columns.
+     * For row-major data, multiply by height_pixels instead, and the
+     * difference gives the number of bytes per row.
      * NULL if width is specified. */
     const uint16_t *glyph_offsets;
     
     /* Table for the glyph data.
      * The data for each glyph is column-by-column, with N bytes per each
      * column. The LSB of the first byte is the top left pixel.
+     * For row-major data, each glyph is row-by-row instead, with the
+     * columns packed into bytes starting from the LSB.
      */
     const uint8_t *glyph_data;
+    
+    /* Nonzero if the glyph data is stored row-by-row. */
+    uint8_t row_major;
+    
+    /* Precomputed kerning edges for the glyphs in this range, or NULL.
+     * See mf_kerning.h for the format. */
+    const uint8_t *kerning_edges;
 };
 
 /* Structure for the font */
@@ -62,6 +77,28 @@ struct mf_bwfont_s
     const struct mf_bwfont_char_range_s *char_ranges;
 };
 
+#if MF_USE_FRAMEBUFFER
+#include "mf_framebuffer.h"
+
+/* Render a single character into a framebuffer in MF_PIXFMT_PAGES format
+ * by copying the glyph columns directly into the pages. Falls back to the
+ * normal framebuffer rendering for other fonts and row-major glyph data.
+ *
+ * font:      Pointer to the font definition.
+ * fb:        Target framebuffer, must be in MF_PIXFMT_PAGES format.
+ * x0, y0:    Upper left corner of the target area.
+ * character: The character code (unicode) to render.
+ * opaque:    If true, the background pixels inside the stored glyph are
+ *            cleared. If false, only the foreground pixels are written.
+ *
+ * Returns width of the character.
+ */
+MF_EXTERN uint8_t mf_bwfont_blit_pages(const struct mf_font_s *font,
+                                       const struct mf_framebuffer_s *fb,
+                                       int16_t x0, int16_t y0,
+                                       mf_char character, bool opaque);
+#endif
+
 #ifdef MF_BWFONT_INTERNALS
 /* Internal functions, don't use these directly. */
 MF_EXTERN uint8_t mf_bwfont_render_character(const struct mf_font_s *font,
@@ -70,8 +107,19 @@ MF_EXTERN uint8_t mf_bwfont_render_character(const struct mf_font_s *font,
                                              mf_pixel_callback_t callback,
                                              void *state);
 
+MF_EXTERN uint8_t mf_bwfont_render_glyph_ref(const struct mf_font_s *font,
+                                             int16_t x0, int16_t y0,
+                                             const struct mf_glyph_ref_s *glyph,
+                                             mf_pixel_callback_t callback,
+                                             void *state);
+
 MF_EXTERN uint8_t mf_bwfont_character_width(const struct mf_font_s *font,
                                             mf_char character);
+
+#if MF_USE_KERNING
+MF_EXTERN const uint8_t *mf_bwfont_kerning_edges(const struct mf_font_s *font,
+                                                 mf_char character);
+#endif
 #endif
 
 #endif
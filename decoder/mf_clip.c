@@ -0,0 +1,88 @@
+#include "mf_clip.h"
+#include "mf_framebuffer.h"
+
+#if MF_USE_CLIPPING
+
+/* Limits of int16_t. Avoids a dependency on libc. */
+#define COORD_MIN (-32767 - 1)
+#define COORD_MAX 32767
+
+void mf_clip_callback(int16_t x, int16_t y, uint8_t count,
+                      uint8_t alpha, void *state)
+{
+    struct mf_clip_s *clip = state;
+    
+    if (mf_clip_run(&clip->rect, &x, y, &count))
+        clip->callback(x, y, count, alpha, clip->state);
+}
+
+uint8_t mf_render_character_clipped(const struct mf_font_s *font,
+                                    int16_t x0, int16_t y0,
+                                    mf_char character,
+                                    const struct mf_cliprect_s *rect,
+                                    mf_pixel_callback_t callback,
+                                    void *state)
+{
+    struct mf_clip_s clip;
+    clip.rect = *rect;
+    clip.callback = callback;
+    clip.state = state;
+    
+    return mf_render_character(font, x0, y0, character,
+                               mf_clip_callback, &clip);
+}
+
+bool mf_clip_get_rect(struct mf_cliprect_s *rect,
+                      mf_pixel_callback_t *callback, void **state)
+{
+    bool clipped = false;
+    
+    rect->x0 = COORD_MIN;
+    rect->y0 = COORD_MIN;
+    rect->x1 = COORD_MAX;
+    rect->y1 = COORD_MAX;
+    
+    if (*callback == mf_clip_callback)
+    {
+        const struct mf_clip_s *clip = *state;
+        *rect = clip->rect;
+        *callback = clip->callback;
+        *state = clip->state;
+        clipped = true;
+    }
+
+#if MF_USE_FRAMEBUFFER
+    if (*callback == mf_framebuffer_callback)
+    {
+        const struct mf_framebuffer_s *fb = *state;
+        if (rect->x0 < fb->clip_x0) rect->x0 = fb->clip_x0;
+        if (rect->y0 < fb->clip_y0) rect->y0 = fb->clip_y0;
+        if (rect->x1 > fb->clip_x1) rect->x1 = fb->clip_x1;
+        if (rect->y1 > fb->clip_y1) rect->y1 = fb->clip_y1;
+        clipped = true;
+    }
+#endif
+    
+    return clipped;
+}
+
+bool mf_clip_run(const struct mf_cliprect_s *rect,
+                 int16_t *x, int16_t y, uint8_t *count)
+{
+    int16_t x_end = *x + *count;
+    
+    if (y < rect->y0 || y >= rect->y1)
+        return false;
+    
+    if (*x < rect->x0)
+        *x = rect->x0;
+    if (x_end > rect->x1)
+        x_end = rect->x1;
+    if (*x >= x_end)
+        return false;
+    
+    *count = x_end - *x;
+    return true;
+}
+
+#endif
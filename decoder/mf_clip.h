@@ -0,0 +1,71 @@
+/* Clipping of the rendered pixels to a rectangle. The rlefont, bwfont and
+ * scaled font decoders recognize the clip target, and avoid decoding the
+ * rows that fall outside of it.
+ */
+
+#ifndef _MF_CLIP_H_
+#define _MF_CLIP_H_
+
+#include "mf_font.h"
+
+/* Rectangle that limits the area to draw. The left and top edges are
+ * inclusive, right and bottom edges exclusive. */
+struct mf_cliprect_s
+{
+    int16_t x0;
+    int16_t y0;
+    int16_t x1;
+    int16_t y1;
+};
+
+/* Clip rectangle together with the target the pixels are passed to. */
+struct mf_clip_s
+{
+    struct mf_cliprect_s rect;
+    mf_pixel_callback_t callback;
+    void *state;
+};
+
+/* Pixel callback that trims the pixel runs to the clip rectangle and
+ * passes them on. Pass a pointer to the struct mf_clip_s as the state.
+ * This works with any font type, but the built-in decoders detect it and
+ * skip the parts of the glyph that lie outside the rectangle.
+ */
+MF_EXTERN void mf_clip_callback(int16_t x, int16_t y, uint8_t count,
+                                uint8_t alpha, void *state);
+
+/* Render a single character, only drawing the pixels inside a rectangle.
+ *
+ * font:      Pointer to the font definition.
+ * x0, y0:    Upper left corner of the target area.
+ * character: The character code (unicode) to render.
+ * rect:      Area to draw in.
+ * callback:  Callback function to write out the pixels.
+ * state:     Free variable for caller to use (can be NULL).
+ *
+ * Returns width of the character.
+ */
+MF_EXTERN uint8_t mf_render_character_clipped(const struct mf_font_s *font,
+                                              int16_t x0, int16_t y0,
+                                              mf_char character,
+                                              const struct mf_cliprect_s *rect,
+                                              mf_pixel_callback_t callback,
+                                              void *state);
+
+/* Internal function used by the decoders, don't use directly.
+ * Gets the clip rectangle of the render target. If the callback is the clip
+ * callback, replaces callback and state with the wrapped target. Returns
+ * false if the target does not clip, and then sets rect to cover
+ * everything.
+ */
+MF_EXTERN bool mf_clip_get_rect(struct mf_cliprect_s *rect,
+                                mf_pixel_callback_t *callback, void **state);
+
+/* Internal function used by the decoders, don't use directly.
+ * Trims a pixel run to the clip rectangle. Returns false if nothing is
+ * left of it.
+ */
+MF_EXTERN bool mf_clip_run(const struct mf_cliprect_s *rect,
+                           int16_t *x, int16_t y, uint8_t *count);
+
+#endif
@@ -83,6 +83,22 @@
 #define MF_USE_KERNING 1
 #endif
 
+/* Enable or disable the use of kerning tables imported from the font file.
+ * Fonts that have been exported with kerning=table are then kerned by the
+ * table only, and the automatic kerning is used for the other fonts.
+ */
+#ifndef MF_USE_KERNING_TABLES
+#define MF_USE_KERNING_TABLES 1
+#endif
+
+/* Enable or disable the use of precomputed font metrics. Fonts that have
+ * been exported with metrics=ascii then give the widths of the printable
+ * ASCII characters from a table, without searching for the glyphs.
+ */
+#ifndef MF_USE_FONT_METRICS
+#define MF_USE_FONT_METRICS 1
+#endif
+
 /* Enable or disable the advanced word wrap algorithm.
  * If disabled, uses a simpler algorithm.
  */
@@ -90,6 +106,22 @@
 #define MF_USE_ADVANCED_WORDWRAP 1
 #endif
 
+/* Enable or disable the optimal word wrap algorithm, mf_wordwrap_optimal().
+ * It gives the least ragged lines, but is slower and needs a scratch
+ * buffer. Disabling it saves some code size.
+ */
+#ifndef MF_USE_OPTIMAL_WORDWRAP
+#define MF_USE_OPTIMAL_WORDWRAP 1
+#endif
+
+/* Enable or disable the incremental word wrap, which keeps the positions
+ * of the lines and updates only the affected ones after the text has been
+ * edited. Requires MF_USE_ADVANCED_WORDWRAP.
+ */
+#ifndef MF_USE_INCREMENTAL_WORDWRAP
+#define MF_USE_INCREMENTAL_WORDWRAP 1
+#endif
+
 /* Enable of disable the justification algorithm.
  * If disabled, mf_render_justified renders just left-aligned.
  */
@@ -111,6 +143,67 @@
 #define MF_USE_TABS 1
 #endif
 
+/* Enable or disable the direct framebuffer rendering support.
+ * If disabled, the decoders always output through the pixel callback.
+ */
+#ifndef MF_USE_FRAMEBUFFER
+#define MF_USE_FRAMEBUFFER 1
+#endif
+
+/* Enable or disable the decoded glyph cache.
+ * The cache stays inactive until it is given memory to use by calling
+ * mf_glyph_cache_init(). Disabling it saves some code size.
+ */
+#ifndef MF_USE_GLYPH_CACHE
+#define MF_USE_GLYPH_CACHE 1
+#endif
+
+/* Enable or disable the span batch output support.
+ * If disabled, the decoders always output through the pixel callback.
+ */
+#ifndef MF_USE_SPAN_BATCH
+#define MF_USE_SPAN_BATCH 1
+#endif
+
+/* Enable or disable the clip rectangle support.
+ * If disabled, the decoders always decode the whole glyph.
+ */
+#ifndef MF_USE_CLIPPING
+#define MF_USE_CLIPPING 1
+#endif
+
+/* Enable or disable the edge smoothing of fractionally scaled fonts.
+ * If disabled, mf_scale_font_fixed() always uses nearest-neighbor scaling.
+ */
+#ifndef MF_USE_SCALE_SMOOTHING
+#define MF_USE_SCALE_SMOOTHING 1
+#endif
+
+/* Enable or disable the expansion of rlefont dictionaries into RAM.
+ * The expansion is only used after mf_rlefont_expand_dictionary() has
+ * been called for the font. Disabling it saves some code size.
+ */
+#ifndef MF_USE_EXPANDED_DICTIONARY
+#define MF_USE_EXPANDED_DICTIONARY 1
+#endif
+
+/* Enable or disable the cache of computed kerning adjustments.
+ * The cache stays inactive until it is given memory to use by calling
+ * mf_kerning_cache_init(). Disabling it saves some code size.
+ */
+#ifndef MF_USE_KERNING_CACHE
+#define MF_USE_KERNING_CACHE 1
+#endif
+
+/* Enable or disable the SIMD blending of long pixel runs in the
+ * framebuffer module, and the SIMD check for ASCII text in
+ * mf_decode_utf8(). Only has an effect when compiling for a target
+ * with SSE2, such as a PC build used for testing or simulation.
+ */
+#ifndef MF_USE_SIMD
+#define MF_USE_SIMD 1
+#endif
+
 /* Number of vertical zones to use when computing kerning.
  * Larger values give more accurate kerning, but are slower and use somewhat
  * more memory. There is no point to increase this beyond the height of the
@@ -121,6 +214,55 @@
 #endif
 
 
+/*************************************************************************
+ * Configuration settings to use more RAM in exchange for speed          *
+ *************************************************************************/
+
+/* Number of entries in the glyph lookup cache.
+ * The cache remembers where the glyph data of recently used characters is
+ * located, so that the search through the character ranges can be skipped.
+ * Each entry takes 8-12 bytes of RAM. Set to 0 to disable the cache.
+ * Use a power of two, so that the slot computation reduces to a mask.
+ */
+#ifndef MF_GLYPH_LOOKUP_CACHE
+#define MF_GLYPH_LOOKUP_CACHE 0
+#endif
+
+/* Number of slots in the index of the glyph cache. The cache finds a glyph
+ * through the index without searching the stored glyphs, and holds at most
+ * this many glyphs. Each slot takes 4 bytes of RAM.
+ */
+#ifndef MF_GLYPH_CACHE_SLOTS
+#define MF_GLYPH_CACHE_SLOTS 64
+#endif
+
+/* Number of spans collected before passing them to the span callback.
+ * Each span takes 6 bytes of stack space.
+ */
+#ifndef MF_SPAN_BATCH_SIZE
+#define MF_SPAN_BATCH_SIZE 16
+#endif
+
+/* Number of pixel runs of one glyph row that a smoothed scaled font
+ * collects before writing out the scaled rows. Rows with more runs are
+ * written in several parts. Each run takes 12 bytes of stack space.
+ */
+#ifndef MF_SCALE_ROW_RUNS
+#define MF_SCALE_ROW_RUNS 16
+#endif
+
+/* Number of pixel runs that a bold, outline or shadow font can store of
+ * the base glyph. Larger glyphs are processed in several bands of rows,
+ * decoding the glyph again for each band. The runs of the base rows needed
+ * for one output row must still fit: 2 * thickness + 1 rows for outlines
+ * and offset_y + 1 rows for shadows. Each run takes 4 bytes of stack space,
+ * and the effect fonts use about 500 bytes more for other buffers.
+ */
+#ifndef MF_EFFECT_RUNS
+#define MF_EFFECT_RUNS 128
+#endif
+
+
 
 /* Add extern "C" when used from C++. */
 #ifdef __cplusplus
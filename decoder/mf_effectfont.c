@@ -0,0 +1,437 @@
+#include "mf_effectfont.h"
+#include "mf_clip.h"
+
+/* Space in the row buffer on both sides of the glyph, for the copies that
+ * are offset horizontally. */
+#define ROW_MARGIN MF_EFFECT_MAX_OFFSET
+#define ROW_SIZE (256 + 2 * ROW_MARGIN)
+
+/* Largest number of copies of the base glyph, needed for the outline of
+ * the maximum thickness. */
+#define MAX_COPIES ((2 * MF_EFFECT_MAX_OUTLINE + 1) * \
+                    (2 * MF_EFFECT_MAX_OUTLINE + 1))
+
+/* One pixel run of the base glyph, relative to its upper left corner. */
+struct effect_run
+{
+    uint8_t x;
+    uint8_t y;
+    uint8_t count;
+    uint8_t alpha;
+};
+
+/* One offset copy of the base glyph that is combined into the result. */
+struct effect_copy
+{
+    int8_t dx;
+    int8_t dy;
+    uint8_t alpha;
+};
+
+/* The runs of the base glyph rows that are needed for the current band
+ * of output rows. */
+struct effect_glyph
+{
+    int16_t row_start;
+    int16_t row_end;
+    uint16_t count;
+    bool overflow;
+    struct effect_run runs[MF_EFFECT_RUNS];
+};
+
+static void collect_callback(int16_t x, int16_t y, uint8_t count,
+                             uint8_t alpha, void *state)
+{
+    struct effect_glyph *glyph = state;
+    struct effect_run *run;
+    
+    if (y < glyph->row_start || y >= glyph->row_end || x < 0 || x > 255)
+        return;
+    
+    if (glyph->count == MF_EFFECT_RUNS)
+    {
+        glyph->overflow = true;
+        return;
+    }
+    
+    if (x + count > 256)
+        count = 256 - x;
+    
+    run = &glyph->runs[glyph->count++];
+    run->x = x;
+    run->y = y;
+    run->count = count;
+    run->alpha = alpha;
+}
+
+/* Sort the runs by row and then by x. The decoders usually give them in
+ * this order already, except for fonts exported in column order. */
+static void sort_runs(struct effect_glyph *glyph)
+{
+    uint16_t i, j;
+    
+    for (i = 1; i < glyph->count; i++)
+    {
+        struct effect_run run = glyph->runs[i];
+        
+        for (j = i; j > 0; j--)
+        {
+            const struct effect_run *prev = &glyph->runs[j - 1];
+            if (prev->y < run.y || (prev->y == run.y && prev->x <= run.x))
+                break;
+            glyph->runs[j] = *prev;
+        }
+        
+        glyph->runs[j] = run;
+    }
+}
+
+/* Get the copies of the base glyph that make up the effect. Returns the
+ * number of copies. */
+static uint8_t get_copies(const struct mf_effectfont_s *efont,
+                          struct effect_copy *copies)
+{
+    uint8_t count = 0;
+    int8_t dx, dy;
+    int8_t size = efont->size;
+    
+    if (efont->effect == MF_EFFECT_BOLD)
+    {
+        for (dx = 0; dx <= size; dx++)
+        {
+            copies[count].dx = dx;
+            copies[count].dy = 0;
+            copies[count].alpha = 255;
+            count++;
+        }
+    }
+    else if (efont->effect == MF_EFFECT_OUTLINE)
+    {
+        /* Leave out the corners to make the outline round. */
+        for (dy = -size; dy <= size; dy++)
+        {
+            for (dx = -size; dx <= size; dx++)
+            {
+                if (dx * dx + dy * dy > size * size + size)
+                    continue;
+                
+                copies[count].dx = dx;
+                copies[count].dy = dy;
+                copies[count].alpha = 255;
+                count++;
+            }
+        }
+    }
+    else
+    {
+        copies[count].dx = 0;
+        copies[count].dy = 0;
+        copies[count].alpha = 255;
+        count++;
+        
+        if (efont->shadow_x || efont->shadow_y)
+        {
+            copies[count].dx = efont->shadow_x;
+            copies[count].dy = efont->shadow_y;
+            copies[count].alpha = efont->shadow_alpha;
+            count++;
+        }
+    }
+    
+    return count;
+}
+
+/* Combine the copies of the base glyph for each output row in the row
+ * buffer, and pass the result to the callback as runs. */
+static void write_rows(const struct mf_effectfont_s *efont,
+                       const struct effect_glyph *glyph,
+                       const struct effect_copy *copies, uint8_t num_copies,
+                       int16_t x0, int16_t y0, int16_t first, int16_t last,
+                       mf_pixel_callback_t callback, void *state)
+{
+    uint8_t row[ROW_SIZE];
+    uint16_t cursors[MAX_COPIES];
+    uint16_t base_cursor = 0;
+    uint16_t c;
+    int16_t x, y;
+    uint8_t i;
+    
+    for (x = 0; x < ROW_SIZE; x++)
+        row[x] = 0;
+    
+    for (i = 0; i < num_copies; i++)
+        cursors[i] = 0;
+    
+    for (y = first; y < last; y++)
+    {
+        int16_t left = ROW_SIZE, right = 0;
+        
+        for (i = 0; i < num_copies; i++)
+        {
+            int16_t src = y - copies[i].dy;
+            
+            c = cursors[i];
+            while (c < glyph->count && glyph->runs[c].y < src)
+                c++;
+            cursors[i] = c;
+            
+            for (; c < glyph->count && glyph->runs[c].y == src; c++)
+            {
+                const struct effect_run *run = &glyph->runs[c];
+                int16_t start = run->x + copies[i].dx + ROW_MARGIN;
+                int16_t end = start + run->count;
+                uint8_t alpha = run->alpha;
+                
+                if (copies[i].alpha != 255)
+                    alpha = (alpha * copies[i].alpha + 127) / 255;
+                
+                if (start < left) left = start;
+                if (end > right) right = end;
+                
+                for (x = start; x < end; x++)
+                {
+                    if (row[x] < alpha)
+                        row[x] = alpha;
+                }
+            }
+        }
+        
+        if (efont->effect == MF_EFFECT_OUTLINE)
+        {
+            /* Remove the glyph itself, leaving only the outline. */
+            c = base_cursor;
+            while (c < glyph->count && glyph->runs[c].y < y)
+                c++;
+            base_cursor = c;
+            
+            for (; c < glyph->count && glyph->runs[c].y == y; c++)
+            {
+                const struct effect_run *run = &glyph->runs[c];
+                int16_t start = run->x + ROW_MARGIN;
+                
+                for (x = start; x < start + run->count; x++)
+                    row[x] = (row[x] > run->alpha) ? row[x] - run->alpha : 0;
+            }
+        }
+        
+        /* Write out the runs of equal alpha and clear the buffer. */
+        x = left;
+        while (x < right)
+        {
+            uint8_t alpha = row[x];
+            int16_t start = x;
+            
+            while (x < right && row[x] == alpha && x - start < 255)
+                row[x++] = 0;
+            
+            if (alpha)
+            {
+                callback(x0 + start - ROW_MARGIN, y0 + y, x - start,
+                         alpha, state);
+            }
+        }
+    }
+}
+
+static uint8_t effect_character_width(const struct mf_font_s *font,
+                                      mf_char character)
+{
+    struct mf_effectfont_s *efont = (struct mf_effectfont_s*)font;
+    uint8_t basewidth;
+    
+    basewidth = efont->basefont->character_width(efont->basefont, character);
+    
+    if (basewidth && efont->effect == MF_EFFECT_BOLD)
+        basewidth += efont->size;
+    
+    return basewidth;
+}
+
+static uint8_t effect_render_character(const struct mf_font_s *font,
+                                       int16_t x0, int16_t y0,
+                                       mf_char character,
+                                       mf_pixel_callback_t callback,
+                                       void *state)
+{
+    struct mf_effectfont_s *efont = (struct mf_effectfont_s*)font;
+    const struct mf_font_s *basefont = efont->basefont;
+    struct effect_glyph glyph;
+    struct effect_copy copies[MAX_COPIES];
+    uint8_t num_copies, i;
+    int16_t min_dx = 0, max_dx = 0, min_dy = 0, max_dy = 0;
+    int16_t first, last, band, y;
+    uint8_t basewidth = 0;
+    mf_pixel_callback_t base_callback = collect_callback;
+    void *base_state = &glyph;
+#if MF_USE_CLIPPING
+    struct mf_clip_s clip;
+    mf_pixel_callback_t target_callback = callback;
+    void *target_state = state;
+    bool clipped;
+#endif
+    
+    /* The outline extends on all sides of the base glyph, so it is drawn
+     * shifted by the thickness to keep it inside the glyph box. */
+    if (efont->effect == MF_EFFECT_OUTLINE)
+    {
+        x0 += efont->size;
+        y0 += efont->size;
+    }
+    
+    num_copies = get_copies(efont, copies);
+    for (i = 0; i < num_copies; i++)
+    {
+        if (copies[i].dx < min_dx) min_dx = copies[i].dx;
+        if (copies[i].dx > max_dx) max_dx = copies[i].dx;
+        if (copies[i].dy < min_dy) min_dy = copies[i].dy;
+        if (copies[i].dy > max_dy) max_dy = copies[i].dy;
+    }
+    
+    first = min_dy;
+    last = basefont->height + max_dy;
+    
+#if MF_USE_CLIPPING
+    /* Only the output rows inside the clip rectangle are computed, and the
+     * base font can skip the glyph rows that are not needed for them. The
+     * original callback still trims the runs to the exact rectangle. */
+    clipped = mf_clip_get_rect(&clip.rect, &target_callback, &target_state);
+    if (clipped)
+    {
+        if (first < clip.rect.y0 - y0) first = clip.rect.y0 - y0;
+        if (last > clip.rect.y1 - y0) last = clip.rect.y1 - y0;
+    }
+    clip.rect.x0 = clipped ? clip.rect.x0 - x0 - max_dx : -32767 - 1;
+    clip.rect.x1 = clipped ? clip.rect.x1 - x0 - min_dx : 32767;
+    clip.callback = collect_callback;
+    clip.state = &glyph;
+#endif
+    
+    /* Usually the whole glyph fits in the buffer. If it does not, the
+     * output is computed in bands of rows, decoding the glyph for each. */
+    band = last - first;
+    y = first;
+    while (y < last)
+    {
+        int16_t end = (y + band < last) ? y + band : last;
+        
+        glyph.row_start = y - max_dy;
+        glyph.row_end = end - min_dy;
+        glyph.count = 0;
+        glyph.overflow = false;
+        
+#if MF_USE_CLIPPING
+        if (clipped || band < last - first)
+        {
+            clip.rect.y0 = glyph.row_start;
+            clip.rect.y1 = glyph.row_end;
+            base_callback = mf_clip_callback;
+            base_state = &clip;
+        }
+#endif
+        
+        basewidth = basefont->render_character(basefont, 0, 0, character,
+                                               base_callback, base_state);
+        if (!basewidth)
+            return 0;
+        
+        if (glyph.overflow && band > 1)
+        {
+            band = (band + 1) / 2;
+            continue;
+        }
+        
+        sort_runs(&glyph);
+        write_rows(efont, &glyph, copies, num_copies, x0, y0, y, end,
+                   callback, state);
+        y = end;
+    }
+    
+    if (!basewidth)
+        basewidth = basefont->character_width(basefont, character);
+    
+    if (basewidth && efont->effect == MF_EFFECT_BOLD)
+        basewidth += efont->size;
+    
+    return basewidth;
+}
+
+/* Common initialization of the effect fonts. */
+static void init_effect_font(struct mf_effectfont_s *newfont,
+                             const struct mf_font_s *basefont,
+                             enum mf_effect_t effect)
+{
+    newfont->font = *basefont;
+    newfont->basefont = basefont;
+    newfont->effect = effect;
+    newfont->size = 0;
+    newfont->shadow_x = 0;
+    newfont->shadow_y = 0;
+    newfont->shadow_alpha = 0;
+    
+    newfont->font.character_width = &effect_character_width;
+    newfont->font.render_character = &effect_render_character;
+    newfont->font.render_glyph_ref = 0;
+    newfont->font.kerning_edges = 0;
+}
+
+/* Add to a dimension of the font, limiting it to the range of uint8_t. */
+static uint8_t add_limited(uint8_t value, uint8_t amount)
+{
+    return (value + amount > 255) ? 255 : value + amount;
+}
+
+void mf_bold_font(struct mf_effectfont_s *newfont,
+                  const struct mf_font_s *basefont,
+                  uint8_t weight)
+{
+    if (weight > MF_EFFECT_MAX_OFFSET)
+        weight = MF_EFFECT_MAX_OFFSET;
+    
+    init_effect_font(newfont, basefont, MF_EFFECT_BOLD);
+    newfont->size = weight;
+    
+    newfont->font.width = add_limited(basefont->width, weight);
+    newfont->font.min_x_advance = add_limited(basefont->min_x_advance, weight);
+    newfont->font.max_x_advance = add_limited(basefont->max_x_advance, weight);
+    newfont->font.metrics = 0;
+}
+
+void mf_outline_font(struct mf_effectfont_s *newfont,
+                     const struct mf_font_s *basefont,
+                     uint8_t thickness)
+{
+    if (thickness < 1)
+        thickness = 1;
+    if (thickness > MF_EFFECT_MAX_OUTLINE)
+        thickness = MF_EFFECT_MAX_OUTLINE;
+    
+    init_effect_font(newfont, basefont, MF_EFFECT_OUTLINE);
+    newfont->size = thickness;
+    
+    newfont->font.width = add_limited(basefont->width, 2 * thickness);
+    newfont->font.height = add_limited(basefont->height, 2 * thickness);
+    newfont->font.baseline_x = add_limited(basefont->baseline_x, thickness);
+    newfont->font.baseline_y = add_limited(basefont->baseline_y, thickness);
+}
+
+void mf_shadow_font(struct mf_effectfont_s *newfont,
+                    const struct mf_font_s *basefont,
+                    uint8_t offset_x, uint8_t offset_y,
+                    uint8_t alpha)
+{
+    if (offset_x > MF_EFFECT_MAX_OFFSET)
+        offset_x = MF_EFFECT_MAX_OFFSET;
+    if (offset_y > MF_EFFECT_MAX_OFFSET)
+        offset_y = MF_EFFECT_MAX_OFFSET;
+    
+    init_effect_font(newfont, basefont, MF_EFFECT_SHADOW);
+    newfont->shadow_x = offset_x;
+    newfont->shadow_y = offset_y;
+    newfont->shadow_alpha = alpha;
+    
+    newfont->font.width = add_limited(basefont->width, offset_x);
+    newfont->font.height = add_limited(basefont->height, offset_y);
+    
+    if (alpha != 255)
+        newfont->font.flags &= ~MF_FONT_FLAG_BW;
+}
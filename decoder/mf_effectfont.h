@@ -0,0 +1,77 @@
+/* Generate bold, outlined and shadowed versions of fonts. This can be used
+ * for emphasis without including a separate font for each style. The base
+ * glyph is decoded once into a buffer and the effect is applied one row at
+ * a time, so that each pixel of the result is written only once.
+ */
+
+#ifndef _MF_EFFECTFONT_H_
+#define _MF_EFFECTFONT_H_
+
+#include "mf_font.h"
+
+/* Largest bold width and shadow offset, in pixels. */
+#define MF_EFFECT_MAX_OFFSET 8
+
+/* Largest outline thickness, in pixels. */
+#define MF_EFFECT_MAX_OUTLINE 3
+
+enum mf_effect_t
+{
+    MF_EFFECT_BOLD = 0,
+    MF_EFFECT_OUTLINE,
+    MF_EFFECT_SHADOW
+};
+
+struct mf_effectfont_s
+{
+    struct mf_font_s font;
+    
+    const struct mf_font_s *basefont;
+    enum mf_effect_t effect;
+    uint8_t size; /* Bold width or outline thickness. */
+    uint8_t shadow_x;
+    uint8_t shadow_y;
+    uint8_t shadow_alpha;
+};
+
+/* Make a bold font by widening the glyphs to the right. The characters
+ * become wider by the same amount.
+ *
+ * newfont:  Structure to initialize, usually allocated statically.
+ * basefont: The font to make bold.
+ * weight:   Number of pixels to add, 1 to MF_EFFECT_MAX_OFFSET.
+ */
+MF_EXTERN void mf_bold_font(struct mf_effectfont_s *newfont,
+                            const struct mf_font_s *basefont,
+                            uint8_t weight);
+
+/* Make a font that renders only the outline around the glyphs. Draw the
+ * text first with this font and then with the base font to get outlined
+ * text. The glyph box grows by the thickness on each side and the baseline
+ * moves with it, so draw this font thickness pixels higher than the base
+ * font. The characters keep the widths of the base font.
+ *
+ * newfont:   Structure to initialize, usually allocated statically.
+ * basefont:  The font to outline.
+ * thickness: Width of the outline, 1 to MF_EFFECT_MAX_OUTLINE.
+ */
+MF_EXTERN void mf_outline_font(struct mf_effectfont_s *newfont,
+                               const struct mf_font_s *basefont,
+                               uint8_t thickness);
+
+/* Make a font with a drop shadow below and to the right of the glyphs.
+ * Where the glyph and its shadow overlap, the larger alpha is used. The
+ * characters keep the widths of the base font.
+ *
+ * newfont:  Structure to initialize, usually allocated statically.
+ * basefont: The font to add the shadow to.
+ * offset_x: Horizontal offset of the shadow, 0 to MF_EFFECT_MAX_OFFSET.
+ * offset_y: Vertical offset of the shadow, 0 to MF_EFFECT_MAX_OFFSET.
+ * alpha:    Opaqueness of the shadow, 255 for the same as the text.
+ */
+MF_EXTERN void mf_shadow_font(struct mf_effectfont_s *newfont,
+                              const struct mf_font_s *basefont,
+                              uint8_t offset_x, uint8_t offset_y,
+                              uint8_t alpha);
+
+#endif
@@ -1,8 +1,14 @@
 #include "mf_encoding.h"
 
-#if MF_ENCODING == MF_ENCODING_UTF8
+#if MF_USE_SIMD && defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SIMD_DECODE 1
+#else
+#define HAVE_SIMD_DECODE 0
+#endif
 
-mf_char mf_getchar(mf_str *str)
+/* Decode one UTF-8 character, same as mf_getchar() in UTF-8 mode. */
+static uint16_t utf8_getchar(const char **str)
 {
     uint8_t c;
     uint8_t tmp, seqlen;
@@ -40,24 +46,105 @@ mf_char mf_getchar(mf_str *str)
          */
         seqlen = 2;
         tmp = 0x20;
-        result = 0;
         while ((c & tmp) && (seqlen < 5))
         {
             seqlen++;
             tmp >>= 1;
+        }
+        
+        result = c & (tmp - 1);
+        while (--seqlen)
+        {
+            /* The string ends in the middle of the sequence. Leave the
+             * pointer at the terminating 0. */
+            if (!**str)
+                return c;
             
             result = (result << 6) | (**str & 0x3F);
             (*str)++;
         }
         
-        result = (result << 6) | (**str & 0x3F);
-        (*str)++;
-        
-        result |= (c & (tmp - 1)) << ((seqlen - 1) * 6);
         return result;
     }
 }
 
+uint16_t mf_decode_utf8(const char **str, uint16_t *buffer, uint16_t size)
+{
+    const uint8_t *p = (const uint8_t*)*str;
+    const uint8_t *end;
+    uint16_t count = 0;
+    
+    if (!size)
+        return 0;
+    
+    /* At most size - 1 bytes can be decoded, so only that much of the
+     * string needs to be known to lie before the terminating 0. The
+     * ASCII runs below are only looked for inside it. */
+    end = p;
+    while (end < p + size - 1 && *end)
+        end++;
+    
+    while (count + 1 < size)
+    {
+#if HAVE_SIMD_DECODE
+        /* Check 16 bytes at a time for plain ASCII, and widen them to
+         * 16-bit characters. */
+        if (p + 16 <= end && count + 16 < size)
+        {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)p);
+            if (_mm_movemask_epi8(bytes) == 0)
+            {
+                __m128i zero = _mm_setzero_si128();
+                _mm_storeu_si128((__m128i*)(buffer + count),
+                                 _mm_unpacklo_epi8(bytes, zero));
+                _mm_storeu_si128((__m128i*)(buffer + count + 8),
+                                 _mm_unpackhi_epi8(bytes, zero));
+                count += 16;
+                p += 16;
+                continue;
+            }
+        }
+#endif
+        
+        /* Check four bytes at a time for plain ASCII. None of the bytes
+         * before the end are 0, so only the high bits need checking. */
+        if (p + 4 <= end && count + 4 < size &&
+            ((p[0] | p[1] | p[2] | p[3]) & 0x80) == 0)
+        {
+            buffer[count++] = p[0];
+            buffer[count++] = p[1];
+            buffer[count++] = p[2];
+            buffer[count++] = p[3];
+            p += 4;
+        }
+        else if (*p > 0 && *p < 0x80)
+        {
+            buffer[count++] = *p++;
+        }
+        else if (*p)
+        {
+            *str = (const char*)p;
+            buffer[count++] = utf8_getchar(str);
+            p = (const uint8_t*)*str;
+        }
+        else
+        {
+            break;
+        }
+    }
+    
+    buffer[count] = 0;
+    *str = (const char*)p;
+    return count;
+}
+
+#if MF_ENCODING == MF_ENCODING_UTF8
+
+mf_char mf_getchar(mf_str *str)
+{
+    return utf8_getchar(str);
+}
+
 void mf_rewind(mf_str *str)
 {
     (*str)--;
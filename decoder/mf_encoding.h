@@ -42,4 +42,22 @@ MF_EXTERN mf_char mf_getchar(mf_str *str);
  */
 MF_EXTERN void mf_rewind(mf_str *str);
 
+/* Decodes a UTF-8 string into an array of 16-bit characters. Runs of
+ * ASCII text are converted several bytes at a time. This is available
+ * with all the encodings, so that text stored in UTF-8 can be decoded once
+ * and then laid out with MF_ENCODING_UTF16, without decoding it again on
+ * every pass of the word wrap and justification.
+ *
+ * str:    Pointer to variable holding current location in string. It is
+ *         advanced past the decoded characters, so that a long string can
+ *         be decoded in pieces.
+ * buffer: Array to store the characters to. The characters are followed
+ *         by a terminating 0.
+ * size:   Size of the array, including space for the terminating 0.
+ *
+ * Returns: The number of characters stored, not counting the terminating 0.
+ */
+MF_EXTERN uint16_t mf_decode_utf8(const char **str, uint16_t *buffer,
+                                  uint16_t size);
+
 #endif
@@ -1,4 +1,5 @@
 #include "mf_font.h"
+#include "mf_glyphcache.h"
 #include <stdbool.h>
 
 /* This will be made into a list of included fonts using macro magic. */
@@ -8,6 +9,13 @@
 #include MF_FONT_FILE_NAME
 /* Include fonts end here */
 
+#if MF_USE_GLYPH_CACHE
+#define render_glyph mf_glyph_cache_render
+#else
+#define render_glyph(font, x0, y0, character, callback, state) \
+    (font)->render_character(font, x0, y0, character, callback, state)
+#endif
+
 uint8_t mf_render_character(const struct mf_font_s *font,
                             int16_t x0, int16_t y0,
                             mf_char character,
@@ -15,12 +23,12 @@ uint8_t mf_render_character(const struct mf_font_s *font,
                             void *state)
 {
     uint8_t width;
-    width = font->render_character(font, x0, y0, character, callback, state);
+    width = render_glyph(font, x0, y0, character, callback, state);
     
     if (!width)
     {
-        width = font->render_character(font, x0, y0, font->fallback_character,
-                                       callback, state);
+        width = render_glyph(font, x0, y0, font->fallback_character,
+                             callback, state);
     }
     
     return width;
@@ -30,6 +38,15 @@ uint8_t mf_character_width(const struct mf_font_s *font,
                            mf_char character)
 {
     uint8_t width;
+    
+#if MF_USE_FONT_METRICS
+    if (font->metrics && character >= MF_ASCII_WIDTHS_FIRST &&
+        character <= MF_ASCII_WIDTHS_LAST)
+    {
+        return font->metrics->ascii_widths[character - MF_ASCII_WIDTHS_FIRST];
+    }
+#endif
+    
     width = font->character_width(font, character);
     
     if (!width)
@@ -75,3 +92,70 @@ const struct mf_font_list_s *mf_get_font_list()
     return MF_INCLUDED_FONTS;
 }
 
+
+#if MF_GLYPH_LOOKUP_CACHE
+
+/* One slot in the direct-mapped glyph lookup cache. */
+struct glyph_lookup_entry_s
+{
+    const struct mf_font_s *font;
+    const void *glyph;
+    mf_char character;
+};
+
+static struct glyph_lookup_entry_s glyph_lookup_cache[MF_GLYPH_LOOKUP_CACHE];
+static struct mf_glyph_lookup_stats_s glyph_lookup_stats;
+
+/* Select the cache slot for a character. The font address is mixed in so
+ * that the same character in different fonts does not always collide. */
+static unsigned glyph_lookup_slot(const struct mf_font_s *font,
+                                  mf_char character)
+{
+    unsigned key = (unsigned)(uintptr_t)font / sizeof(void*);
+    key += (uint16_t)character;
+    return key % MF_GLYPH_LOOKUP_CACHE;
+}
+
+bool mf_glyph_lookup_get(const struct mf_font_s *font,
+                         mf_char character, const void **glyph)
+{
+    struct glyph_lookup_entry_s *e;
+    e = &glyph_lookup_cache[glyph_lookup_slot(font, character)];
+    
+    if (e->font == font && e->character == character)
+    {
+        glyph_lookup_stats.hits++;
+        *glyph = e->glyph;
+        return true;
+    }
+    
+    glyph_lookup_stats.misses++;
+    return false;
+}
+
+void mf_glyph_lookup_put(const struct mf_font_s *font,
+                         mf_char character, const void *glyph)
+{
+    struct glyph_lookup_entry_s *e;
+    e = &glyph_lookup_cache[glyph_lookup_slot(font, character)];
+    e->font = font;
+    e->character = character;
+    e->glyph = glyph;
+}
+
+void mf_get_glyph_lookup_stats(struct mf_glyph_lookup_stats_s *stats)
+{
+    *stats = glyph_lookup_stats;
+}
+
+void mf_clear_glyph_lookup_cache()
+{
+    unsigned i;
+    for (i = 0; i < MF_GLYPH_LOOKUP_CACHE; i++)
+        glyph_lookup_cache[i].font = 0;
+    
+    glyph_lookup_stats.hits = 0;
+    glyph_lookup_stats.misses = 0;
+}
+
+#endif
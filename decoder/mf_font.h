@@ -6,6 +6,7 @@
 #define _MF_FONT_H_
 
 #include "mf_encoding.h"
+#include <stdbool.h>
 
 /* Callback function that writes pixels to screen / buffer / whatever.
  *
@@ -18,6 +19,31 @@
 typedef void (*mf_pixel_callback_t) (int16_t x, int16_t y, uint8_t count,
                                      uint8_t alpha, void *state);
 
+struct mf_kerning_table_s;
+
+/* Reference to a glyph that has been looked up in advance, for example
+ * by the "mcufont glyph_runs" command. The meaning of the index depends
+ * on the font format, for rlefont and bwfont it is the position of the
+ * character in the range. */
+struct mf_glyph_ref_s
+{
+    uint8_t range; /* Index of the character range. */
+    uint16_t index; /* Glyph within the range. */
+};
+
+/* Range of characters in mf_font_metrics_s::ascii_widths. */
+#define MF_ASCII_WIDTHS_FIRST 0x20
+#define MF_ASCII_WIDTHS_LAST  0x7E
+
+/* Precomputed metrics of a font, for measuring text quickly. */
+struct mf_font_metrics_s
+{
+    /* Widths of the printable ASCII characters, as returned by
+     * mf_character_width(). Missing characters have the width of the
+     * fallback character. */
+    uint8_t ascii_widths[MF_ASCII_WIDTHS_LAST - MF_ASCII_WIDTHS_FIRST + 1];
+};
+
 /* General information about a font. */
 struct mf_font_s
 {
@@ -59,8 +85,33 @@ struct mf_font_s
                                 mf_char character,
                                 mf_pixel_callback_t callback,
                                 void *state);
+    
+    /* Function to render a glyph by reference, without searching for the
+     * character. NULL if the font does not support glyph references.
+     * Returns the glyph width or 0 if the reference is not valid. */
+    uint8_t (*render_glyph_ref)(const struct mf_font_s *font,
+                                int16_t x0, int16_t y0,
+                                const struct mf_glyph_ref_s *glyph,
+                                mf_pixel_callback_t callback,
+                                void *state);
+    
+    /* Function to get the precomputed kerning edges of a character, or NULL
+     * if the font does not have them. Returns NULL if the character has
+     * no precomputed edges. The format is described in mf_kerning.h. */
+    const uint8_t *(*kerning_edges)(const struct mf_font_s *font,
+                                    mf_char character);
+    
+    /* Kerning pairs from the original font file, or NULL if the font does
+     * not have them. The format is described in mf_kerning.h. */
+    const struct mf_kerning_table_s *kerning_table;
+    
+    /* Precomputed metrics, or NULL if the font was exported without them. */
+    const struct mf_font_metrics_s *metrics;
 };
 
+/* Size in bytes of the precomputed kerning edges of one glyph. */
+#define MF_KERNING_EDGE_BYTES (MF_KERNING_ZONES + 2)
+
 /* The flag definitions for the font.flags field. */
 #define MF_FONT_FLAG_MONOSPACE 0x01
 #define MF_FONT_FLAG_BW        0x02
@@ -115,4 +166,38 @@ MF_EXTERN const struct mf_font_s *mf_find_font(const char *name);
 /* Get the list of included fonts */
 MF_EXTERN const struct mf_font_list_s *mf_get_font_list();
 
+#if MF_GLYPH_LOOKUP_CACHE
+/* Statistics of the glyph lookup cache. */
+struct mf_glyph_lookup_stats_s
+{
+    uint32_t hits;
+    uint32_t misses;
+};
+
+/* Get the hit and miss counts of the glyph lookup cache.
+ *
+ * stats: Pointer to a structure that will be filled in.
+ */
+MF_EXTERN void mf_get_glyph_lookup_stats(struct mf_glyph_lookup_stats_s *stats);
+
+/* Empty the glyph lookup cache and reset the statistics. Only needed if you
+ * construct font structures in RAM and reuse the memory for another font.
+ */
+MF_EXTERN void mf_clear_glyph_lookup_cache();
+
+/* Internal functions used by the font decoders, don't use these directly.
+ *
+ * The glyph pointer is an opaque value defined by the font format. A cached
+ * NULL glyph means that the character is known to be missing from the font,
+ * so that the fallback character can be found without a second search.
+ *
+ * mf_glyph_lookup_get returns true if the character was found in the cache.
+ */
+MF_EXTERN bool mf_glyph_lookup_get(const struct mf_font_s *font,
+                                   mf_char character, const void **glyph);
+
+MF_EXTERN void mf_glyph_lookup_put(const struct mf_font_s *font,
+                                   mf_char character, const void *glyph);
+#endif
+
 #endif
\ No newline at end of file
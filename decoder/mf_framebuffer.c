@@ -0,0 +1,475 @@
+#include "mf_framebuffer.h"
+
+#if MF_USE_FRAMEBUFFER
+
+#if MF_USE_SIMD && defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SIMD_BLEND 1
+#else
+#define HAVE_SIMD_BLEND 0
+#endif
+
+/* Blend foreground over background, both in the same range. */
+static uint8_t blend(uint8_t bg, uint8_t fg, uint8_t alpha)
+{
+    return ((unsigned)bg * (255 - alpha) + (unsigned)fg * alpha + 127) / 255;
+}
+
+#if HAVE_SIMD_BLEND
+/* Blend a repeating 16-byte foreground pattern over the bytes at p, 16 bytes
+ * at a time. Gives the same result as blend() for each byte. Returns the
+ * number of bytes processed, the caller handles the rest. */
+static uint16_t blend_bytes_simd(uint8_t *p, uint16_t count,
+                                 const uint8_t *pattern, uint8_t alpha)
+{
+    __m128i zero, one, inv, fg, fg_lo, fg_hi, bg, lo, hi;
+    uint16_t done;
+    
+    zero = _mm_setzero_si128();
+    one = _mm_set1_epi16(1);
+    inv = _mm_set1_epi16(255 - alpha);
+    
+    /* Precompute fg * alpha + 127 for both halves of the pattern. */
+    fg = _mm_loadu_si128((const __m128i*)pattern);
+    fg_lo = _mm_mullo_epi16(_mm_unpacklo_epi8(fg, zero), _mm_set1_epi16(alpha));
+    fg_hi = _mm_mullo_epi16(_mm_unpackhi_epi8(fg, zero), _mm_set1_epi16(alpha));
+    fg_lo = _mm_add_epi16(fg_lo, _mm_set1_epi16(127));
+    fg_hi = _mm_add_epi16(fg_hi, _mm_set1_epi16(127));
+    
+    for (done = 0; count - done >= 16; done += 16)
+    {
+        bg = _mm_loadu_si128((const __m128i*)(p + done));
+        lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(bg, zero), inv),
+                           fg_lo);
+        hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(bg, zero), inv),
+                           fg_hi);
+        
+        /* x / 255 == (x + 1 + (x >> 8)) >> 8 for x < 65535. */
+        lo = _mm_add_epi16(_mm_add_epi16(lo, one), _mm_srli_epi16(lo, 8));
+        hi = _mm_add_epi16(_mm_add_epi16(hi, one), _mm_srli_epi16(hi, 8));
+        lo = _mm_srli_epi16(lo, 8);
+        hi = _mm_srli_epi16(hi, 8);
+        
+        _mm_storeu_si128((__m128i*)(p + done), _mm_packus_epi16(lo, hi));
+    }
+    
+    return done;
+}
+#endif
+
+static void fill_a8(uint8_t *p, uint8_t count, uint8_t alpha, uint8_t color)
+{
+#if HAVE_SIMD_BLEND
+    uint8_t pattern[16];
+    uint8_t i;
+    uint16_t done;
+#endif
+    
+    if (alpha == 255)
+    {
+        while (count--)
+            *p++ = color;
+    }
+    else
+    {
+#if HAVE_SIMD_BLEND
+        if (count >= 16)
+        {
+            for (i = 0; i < 16; i++)
+                pattern[i] = color;
+            
+            done = blend_bytes_simd(p, count, pattern, alpha);
+            p += done;
+            count -= done;
+        }
+#endif
+        
+        while (count--)
+        {
+            *p = blend(*p, color, alpha);
+            p++;
+        }
+    }
+}
+
+static void fill_a4(uint8_t *row, int16_t x, uint8_t count, uint8_t alpha,
+                    uint8_t color)
+{
+    uint8_t *p, value;
+    
+    while (count--)
+    {
+        p = row + x / 2;
+        if (x & 1)
+        {
+            value = blend(*p & 0x0F, color, alpha);
+            *p = (*p & 0xF0) | value;
+        }
+        else
+        {
+            value = blend(*p >> 4, color, alpha);
+            *p = (*p & 0x0F) | (value << 4);
+        }
+        x++;
+    }
+}
+
+static void fill_1bpp(uint8_t *row, int16_t x, uint8_t count, uint8_t alpha,
+                      uint8_t color)
+{
+    uint8_t *p;
+    uint8_t mask;
+    
+    /* There is no blending in 1 bit per pixel, just threshold it. */
+    if (alpha < 128)
+        return;
+    
+    /* Write the partial bytes bit-by-bit and full bytes at once. */
+    while (count)
+    {
+        p = row + x / 8;
+        if ((x & 7) == 0 && count >= 8)
+        {
+            *p = color ? 0xFF : 0x00;
+            x += 8;
+            count -= 8;
+        }
+        else
+        {
+            mask = 0x80 >> (x & 7);
+            if (color)
+                *p |= mask;
+            else
+                *p &= ~mask;
+            x++;
+            count--;
+        }
+    }
+}
+
+static void fill_pages(uint8_t *p, uint8_t count, uint8_t alpha,
+                       uint8_t color, uint8_t mask)
+{
+    /* Threshold the same way as in 1 bit per pixel format. */
+    if (alpha < 128)
+        return;
+    
+    if (color)
+    {
+        while (count--)
+            *p++ |= mask;
+    }
+    else
+    {
+        while (count--)
+            *p++ &= ~mask;
+    }
+}
+
+static void fill_rgb565(uint16_t *p, uint8_t count, uint8_t alpha,
+                        uint16_t color)
+{
+    uint8_t r, g, b;
+    
+    if (alpha == 255)
+    {
+        while (count--)
+            *p++ = color;
+        return;
+    }
+    
+    while (count--)
+    {
+        r = blend(*p >> 11, color >> 11, alpha);
+        g = blend((*p >> 5) & 0x3F, (color >> 5) & 0x3F, alpha);
+        b = blend(*p & 0x1F, color & 0x1F, alpha);
+        *p++ = ((uint16_t)r << 11) | ((uint16_t)g << 5) | b;
+    }
+}
+
+static void fill_rgb888(uint8_t *p, uint8_t count, uint8_t alpha,
+                        uint32_t color)
+{
+    uint8_t r = color >> 16;
+    uint8_t g = color >> 8;
+    uint8_t b = color;
+    
+    if (alpha == 255)
+    {
+        while (count--)
+        {
+            p[0] = r;
+            p[1] = g;
+            p[2] = b;
+            p += 3;
+        }
+        return;
+    }
+    
+    while (count--)
+    {
+        p[0] = blend(p[0], r, alpha);
+        p[1] = blend(p[1], g, alpha);
+        p[2] = blend(p[2], b, alpha);
+        p += 3;
+    }
+}
+
+static void fill_argb8888(uint32_t *p, uint8_t count, uint8_t alpha,
+                          uint32_t color)
+{
+    uint8_t *bytes, *fg;
+    uint8_t i;
+#if HAVE_SIMD_BLEND
+    uint32_t pattern[4];
+    uint16_t done;
+#endif
+    
+    if (alpha == 255)
+    {
+        while (count--)
+            *p++ = color;
+        return;
+    }
+    
+#if HAVE_SIMD_BLEND
+    if (count >= 4)
+    {
+        pattern[0] = pattern[1] = pattern[2] = pattern[3] = color;
+        done = blend_bytes_simd((uint8_t*)p, (uint16_t)count * 4,
+                                (const uint8_t*)pattern, alpha);
+        p += done / 4;
+        count -= done / 4;
+    }
+#endif
+    
+    /* Blend each channel separately, in whatever byte order they are. */
+    fg = (uint8_t*)&color;
+    while (count--)
+    {
+        bytes = (uint8_t*)p++;
+        for (i = 0; i < 4; i++)
+            bytes[i] = blend(bytes[i], fg[i], alpha);
+    }
+}
+
+/* Write a run that has already been clipped and mapped through alpha_lut. */
+static void fill_run(const struct mf_framebuffer_s *fb, int16_t x, int16_t y,
+                     uint8_t count, uint8_t alpha)
+{
+    uint8_t *row = fb->buffer + (uint32_t)fb->stride * y;
+    
+    switch (fb->format)
+    {
+        case MF_PIXFMT_A8:
+            fill_a8(row + x, count, alpha, fb->color);
+            break;
+        
+        case MF_PIXFMT_A4:
+            fill_a4(row, x, count, alpha, fb->color);
+            break;
+        
+        case MF_PIXFMT_1BPP:
+            fill_1bpp(row, x, count, alpha, fb->color);
+            break;
+        
+        case MF_PIXFMT_RGB565:
+            fill_rgb565((uint16_t*)row + x, count, alpha, fb->color);
+            break;
+        
+        case MF_PIXFMT_RGB888:
+            fill_rgb888(row + 3 * x, count, alpha, fb->color);
+            break;
+        
+        case MF_PIXFMT_PAGES:
+            row = fb->buffer + (uint32_t)fb->stride * (y >> 3);
+            fill_pages(row + x, count, alpha, fb->color, 1 << (y & 7));
+            break;
+        
+        case MF_PIXFMT_ARGB8888:
+            fill_argb8888((uint32_t*)row + x, count, alpha, fb->color);
+            break;
+    }
+}
+
+void mf_framebuffer_fill(const struct mf_framebuffer_s *fb,
+                         int16_t x, int16_t y, uint8_t count,
+                         uint8_t alpha)
+{
+    int16_t x_end = x + count;
+    
+    if (fb->alpha_lut)
+        alpha = fb->alpha_lut[alpha];
+    
+    if (alpha == 0 || y < fb->clip_y0 || y >= fb->clip_y1)
+        return;
+    
+    if (x < fb->clip_x0)
+        x = fb->clip_x0;
+    if (x_end > fb->clip_x1)
+        x_end = fb->clip_x1;
+    if (x >= x_end)
+        return;
+    
+    fill_run(fb, x, y, x_end - x, alpha);
+}
+
+void mf_framebuffer_fill_column(const struct mf_framebuffer_s *fb,
+                                int16_t x, int16_t y, uint8_t count,
+                                uint8_t alpha)
+{
+    int16_t y_end = y + count;
+    uint8_t *p;
+    uint8_t mask;
+    
+    if (fb->alpha_lut)
+        alpha = fb->alpha_lut[alpha];
+    
+    if (alpha == 0 || x < fb->clip_x0 || x >= fb->clip_x1)
+        return;
+    
+    if (y < fb->clip_y0)
+        y = fb->clip_y0;
+    if (y_end > fb->clip_y1)
+        y_end = fb->clip_y1;
+    
+    if (fb->format == MF_PIXFMT_PAGES)
+    {
+        /* Set up to 8 rows of the column with a single byte write. */
+        if (alpha < 128)
+            return;
+        
+        while (y < y_end)
+        {
+            p = fb->buffer + (uint32_t)fb->stride * (y >> 3) + x;
+            mask = 0xFF << (y & 7);
+            if (y_end - (y & ~7) < 8)
+                mask &= 0xFF >> (8 - (y_end & 7));
+            
+            if (fb->color)
+                *p |= mask;
+            else
+                *p &= ~mask;
+            
+            y = (y & ~7) + 8;
+        }
+        return;
+    }
+    
+    while (y < y_end)
+        fill_run(fb, x, y++, 1, alpha);
+}
+
+void mf_framebuffer_fill_rect(const struct mf_framebuffer_s *fb,
+                              int16_t x, int16_t y, uint16_t width,
+                              uint16_t height, uint8_t alpha)
+{
+    int32_t x_end = (int32_t)x + width;
+    int32_t y_end = (int32_t)y + height;
+    int16_t pos;
+    uint8_t *row;
+    uint8_t part, mask;
+    
+    if (fb->alpha_lut)
+        alpha = fb->alpha_lut[alpha];
+    
+    if (alpha == 0)
+        return;
+    
+    if (x < fb->clip_x0)
+        x = fb->clip_x0;
+    if (x_end > fb->clip_x1)
+        x_end = fb->clip_x1;
+    if (y < fb->clip_y0)
+        y = fb->clip_y0;
+    if (y_end > fb->clip_y1)
+        y_end = fb->clip_y1;
+    
+    while (y < y_end)
+    {
+        if (fb->format == MF_PIXFMT_PAGES)
+        {
+            /* Set all the rows of the rectangle that are in the same page
+             * with a single byte write. */
+            row = fb->buffer + (uint32_t)fb->stride * (y >> 3);
+            mask = 0xFF << (y & 7);
+            if (y_end - (y & ~7) < 8)
+                mask &= 0xFF >> (8 - (y_end & 7));
+            
+            for (pos = x; pos < x_end; pos += part)
+            {
+                part = (x_end - pos > 255) ? 255 : x_end - pos;
+                fill_pages(row + pos, part, alpha, fb->color, mask);
+            }
+            
+            y = (y & ~7) + 8;
+        }
+        else
+        {
+            for (pos = x; pos < x_end; pos += part)
+            {
+                part = (x_end - pos > 255) ? 255 : x_end - pos;
+                fill_run(fb, pos, y, part, alpha);
+            }
+            
+            y++;
+        }
+    }
+}
+
+void mf_framebuffer_callback(int16_t x, int16_t y, uint8_t count,
+                             uint8_t alpha, void *state)
+{
+    mf_framebuffer_fill(state, x, y, count, alpha);
+}
+
+uint8_t mf_framebuffer_render_character(const struct mf_font_s *font,
+                                        const struct mf_framebuffer_s *fb,
+                                        int16_t x0, int16_t y0,
+                                        mf_char character)
+{
+    return mf_render_character(font, x0, y0, character,
+                               mf_framebuffer_callback, (void*)fb);
+}
+
+/* State for rendering a line of text into a framebuffer. */
+struct framebuffer_line_s
+{
+    const struct mf_font_s *font;
+    const struct mf_framebuffer_s *fb;
+};
+
+static uint8_t framebuffer_character_callback(int16_t x0, int16_t y0,
+                                              mf_char character,
+                                              void *state)
+{
+    struct framebuffer_line_s *s = state;
+    return mf_framebuffer_render_character(s->font, s->fb, x0, y0, character);
+}
+
+void mf_framebuffer_render_aligned(const struct mf_font_s *font,
+                                   const struct mf_framebuffer_s *fb,
+                                   int16_t x0, int16_t y0,
+                                   enum mf_align_t align,
+                                   mf_str text, uint16_t count)
+{
+    struct framebuffer_line_s s;
+    s.font = font;
+    s.fb = fb;
+    mf_render_aligned(font, x0, y0, align, text, count,
+                      framebuffer_character_callback, &s);
+}
+
+void mf_framebuffer_render_justified(const struct mf_font_s *font,
+                                     const struct mf_framebuffer_s *fb,
+                                     int16_t x0, int16_t y0, int16_t width,
+                                     mf_str text, uint16_t count)
+{
+    struct framebuffer_line_s s;
+    s.font = font;
+    s.fb = fb;
+    mf_render_justified(font, x0, y0, width, text, count,
+                        framebuffer_character_callback, &s);
+}
+
+#endif
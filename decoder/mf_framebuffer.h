@@ -0,0 +1,118 @@
+/* Rendering directly into a memory framebuffer. The rlefont and bwfont
+ * decoders recognize the framebuffer target and write the pixels without
+ * calling through a function pointer for each run.
+ */
+
+#ifndef _MF_FRAMEBUFFER_H_
+#define _MF_FRAMEBUFFER_H_
+
+#include "mf_font.h"
+#include "mf_justify.h"
+
+/* Supported pixel formats of the framebuffer. */
+enum mf_pixel_format_t
+{
+    MF_PIXFMT_A8 = 0,   /* 8 bits per pixel grayscale or alpha. */
+    MF_PIXFMT_A4,       /* 4 bits per pixel, left pixel in the high nibble. */
+    MF_PIXFMT_1BPP,     /* 1 bit per pixel, left pixel in the MSB. */
+    MF_PIXFMT_RGB565,   /* 16 bits per pixel, in native byte order. */
+    MF_PIXFMT_RGB888,   /* 24 bits per pixel, in R, G, B byte order. */
+    MF_PIXFMT_PAGES,    /* 1 bit per pixel, vertical bytes of 8 rows with
+                         * the top pixel in the LSB (SSD1306, ST7565). */
+    MF_PIXFMT_ARGB8888  /* 32 bits per pixel, 0xAARRGGBB in native order. */
+};
+
+/* Description of the target buffer. */
+struct mf_framebuffer_s
+{
+    /* Pointer to the pixel at (0, 0). For RGB565 and ARGB8888, must be
+     * aligned to the pixel size. */
+    uint8_t *buffer;
+    
+    /* Number of bytes from the start of one row to the start of the next.
+     * For MF_PIXFMT_PAGES, the number of bytes per page of 8 rows. */
+    uint16_t stride;
+    
+    /* Format of the pixels in the buffer. */
+    enum mf_pixel_format_t format;
+    
+    /* Foreground color, in the pixel format of the buffer:
+     * A8: 0-255, A4: 0-15, 1BPP and PAGES: 0-1, RGB565: 16-bit value,
+     * RGB888: 0xRRGGBB, ARGB8888: 0xAARRGGBB. */
+    uint32_t color;
+    
+    /* Clip rectangle. Pixels outside it are not written. The left and top
+     * edges are inclusive, right and bottom edges exclusive. The clip
+     * rectangle must lie inside the buffer. */
+    int16_t clip_x0;
+    int16_t clip_y0;
+    int16_t clip_x1;
+    int16_t clip_y1;
+    
+    /* Optional table that maps the alpha values from the font to the
+     * blending weights, to correct for the gamma and contrast of the
+     * display. NULL for linear blending. The mcufont tool can generate
+     * the table with the gamma_table command. */
+    const uint8_t *alpha_lut;
+};
+
+/* Blend a horizontal run of pixels into the framebuffer.
+ * Has the same parameters as mf_pixel_callback_t.
+ */
+MF_EXTERN void mf_framebuffer_fill(const struct mf_framebuffer_s *fb,
+                                   int16_t x, int16_t y, uint8_t count,
+                                   uint8_t alpha);
+
+/* Blend a vertical run of count pixels, starting at (x, y) and going
+ * down, into the framebuffer. Used by column-major fonts.
+ */
+MF_EXTERN void mf_framebuffer_fill_column(const struct mf_framebuffer_s *fb,
+                                          int16_t x, int16_t y, uint8_t count,
+                                          uint8_t alpha);
+
+/* Blend a rectangle of width x height pixels with the upper left corner
+ * at (x, y) into the framebuffer. Used by scaled fonts to write all the
+ * output rows of a pixel run at once.
+ */
+MF_EXTERN void mf_framebuffer_fill_rect(const struct mf_framebuffer_s *fb,
+                                        int16_t x, int16_t y, uint16_t width,
+                                        uint16_t height, uint8_t alpha);
+
+/* Pixel callback that writes to a framebuffer. Pass a pointer to the
+ * struct mf_framebuffer_s as the state. This works with any font type,
+ * but the built-in decoders detect it and call mf_framebuffer_fill
+ * directly.
+ */
+MF_EXTERN void mf_framebuffer_callback(int16_t x, int16_t y, uint8_t count,
+                                       uint8_t alpha, void *state);
+
+/* Render a single character into the framebuffer.
+ *
+ * font:      Pointer to the font definition.
+ * fb:        Target framebuffer.
+ * x0, y0:    Upper left corner of the target area.
+ * character: The character code (unicode) to render.
+ *
+ * Returns width of the character.
+ */
+MF_EXTERN uint8_t mf_framebuffer_render_character(
+    const struct mf_font_s *font, const struct mf_framebuffer_s *fb,
+    int16_t x0, int16_t y0, mf_char character);
+
+/* Render a single line of aligned text into the framebuffer.
+ * See mf_render_aligned for the description of the parameters.
+ */
+MF_EXTERN void mf_framebuffer_render_aligned(
+    const struct mf_font_s *font, const struct mf_framebuffer_s *fb,
+    int16_t x0, int16_t y0, enum mf_align_t align,
+    mf_str text, uint16_t count);
+
+/* Render a single line of justified text into the framebuffer.
+ * See mf_render_justified for the description of the parameters.
+ */
+MF_EXTERN void mf_framebuffer_render_justified(
+    const struct mf_font_s *font, const struct mf_framebuffer_s *fb,
+    int16_t x0, int16_t y0, int16_t width,
+    mf_str text, uint16_t count);
+
+#endif
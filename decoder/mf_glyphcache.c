@@ -0,0 +1,310 @@
+#include "mf_glyphcache.h"
+#include "mf_framebuffer.h"
+
+#if MF_USE_GLYPH_CACHE
+
+/* Header of one cached glyph in the arena. It is followed by the pixel
+ * runs of the glyph. */
+struct cache_entry_s
+{
+    const struct mf_font_s *font;
+    uint32_t last_used;
+    uint16_t run_count;
+    mf_char character;
+    uint8_t width;
+};
+
+/* One run of pixels, relative to the upper left corner of the glyph. */
+struct cache_run_s
+{
+    uint8_t x;
+    uint8_t y;
+    uint8_t count;
+    uint8_t alpha;
+};
+
+/* Alignment required for the entry headers. */
+#define ENTRY_ALIGN sizeof(union { void *p; uint32_t u; })
+
+/* State of the cache. The entries are stored back-to-back in the arena,
+ * and the entry currently being recorded is always the last one. */
+struct glyph_cache_s
+{
+    /* Direct-mapped index from the font and character to the offset of
+     * the entry in the arena, plus one. Zero marks an empty slot. Every
+     * complete entry has its own slot, so a new glyph replaces the entry
+     * that was stored in its slot. */
+    uint32_t index[MF_GLYPH_CACHE_SLOTS];
+    
+    uint8_t *arena;
+    uint32_t size;
+    uint32_t used; /* Bytes in the complete entries. */
+    uint32_t pending; /* Bytes in the entry being recorded. */
+    uint32_t clock; /* Incremented on every access, for the LRU order. */
+    struct mf_glyph_cache_stats_s stats;
+};
+
+static struct glyph_cache_s cache;
+
+/* State for recording a glyph while it is being rendered. */
+struct record_s
+{
+    mf_pixel_callback_t callback;
+    void *state;
+    int16_t x0;
+    int16_t y0;
+    uint16_t run_count;
+    bool failed;
+};
+
+/* Size of an entry in the arena, rounded up to keep the headers aligned. */
+static uint32_t entry_size(uint16_t run_count)
+{
+    uint32_t size = sizeof(struct cache_entry_s);
+    size += (uint32_t)run_count * sizeof(struct cache_run_s);
+    return (size + ENTRY_ALIGN - 1) / ENTRY_ALIGN * ENTRY_ALIGN;
+}
+
+static struct cache_entry_s *entry_at(uint32_t pos)
+{
+    return (struct cache_entry_s*)(cache.arena + pos);
+}
+
+/* Select the index slot for a character. The font address is mixed in
+ * the same way as in the glyph lookup cache. */
+static unsigned cache_slot(const struct mf_font_s *font, mf_char character)
+{
+    unsigned key = (unsigned)(uintptr_t)font / sizeof(void*);
+    key += (uint16_t)character;
+    return key % MF_GLYPH_CACHE_SLOTS;
+}
+
+/* Find the cached entry for a character, or NULL if not in cache. */
+static struct cache_entry_s *find_entry(const struct mf_font_s *font,
+                                        mf_char character)
+{
+    struct cache_entry_s *e;
+    uint32_t pos = cache.index[cache_slot(font, character)];
+    
+    if (!pos)
+        return 0;
+    
+    e = entry_at(pos - 1);
+    if (e->font == font && e->character == character)
+        return e;
+    
+    return 0;
+}
+
+/* Drop the complete entry at the given offset, and move the following
+ * entries down over it. */
+static void remove_entry(uint32_t pos)
+{
+    const struct cache_entry_s *e = entry_at(pos);
+    uint32_t size, end;
+    uint8_t *dest, *src;
+    unsigned i;
+    
+    size = entry_size(e->run_count);
+    cache.index[cache_slot(e->font, e->character)] = 0;
+    
+    for (i = 0; i < MF_GLYPH_CACHE_SLOTS; i++)
+    {
+        if (cache.index[i] > pos)
+            cache.index[i] -= size;
+    }
+    
+    /* Avoids a dependency on libc */
+    end = cache.used + cache.pending;
+    dest = cache.arena + pos;
+    src = dest + size;
+    while (src < cache.arena + end)
+        *dest++ = *src++;
+    
+    cache.used -= size;
+    cache.stats.evictions++;
+    cache.stats.glyphs--;
+}
+
+/* Drop the least recently used complete entry. Returns false if there is
+ * nothing to drop. */
+static bool evict_entry()
+{
+    uint32_t pos, lru_pos = 0;
+    uint32_t lru_time = 0;
+    bool found = false;
+    unsigned i;
+    
+    for (i = 0; i < MF_GLYPH_CACHE_SLOTS; i++)
+    {
+        pos = cache.index[i];
+        if (pos && (!found || entry_at(pos - 1)->last_used < lru_time))
+        {
+            found = true;
+            lru_pos = pos - 1;
+            lru_time = entry_at(lru_pos)->last_used;
+        }
+    }
+    
+    if (!found)
+        return false;
+    
+    remove_entry(lru_pos);
+    return true;
+}
+
+/* Make room for the pending entry to grow to the given size. */
+static bool make_room(uint32_t size)
+{
+    while (cache.used + size > cache.size)
+    {
+        if (!evict_entry())
+            return false;
+    }
+    
+    return true;
+}
+
+/* Pixel callback that passes the pixels on and records them. */
+static void record_callback(int16_t x, int16_t y, uint8_t count,
+                            uint8_t alpha, void *state)
+{
+    struct record_s *r = state;
+    struct cache_run_s *run;
+    int16_t dx = x - r->x0;
+    int16_t dy = y - r->y0;
+    
+    r->callback(x, y, count, alpha, r->state);
+    
+    if (r->failed)
+        return;
+    
+    /* Glyphs that do not fit in the 8-bit coordinates are not cached. */
+    if (dx < 0 || dx > 255 || dy < 0 || dy > 255 ||
+        !make_room(entry_size(r->run_count + 1)))
+    {
+        r->failed = true;
+        return;
+    }
+    
+    run = (struct cache_run_s*)(entry_at(cache.used) + 1) + r->run_count;
+    run->x = dx;
+    run->y = dy;
+    run->count = count;
+    run->alpha = alpha;
+    r->run_count++;
+    cache.pending = entry_size(r->run_count);
+}
+
+/* Render a cached glyph. */
+static void replay_entry(const struct cache_entry_s *e,
+                         int16_t x0, int16_t y0,
+                         mf_pixel_callback_t callback,
+                         void *state)
+{
+    const struct cache_run_s *run = (const struct cache_run_s*)(e + 1);
+    uint16_t i;
+    
+#if MF_USE_FRAMEBUFFER
+    if (callback == mf_framebuffer_callback)
+    {
+        for (i = 0; i < e->run_count; i++, run++)
+        {
+            mf_framebuffer_fill(state, x0 + run->x, y0 + run->y,
+                                run->count, run->alpha);
+        }
+        return;
+    }
+#endif
+    
+    for (i = 0; i < e->run_count; i++, run++)
+    {
+        callback(x0 + run->x, y0 + run->y, run->count, run->alpha, state);
+    }
+}
+
+uint8_t mf_glyph_cache_render(const struct mf_font_s *font,
+                              int16_t x0, int16_t y0,
+                              mf_char character,
+                              mf_pixel_callback_t callback,
+                              void *state)
+{
+    struct cache_entry_s *e;
+    struct record_s rec;
+    uint8_t width;
+    unsigned slot;
+    
+    if (!cache.arena)
+    {
+        return font->render_character(font, x0, y0, character,
+                                      callback, state);
+    }
+    
+    e = find_entry(font, character);
+    if (e)
+    {
+        cache.stats.hits++;
+        e->last_used = ++cache.clock;
+        replay_entry(e, x0, y0, callback, state);
+        return e->width;
+    }
+    
+    /* The new glyph takes the slot of the entry that is stored there. */
+    slot = cache_slot(font, character);
+    if (cache.index[slot])
+        remove_entry(cache.index[slot] - 1);
+    
+    /* Decode the glyph normally, and record it at the end of the arena. */
+    cache.stats.misses++;
+    rec.callback = callback;
+    rec.state = state;
+    rec.x0 = x0;
+    rec.y0 = y0;
+    rec.run_count = 0;
+    rec.failed = !make_room(entry_size(0));
+    cache.pending = entry_size(0);
+    
+    width = font->render_character(font, x0, y0, character,
+                                   record_callback, &rec);
+    
+    if (!rec.failed)
+    {
+        e = entry_at(cache.used);
+        e->font = font;
+        e->last_used = ++cache.clock;
+        e->run_count = rec.run_count;
+        e->character = character;
+        e->width = width;
+        cache.index[slot] = cache.used + 1;
+        cache.used += entry_size(rec.run_count);
+        cache.stats.glyphs++;
+    }
+    
+    cache.pending = 0;
+    return width;
+}
+
+void mf_glyph_cache_init(void *arena, uint32_t size)
+{
+    unsigned i;
+    for (i = 0; i < MF_GLYPH_CACHE_SLOTS; i++)
+        cache.index[i] = 0;
+    
+    cache.arena = arena;
+    cache.size = size;
+    cache.used = 0;
+    cache.pending = 0;
+    cache.clock = 0;
+    cache.stats.hits = 0;
+    cache.stats.misses = 0;
+    cache.stats.evictions = 0;
+    cache.stats.glyphs = 0;
+}
+
+void mf_get_glyph_cache_stats(struct mf_glyph_cache_stats_s *stats)
+{
+    *stats = cache.stats;
+    stats->bytes_used = cache.used;
+}
+
+#endif
@@ -0,0 +1,56 @@
+/* Cache of decoded glyphs. Stores the pixel runs of recently rendered
+ * glyphs in a memory area given by the caller, so that drawing the same
+ * glyph again does not need to decompress it. Works for all font types.
+ */
+
+#ifndef _MF_GLYPHCACHE_H_
+#define _MF_GLYPHCACHE_H_
+
+#include "mf_font.h"
+
+/* Statistics of the glyph cache. */
+struct mf_glyph_cache_stats_s
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    
+    /* Number of glyphs and bytes currently stored. */
+    uint16_t glyphs;
+    uint32_t bytes_used;
+};
+
+#if MF_USE_GLYPH_CACHE
+
+/* Give the cache a memory area to use, and empty it. Glyphs rendered after
+ * this through mf_render_character are stored in the cache. When it gets
+ * full, the least recently used glyphs are dropped. A glyph also replaces
+ * the one that has the same slot in the index, see MF_GLYPH_CACHE_SLOTS.
+ * Pass NULL to stop using the cache.
+ *
+ * The cache is not reentrant: the pixel callback may not render
+ * characters itself.
+ *
+ * arena: Memory to store the glyphs in. Must be aligned for a pointer.
+ * size:  Size of the memory area in bytes.
+ */
+MF_EXTERN void mf_glyph_cache_init(void *arena, uint32_t size);
+
+/* Get the hit and miss counts and the current usage of the glyph cache.
+ *
+ * stats: Pointer to a structure that will be filled in.
+ */
+MF_EXTERN void mf_get_glyph_cache_stats(struct mf_glyph_cache_stats_s *stats);
+
+/* Internal function used by mf_render_character, don't use directly.
+ * Renders the character from the cache, or decodes and stores it.
+ */
+MF_EXTERN uint8_t mf_glyph_cache_render(const struct mf_font_s *font,
+                                        int16_t x0, int16_t y0,
+                                        mf_char character,
+                                        mf_pixel_callback_t callback,
+                                        void *state);
+
+#endif
+
+#endif
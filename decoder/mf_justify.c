@@ -51,7 +51,7 @@ int16_t mf_get_string_width(const struct mf_font_s *font, mf_str text,
     while (count-- && *text)
     {
         c2 = mf_getchar(&text);
-
+        
         if (c2 == '\t')
         {
 #if MF_USE_TABS
@@ -65,7 +65,7 @@ int16_t mf_get_string_width(const struct mf_font_s *font, mf_str text,
         
         if (kern && c1 != 0)
             result += mf_compute_kerning(font, c1, c2);
-
+        
         result += mf_character_width(font, c2);
         c1 = c2;
     }
@@ -73,35 +73,77 @@ int16_t mf_get_string_width(const struct mf_font_s *font, mf_str text,
     return result;
 }
 
-/* Return the length of the string without trailing spaces. */
-static uint16_t strip_spaces(mf_str text, uint16_t count, mf_char *last_char)
+/* Returns true if the character is a justification point, i.e. expands
+ * when the text is being justified. */
+static bool is_justify_space(uint16_t c)
+{
+    return c == ' ' || c == 0xA0;
+}
+
+/* Returns true if the character is left out at the end of a line. */
+static bool is_trailing_space(uint16_t c)
+{
+    return c == ' ' || c == 0xA0 || c == '\n' || c == '\r' || c == '\t';
+}
+
+void mf_measure_line(const struct mf_font_s *font,
+                     mf_str text, uint16_t count, bool kern,
+                     struct mf_line_metrics_s *metrics)
 {
-    uint16_t i = 0, result = 0;
-    mf_char tmp = 0;
+    int16_t width = 0, kerned_width = 0;
+    uint16_t i = 0, spaces = 0, tabs = 0;
+    mf_char c, c1 = 0, c2;
+    
+    metrics->count = 0;
+    metrics->width = 0;
+    metrics->kerned_width = 0;
+    metrics->spaces = 0;
+    metrics->tabs = 0;
+    c = 0;
     
     if (!count)
         count = 0xFFFF;
     
     while (count-- && *text)
     {
+        c = c2 = mf_getchar(&text);
         i++;
-        tmp = mf_getchar(&text);
-        if (tmp != ' ' && tmp != 0xA0 && tmp != '\n' &&
-            tmp != '\r' && tmp != '\t')
+        
+        if (c2 == '\t')
         {
-            result = i;
+            tabs++;
+#if MF_USE_TABS
+            width = mf_round_to_tab(font, 0, width);
+            kerned_width = mf_round_to_tab(font, 0, kerned_width);
+            c1 = ' ';
+            continue;
+#else
+            c2 = ' ';
+#endif
+        }
+        
+        if (kern && c1 != 0)
+            kerned_width += mf_compute_kerning(font, c1, c2);
+        
+        width += mf_character_width(font, c2);
+        kerned_width += mf_character_width(font, c2);
+        c1 = c2;
+        
+        if (is_justify_space(c2))
+            spaces++;
+        
+        /* Everything up to the last visible character is included. */
+        if (!is_trailing_space(c))
+        {
+            metrics->count = i;
+            metrics->width = width;
+            metrics->kerned_width = kerned_width;
+            metrics->spaces = spaces;
+            metrics->tabs = tabs;
         }
     }
     
-    if (last_char)
-    {
-        if (!*text)
-            *last_char = 0;
-        else
-            *last_char = tmp;
-    }
-    
-    return result;
+    metrics->last_char = *text ? c : 0;
 }
 
 /* Render left-aligned string, left edge at x0. */
@@ -132,7 +174,7 @@ static void render_left(const struct mf_font_s *font,
         
         if (c1 != 0)
             x += mf_compute_kerning(font, c1, c2);
-
+        
         x += callback(x, y0, c2, state);
         c1 = c2;
     }
@@ -140,16 +182,14 @@ static void render_left(const struct mf_font_s *font,
 
 #if !MF_USE_ALIGN
 
-void mf_render_aligned(const struct mf_font_s *font,
-                       int16_t x0, int16_t y0,
-                       enum mf_align_t align,
-                       mf_str text, uint16_t count,
-                       mf_character_callback_t callback,
-                       void *state)
+void mf_render_aligned_metrics(const struct mf_font_s *font,
+                               int16_t x0, int16_t y0,
+                               enum mf_align_t align, mf_str text,
+                               const struct mf_line_metrics_s *metrics,
+                               mf_character_callback_t callback,
+                               void *state)
 {
-    int16_t string_width;
-    count = strip_spaces(text, count, 0);
-    render_left(font, x0, y0, text, count, callback, state);
+    render_left(font, x0, y0, text, metrics->count, callback, state);
 }
 
 #else
@@ -201,89 +241,80 @@ static void render_right(const struct mf_font_s *font,
     }
 }
 
-void mf_render_aligned(const struct mf_font_s *font,
-                       int16_t x0, int16_t y0,
-                       enum mf_align_t align,
-                       mf_str text, uint16_t count,
-                       mf_character_callback_t callback,
-                       void *state)
+void mf_render_aligned_metrics(const struct mf_font_s *font,
+                               int16_t x0, int16_t y0,
+                               enum mf_align_t align, mf_str text,
+                               const struct mf_line_metrics_s *metrics,
+                               mf_character_callback_t callback,
+                               void *state)
 {
-    int16_t string_width;
-    count = strip_spaces(text, count, 0);
-    
     if (align == MF_ALIGN_LEFT)
     {
-        render_left(font, x0, y0, text, count, callback, state);
+        render_left(font, x0, y0, text, metrics->count, callback, state);
     }
     if (align == MF_ALIGN_CENTER)
     {
-        string_width = mf_get_string_width(font, text, count, false);
-        x0 -= string_width / 2;
-        render_left(font, x0, y0, text, count, callback, state);
+        x0 -= metrics->width / 2;
+        render_left(font, x0, y0, text, metrics->count, callback, state);
     }
     else if (align == MF_ALIGN_RIGHT)
     {
-        render_right(font, x0, y0, text, count, callback, state);
+        render_right(font, x0, y0, text, metrics->count, callback, state);
     }
 }
 
 #endif
 
-
-#if !MF_USE_JUSTIFY
-
-void mf_render_justified(const struct mf_font_s *font,
-                         int16_t x0, int16_t y0, int16_t width,
-                         mf_str text, uint16_t count,
-                         mf_character_callback_t callback,
-                         void *state)
+void mf_render_aligned(const struct mf_font_s *font,
+                       int16_t x0, int16_t y0,
+                       enum mf_align_t align,
+                       mf_str text, uint16_t count,
+                       mf_character_callback_t callback,
+                       void *state)
 {
-    mf_render_aligned(font, x0, y0, MF_ALIGN_LEFT, text, count, callback, state);
+    struct mf_line_metrics_s metrics;
+    mf_measure_line(font, text, count, false, &metrics);
+    mf_render_aligned_metrics(font, x0, y0, align, text, &metrics,
+                              callback, state);
 }
 
-#else
 
-/* Returns true if the character is a justification point, i.e. expands
- * when the text is being justified. */
-static bool is_justify_space(uint16_t c)
-{
-    return c == ' ' || c == 0xA0;
-}
+#if !MF_USE_JUSTIFY
 
-/* Count the number of space characters in string */
-static uint16_t count_spaces(mf_str text, uint16_t count)
+void mf_render_justified_metrics(const struct mf_font_s *font,
+                                 int16_t x0, int16_t y0, int16_t width,
+                                 mf_str text,
+                                 const struct mf_line_metrics_s *metrics,
+                                 mf_character_callback_t callback,
+                                 void *state)
 {
-    uint16_t spaces = 0;
-    while (count-- && *text)
-    {
-        if (is_justify_space(mf_getchar(&text)))
-            spaces++;
-    }
-    return spaces;
+    mf_render_aligned_metrics(font, x0, y0, MF_ALIGN_LEFT, text, metrics,
+                              callback, state);
 }
 
-void mf_render_justified(const struct mf_font_s *font,
-                         int16_t x0, int16_t y0, int16_t width,
-                         mf_str text, uint16_t count,
-                         mf_character_callback_t callback,
-                         void *state)
+#else
+
+void mf_render_justified_metrics(const struct mf_font_s *font,
+                                 int16_t x0, int16_t y0, int16_t width,
+                                 mf_str text,
+                                 const struct mf_line_metrics_s *metrics,
+                                 mf_character_callback_t callback,
+                                 void *state)
 {
-    int16_t string_width, adjustment;
-    uint16_t num_spaces;
-    mf_char last_char;
+    int16_t adjustment;
+    uint16_t num_spaces, count;
     
-    count = strip_spaces(text, count, &last_char);
+    count = metrics->count;
     
-    if (last_char == '\n' || last_char == 0)
+    if (metrics->last_char == '\n' || metrics->last_char == 0)
     {
         /* Line ends in linefeed, do not justify. */
         render_left(font, x0, y0, text, count, callback, state);
         return;
     }
     
-    string_width = mf_get_string_width(font, text, count, false);
-    adjustment = width - string_width;
-    num_spaces = count_spaces(text, count);
+    adjustment = width - metrics->width;
+    num_spaces = metrics->spaces;
     
     {
         int16_t x, tmp;
@@ -321,7 +352,7 @@ void mf_render_justified(const struct mf_font_s *font,
                 x += tmp;
                 adjustment -= tmp;
             }
-
+            
             x += callback(x, y0, c2, state);
             c1 = c2;
         }
@@ -330,3 +361,251 @@ void mf_render_justified(const struct mf_font_s *font,
 
 #endif
 
+void mf_render_justified(const struct mf_font_s *font,
+                         int16_t x0, int16_t y0, int16_t width,
+                         mf_str text, uint16_t count,
+                         mf_character_callback_t callback,
+                         void *state)
+{
+    struct mf_line_metrics_s metrics;
+    mf_measure_line(font, text, count, false, &metrics);
+    mf_render_justified_metrics(font, x0, y0, width, text, &metrics,
+                                callback, state);
+}
+
+/* Store one coordinate, if it fits in the array. */
+static void store_position(int16_t *positions, uint16_t max_positions,
+                           uint16_t index, int16_t x)
+{
+    if (index < max_positions)
+        positions[index] = x;
+}
+
+/* Number of coordinates that fit in the array. */
+static uint16_t stored_positions(const struct mf_line_metrics_s *metrics,
+                                 uint16_t max_positions)
+{
+    if (max_positions > metrics->count)
+        return metrics->count + 1;
+    else
+        return max_positions;
+}
+
+/* Compute the positions for left-aligned or justified text. This follows
+ * the same steps as render_left() and mf_render_justified_metrics(). */
+static void positions_left(const struct mf_font_s *font, int16_t x0,
+                           mf_str text, uint16_t count, bool justify,
+                           int16_t adjustment, uint16_t num_spaces,
+                           int16_t *positions, uint16_t max_positions)
+{
+    int16_t x, tmp;
+    uint16_t i;
+    mf_char c1 = 0, c2;
+    
+    x = x0 - font->baseline_x;
+    for (i = 0; i < count; i++)
+    {
+        c2 = mf_getchar(&text);
+        
+        if (c2 == '\t')
+        {
+#if MF_USE_TABS
+            store_position(positions, max_positions, i, x + font->baseline_x);
+            tmp = x;
+            x = mf_round_to_tab(font, x0, x);
+            adjustment -= x - tmp - mf_character_width(font, '\t');
+            c1 = justify ? c2 : ' ';
+            continue;
+#else
+            c2 = ' ';
+#endif
+        }
+        
+        if (justify && is_justify_space(c2))
+        {
+            tmp = (adjustment + num_spaces / 2) / num_spaces;
+            adjustment -= tmp;
+            num_spaces--;
+            x += tmp;
+        }
+        
+        if (c1 != 0)
+        {
+            tmp = mf_compute_kerning(font, c1, c2);
+            x += tmp;
+            adjustment -= tmp;
+        }
+        
+        store_position(positions, max_positions, i, x + font->baseline_x);
+        x += mf_character_width(font, c2);
+        c1 = c2;
+    }
+    
+    store_position(positions, max_positions, count, x + font->baseline_x);
+}
+
+#if MF_USE_ALIGN
+/* Compute the positions for right-aligned text, following render_right(). */
+static void positions_right(const struct mf_font_s *font, int16_t x0,
+                            mf_str text, uint16_t count,
+                            int16_t *positions, uint16_t max_positions)
+{
+    int16_t x;
+    uint16_t i;
+    mf_char c1, c2 = 0;
+    mf_str tmp;
+    
+    for (i = 0; i < count; i++)
+        mf_getchar(&text);
+    
+    x = x0 - font->baseline_x;
+    store_position(positions, max_positions, count, x0);
+    for (i = count; i > 0; i--)
+    {
+        mf_rewind(&text);
+        tmp = text;
+        c1 = mf_getchar(&tmp);
+        
+        if (c1 == '\t')
+        {
+#if MF_USE_TABS
+            x = mf_round_to_prev_tab(font, x0, x);
+            store_position(positions, max_positions, i - 1,
+                           x + font->baseline_x);
+            c2 = ' ';
+            continue;
+#else
+            c1 = ' ';
+#endif
+        }
+        
+        x -= mf_character_width(font, c1);
+        
+        if (c2 != 0)
+            x -= mf_compute_kerning(font, c1, c2);
+        
+        store_position(positions, max_positions, i - 1, x + font->baseline_x);
+        c2 = c1;
+    }
+}
+#endif
+
+uint16_t mf_get_aligned_positions(const struct mf_font_s *font,
+                                  int16_t x0, enum mf_align_t align,
+                                  mf_str text,
+                                  const struct mf_line_metrics_s *metrics,
+                                  int16_t *positions, uint16_t max_positions)
+{
+#if MF_USE_ALIGN
+    if (align == MF_ALIGN_RIGHT)
+    {
+        positions_right(font, x0, text, metrics->count,
+                        positions, max_positions);
+        return stored_positions(metrics, max_positions);
+    }
+    
+    if (align == MF_ALIGN_CENTER)
+        x0 -= metrics->width / 2;
+#endif
+    
+    positions_left(font, x0, text, metrics->count, false, 0, 0,
+                   positions, max_positions);
+    return stored_positions(metrics, max_positions);
+}
+
+uint16_t mf_get_justified_positions(const struct mf_font_s *font,
+                                    int16_t x0, int16_t width,
+                                    mf_str text,
+                                    const struct mf_line_metrics_s *metrics,
+                                    int16_t *positions, uint16_t max_positions)
+{
+#if MF_USE_JUSTIFY
+    if (metrics->last_char != '\n' && metrics->last_char != 0)
+    {
+        positions_left(font, x0, text, metrics->count, true,
+                       width - metrics->width, metrics->spaces,
+                       positions, max_positions);
+        return stored_positions(metrics, max_positions);
+    }
+#endif
+    
+    return mf_get_aligned_positions(font, x0, MF_ALIGN_LEFT, text, metrics,
+                                    positions, max_positions);
+}
+
+uint16_t mf_find_position(const int16_t *positions, uint16_t count,
+                          int16_t x)
+{
+    uint16_t low = 0, high = count, mid;
+    
+    /* Find the last boundary that is at or left of x. */
+    while (low < high)
+    {
+        mid = low + (high - low + 1) / 2;
+        if (positions[mid] <= x)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    
+    /* Move to the next boundary if it is closer. */
+    if (low < count && positions[low + 1] - x < x - positions[low])
+        low++;
+    
+    return low;
+}
+
+void mf_render_glyph_run(const struct mf_font_s *font,
+                         int16_t x0, int16_t y0,
+                         enum mf_align_t align,
+                         const struct mf_glyph_run_s *run,
+                         mf_character_callback_t callback,
+                         void *state)
+{
+    uint16_t i;
+    
+#if MF_USE_ALIGN
+    if (align == MF_ALIGN_CENTER)
+        x0 -= run->width / 2;
+    else if (align == MF_ALIGN_RIGHT)
+        x0 -= run->width;
+#endif
+    
+    x0 -= font->baseline_x;
+    for (i = 0; i < run->count; i++)
+    {
+        callback(x0 + run->positions[i], y0, run->characters[i], state);
+    }
+}
+
+void mf_render_glyph_run_pixels(const struct mf_font_s *font,
+                                int16_t x0, int16_t y0,
+                                enum mf_align_t align,
+                                const struct mf_glyph_run_s *run,
+                                mf_pixel_callback_t callback,
+                                void *state)
+{
+    uint16_t i;
+    
+#if MF_USE_ALIGN
+    if (align == MF_ALIGN_CENTER)
+        x0 -= run->width / 2;
+    else if (align == MF_ALIGN_RIGHT)
+        x0 -= run->width;
+#endif
+    
+    x0 -= font->baseline_x;
+    for (i = 0; i < run->count; i++)
+    {
+        if (run->glyphs && font->render_glyph_ref)
+        {
+            font->render_glyph_ref(font, x0 + run->positions[i], y0,
+                                   &run->glyphs[i], callback, state);
+        }
+        else
+        {
+            mf_render_character(font, x0 + run->positions[i], y0,
+                                run->characters[i], callback, state);
+        }
+    }
+}
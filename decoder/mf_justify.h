@@ -35,6 +35,35 @@ typedef uint8_t (*mf_character_callback_t) (int16_t x0, int16_t y0,
 MF_EXTERN int16_t mf_get_string_width(const struct mf_font_s *font,
                                       mf_str text, uint16_t count, bool kern);
 
+/* Measurements of a single line of text, from mf_measure_line().
+ * Trailing whitespace is not included in any of the values, and tabs
+ * are rounded to the tab stops.
+ */
+struct mf_line_metrics_s
+{
+    uint16_t count; /* Number of characters without trailing whitespace. */
+    int16_t width; /* Width in pixels without kerning. */
+    int16_t kerned_width; /* Width in pixels with kerning, if requested. */
+    uint16_t spaces; /* Number of spaces that expand in justification. */
+    uint16_t tabs; /* Number of tab characters. */
+    mf_char last_char; /* Last character of the line, 0 at end of string. */
+};
+
+/* Measure a line of text in a single pass, for the alignment functions
+ * below. Callers that render the same line several times, or that need
+ * its width for layout, can measure it once and reuse the result.
+ *
+ * font:    Pointer to the font definition.
+ * text:    Pointer to start of the text to measure.
+ * count:   Number of characters on the line or 0 to read until end of string.
+ * kern:    True to also compute kerned_width (slower), otherwise it is
+ *          the same as width.
+ * metrics: Returns the measurements.
+ */
+MF_EXTERN void mf_measure_line(const struct mf_font_s *font,
+                               mf_str text, uint16_t count, bool kern,
+                               struct mf_line_metrics_s *metrics);
+
 /* Render a single line of aligned text.
  *
  * font:     Pointer to the font definition.
@@ -53,6 +82,16 @@ MF_EXTERN void mf_render_aligned(const struct mf_font_s *font,
                                  mf_character_callback_t callback,
                                  void *state);
 
+/* Render a single line of aligned text that has already been measured
+ * with mf_measure_line(). Parameters are as for mf_render_aligned().
+ */
+MF_EXTERN void mf_render_aligned_metrics(const struct mf_font_s *font,
+                                         int16_t x0, int16_t y0,
+                                         enum mf_align_t align, mf_str text,
+                                         const struct mf_line_metrics_s *metrics,
+                                         mf_character_callback_t callback,
+                                         void *state);
+
 /* Render a single line of justified text.
  *
  * font:     Pointer to the font definition.
@@ -70,5 +109,118 @@ MF_EXTERN void mf_render_justified(const struct mf_font_s *font,
                                    mf_character_callback_t callback,
                                    void *state);
 
+/* Render a single line of justified text that has already been measured
+ * with mf_measure_line(). Parameters are as for mf_render_justified().
+ */
+MF_EXTERN void mf_render_justified_metrics(const struct mf_font_s *font,
+                                           int16_t x0, int16_t y0,
+                                           int16_t width, mf_str text,
+                                           const struct mf_line_metrics_s *metrics,
+                                           mf_character_callback_t callback,
+                                           void *state);
+
+/* Compute the x coordinates of the characters on a line that has been
+ * measured with mf_measure_line(), without rendering anything. The result
+ * matches what mf_render_aligned_metrics() would render, including kerning
+ * and tab stops, and can be used for placing a cursor or for hit-testing.
+ *
+ * positions[i] is the left edge of character i and positions[count] is
+ * the right edge of the line, where count is metrics->count. Trailing
+ * whitespace is not included.
+ *
+ * font:          Pointer to the font definition.
+ * x0:            Depending on align, either left, center or right edge.
+ * align:         Type of alignment.
+ * text:          Pointer to start of the text.
+ * metrics:       Measurements of the line.
+ * positions:     Array to store the coordinates to.
+ * max_positions: Size of the array, metrics->count + 1 to store all.
+ * Returns the number of coordinates stored.
+ */
+MF_EXTERN uint16_t mf_get_aligned_positions(const struct mf_font_s *font,
+                                            int16_t x0, enum mf_align_t align,
+                                            mf_str text,
+                                            const struct mf_line_metrics_s *metrics,
+                                            int16_t *positions,
+                                            uint16_t max_positions);
+
+/* Compute the x coordinates of the characters on a justified line.
+ * Parameters are as for mf_get_aligned_positions(), with x0 and width
+ * as in mf_render_justified().
+ */
+MF_EXTERN uint16_t mf_get_justified_positions(const struct mf_font_s *font,
+                                              int16_t x0, int16_t width,
+                                              mf_str text,
+                                              const struct mf_line_metrics_s *metrics,
+                                              int16_t *positions,
+                                              uint16_t max_positions);
+
+/* Find the character boundary nearest to an x coordinate, using binary
+ * search on the result of mf_get_aligned_positions() or
+ * mf_get_justified_positions().
+ *
+ * positions: Array of count + 1 coordinates.
+ * count:     Number of characters on the line.
+ * x:         The x coordinate, e.g. from a touch event.
+ * Returns the cursor position, from 0 (before the first character) to
+ * count (after the last character).
+ */
+MF_EXTERN uint16_t mf_find_position(const int16_t *positions, uint16_t count,
+                                    int16_t x);
+
+/* A line of text that has been laid out in advance with the
+ * "mcufont glyph_runs" command. The kerning and tab stops are already
+ * applied to the positions. If the run was laid out for a specific font
+ * format, the glyphs have also been looked up in advance. The tab stops
+ * are counted from the start of the run, so right aligned runs with tabs
+ * differ from mf_render_aligned().
+ */
+struct mf_glyph_run_s
+{
+    uint16_t count; /* Number of glyphs. */
+    int16_t width; /* Width of the whole run in pixels. */
+    const uint16_t *characters; /* Character of each glyph. */
+    const int16_t *positions; /* X coordinate of each glyph from the start. */
+    const struct mf_glyph_ref_s *glyphs; /* Glyph references, or NULL. */
+};
+
+/* Render a glyph run. Unlike mf_render_aligned(), this does not need to
+ * decode or measure the text.
+ *
+ * font:     Pointer to the font that the run was laid out for.
+ * x0:       Depending on aligned, either left, center or right edge of target.
+ * y0:       Upper edge of the target area.
+ * align:    Type of alignment.
+ * run:      The glyph run to render.
+ * callback: Callback to call for each character.
+ * state:    Free variable for use in the callback.
+ */
+MF_EXTERN void mf_render_glyph_run(const struct mf_font_s *font,
+                                   int16_t x0, int16_t y0,
+                                   enum mf_align_t align,
+                                   const struct mf_glyph_run_s *run,
+                                   mf_character_callback_t callback,
+                                   void *state);
+
+/* Render a glyph run straight to a pixel callback. The glyph references
+ * of the run are used to render the glyphs without searching for the
+ * characters, which skips the glyph cache. Runs without references, and
+ * fonts that do not support them such as scaled fonts, are rendered by
+ * character instead.
+ *
+ * font:     Pointer to the font that the run was laid out for.
+ * x0:       Depending on aligned, either left, center or right edge of target.
+ * y0:       Upper edge of the target area.
+ * align:    Type of alignment.
+ * run:      The glyph run to render.
+ * callback: Callback to write out the pixels.
+ * state:    Free variable for use in the callback.
+ */
+MF_EXTERN void mf_render_glyph_run_pixels(const struct mf_font_s *font,
+                                          int16_t x0, int16_t y0,
+                                          enum mf_align_t align,
+                                          const struct mf_glyph_run_s *run,
+                                          mf_pixel_callback_t callback,
+                                          void *state);
 
 #endif
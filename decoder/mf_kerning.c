@@ -58,44 +58,137 @@ static bool do_kerning(mf_char c)
 static int16_t max16(int16_t a, int16_t b) { return (a > b) ? a : b; }
 static int16_t avg16(int16_t a, int16_t b) { return (a + b) / 2; }
 
-int8_t mf_compute_kerning(const struct mf_font_s *font,
-                          mf_char c1, mf_char c2)
+#if MF_USE_KERNING_TABLES
+/* Find the class of a character by binary search, or 0 if it has none. */
+static uint8_t find_kerning_class(const uint16_t *chars, const uint8_t *classes,
+                                  uint16_t count, mf_char c)
+{
+    uint16_t lo = 0, hi = count;
+    
+    while (lo < hi)
+    {
+        uint16_t mid = lo + (hi - lo) / 2;
+        if (chars[mid] < c)
+            lo = mid + 1;
+        else if (chars[mid] > c)
+            hi = mid;
+        else
+            return classes[mid];
+    }
+    
+    return 0;
+}
+
+/* Look up the adjustment for a character pair in the kerning table. */
+static int8_t lookup_kerning_table(const struct mf_kerning_table_s *table,
+                                   mf_char c1, mf_char c2)
+{
+    uint8_t first, second;
+    
+    first = find_kerning_class(table->first_chars, table->first_classes,
+                               table->first_count, c1);
+    if (!first)
+        return 0;
+    
+    second = find_kerning_class(table->second_chars, table->second_classes,
+                                table->second_count, c2);
+    if (!second)
+        return 0;
+    
+    return table->adjustments[(first - 1) * table->second_class_count +
+                              (second - 1)];
+}
+#endif
+
+/* Unpack the left or right edges of a glyph from the precomputed kerning
+ * edges, into the same form as fit_leftedge and fit_rightedge produce. */
+static void unpack_edges(const uint8_t *edges, bool right, uint8_t *edgepos)
+{
+    uint8_t i, delta;
+    
+    for (i = 0; i < MF_KERNING_ZONES; i++)
+    {
+        delta = right ? (edges[2 + i] & 0x0F) : (edges[2 + i] >> 4);
+        if (delta == 15)
+            edgepos[i] = right ? 0 : 255;
+        else
+            edgepos[i] = right ? edges[1] - delta : edges[0] + delta;
+    }
+}
+
+/* Get the precomputed edges and widths of both characters, if the font has
+ * them. Characters that are missing from the font are rendered using the
+ * fallback character, so they always go through the slow path. */
+static bool get_kerning_edges(const struct mf_font_s *font,
+                              mf_char c1, mf_char c2,
+                              uint8_t *right, uint8_t *left,
+                              uint8_t *w1, uint8_t *w2)
+{
+    const uint8_t *e1, *e2;
+    
+    if (!font->kerning_edges)
+        return false;
+    
+    e1 = font->kerning_edges(font, c1);
+    e2 = font->kerning_edges(font, c2);
+    if (!e1 || !e2)
+        return false;
+    
+    *w1 = font->character_width(font, c1);
+    *w2 = font->character_width(font, c2);
+    if (!*w1 || !*w2)
+        return false;
+    
+    unpack_edges(e1, true, right);
+    unpack_edges(e2, false, left);
+    return true;
+}
+
+static int8_t compute_kerning(const struct mf_font_s *font,
+                              mf_char c1, mf_char c2)
 {
     struct kerning_state_s leftedge, rightedge;
+    const uint8_t *left = leftedge.edgepos, *right = rightedge.edgepos;
     uint8_t w1, w2, i, min_space;
     int16_t normal_space, adjust, max_adjust;
     
-    if (font->flags & MF_FONT_FLAG_MONOSPACE)
-        return 0; /* No kerning for monospace fonts */
+#if MF_USE_KERNING_TABLES
+    if (font->kerning_table)
+        return lookup_kerning_table(font->kerning_table, c1, c2);
+#endif
     
     if (!do_kerning(c1) || !do_kerning(c2))
         return 0;
     
-    /* Compute the height of one kerning zone in pixels */
-    i = (font->height + MF_KERNING_ZONES - 1) / MF_KERNING_ZONES;
-    if (i < 1) i = 1;
-    
-    /* Initialize structures */
-    leftedge.zoneheight = rightedge.zoneheight = i;
-    for (i = 0; i < MF_KERNING_ZONES; i++)
+    if (!get_kerning_edges(font, c1, c2, rightedge.edgepos, leftedge.edgepos,
+                           &w1, &w2))
     {
-        leftedge.edgepos[i] = 255;
-        rightedge.edgepos[i] = 0;
+        /* Compute the height of one kerning zone in pixels */
+        i = (font->height + MF_KERNING_ZONES - 1) / MF_KERNING_ZONES;
+        if (i < 1) i = 1;
+        
+        /* Initialize structures */
+        leftedge.zoneheight = rightedge.zoneheight = i;
+        for (i = 0; i < MF_KERNING_ZONES; i++)
+        {
+            leftedge.edgepos[i] = 255;
+            rightedge.edgepos[i] = 0;
+        }
+        
+        /* Analyze the edges of both glyphs. */
+        w1 = mf_render_character(font, 0, 0, c1, fit_rightedge, &rightedge);
+        w2 = mf_render_character(font, 0, 0, c2, fit_leftedge, &leftedge);
     }
     
-    /* Analyze the edges of both glyphs. */
-    w1 = mf_render_character(font, 0, 0, c1, fit_rightedge, &rightedge);
-    w2 = mf_render_character(font, 0, 0, c2, fit_leftedge, &leftedge);
-    
     /* Find the minimum horizontal space between the glyphs. */
     min_space = 255;
     for (i = 0; i < MF_KERNING_ZONES; i++)
     {
         uint8_t space;
-        if (leftedge.edgepos[i] == 255 || rightedge.edgepos[i] == 0)
+        if (left[i] == 255 || right[i] == 0)
             continue; /* Outside glyph area. */
         
-        space = w1 - rightedge.edgepos[i] + leftedge.edgepos[i];
+        space = w1 - right[i] + left[i];
         if (space < min_space)
             min_space = space;
     }
@@ -115,4 +208,93 @@ int8_t mf_compute_kerning(const struct mf_font_s *font,
     return adjust;
 }
 
+#if MF_USE_KERNING_CACHE
+/* One computed adjustment in the kerning cache. */
+struct kerning_cache_entry_s
+{
+    const struct mf_font_s *font;
+    mf_char c1;
+    mf_char c2;
+    int8_t adjust;
+};
+
+/* State of the kerning cache. The entries form a direct-mapped hash table,
+ * an entry with NULL font is empty. */
+struct kerning_cache_s
+{
+    struct kerning_cache_entry_s *entries;
+    struct mf_kerning_cache_stats_s stats;
+};
+
+static struct kerning_cache_s kcache;
+
+void mf_kerning_cache_init(void *arena, uint32_t size)
+{
+    uint32_t i;
+    
+    kcache.entries = arena;
+    kcache.stats.hits = 0;
+    kcache.stats.misses = 0;
+    kcache.stats.evictions = 0;
+    kcache.stats.entries = 0;
+    
+    if (arena)
+        kcache.stats.entries = size / sizeof(struct kerning_cache_entry_s);
+    
+    if (!kcache.stats.entries)
+        kcache.entries = 0;
+    
+    for (i = 0; i < kcache.stats.entries; i++)
+        kcache.entries[i].font = 0;
+}
+
+void mf_get_kerning_cache_stats(struct mf_kerning_cache_stats_s *stats)
+{
+    *stats = kcache.stats;
+}
+
+/* Get the adjustment from the cache, or compute and store it. Different
+ * fonts share the slots, which is fine because usually one font at a time
+ * is being laid out. */
+static int8_t cached_kerning(const struct mf_font_s *font,
+                             mf_char c1, mf_char c2)
+{
+    struct kerning_cache_entry_s *e;
+    uint32_t hash;
+    
+    hash = ((uint32_t)c1 * 0x9E3Bu) ^ ((uint32_t)c2 * 0x3C6Fu) ^ font->height;
+    e = &kcache.entries[hash % kcache.stats.entries];
+    
+    if (e->font == font && e->c1 == c1 && e->c2 == c2)
+    {
+        kcache.stats.hits++;
+        return e->adjust;
+    }
+    
+    kcache.stats.misses++;
+    if (e->font)
+        kcache.stats.evictions++;
+    
+    e->font = font;
+    e->c1 = c1;
+    e->c2 = c2;
+    e->adjust = compute_kerning(font, c1, c2);
+    return e->adjust;
+}
+#endif
+
+int8_t mf_compute_kerning(const struct mf_font_s *font,
+                          mf_char c1, mf_char c2)
+{
+    if (font->flags & MF_FONT_FLAG_MONOSPACE)
+        return 0; /* No kerning for monospace fonts */
+    
+#if MF_USE_KERNING_CACHE
+    if (kcache.entries)
+        return cached_kerning(font, c1, c2);
+#endif
+    
+    return compute_kerning(font, c1, c2);
+}
+
 #endif
@@ -9,6 +9,40 @@
 #include "mf_config.h"
 #include "mf_rlefont.h"
 
+/* Fonts can be exported with precomputed kerning edges, so that the glyphs
+ * do not need to be rendered to compute the kerning. The edges of each
+ * glyph are MF_KERNING_EDGE_BYTES bytes: the leftmost x coordinate of the
+ * glyph and the rightmost x coordinate, followed by one byte per zone.
+ * The high nibble of the zone byte is the distance of the left edge in the
+ * zone from the leftmost coordinate, and the low nibble is the distance of
+ * the right edge from the rightmost coordinate. Distances are limited to
+ * 14, and empty zones are stored as 0xFF.
+ */
+
+/* Kerning pairs imported from the font file. The characters are grouped
+ * into classes that kern identically, numbered from 1, and the adjustments
+ * are stored as a matrix indexed by the classes. Characters that do not
+ * appear in the lists are not kerned at all. */
+struct mf_kerning_table_s
+{
+    /* Characters on the left side of the pairs, sorted, and their classes. */
+    uint16_t first_count;
+    const uint16_t *first_chars;
+    const uint8_t *first_classes;
+    
+    /* Characters on the right side of the pairs, sorted, and their classes. */
+    uint16_t second_count;
+    const uint16_t *second_chars;
+    const uint8_t *second_classes;
+    
+    /* Number of classes on the right side, i.e. the width of the matrix. */
+    uint8_t second_class_count;
+    
+    /* Adjustments in pixels, at the index
+     * (first class - 1) * second_class_count + (second class - 1). */
+    const int8_t *adjustments;
+};
+
 /* Compute the kerning adjustment when c1 is followed by c2.
  * 
  * font: Pointer to the font definition.
@@ -24,4 +58,40 @@ MF_EXTERN int8_t mf_compute_kerning(const struct mf_font_s *font,
 #define mf_compute_kerning(f,c1,c2) (0)
 #endif
 
+/* Statistics of the kerning cache. */
+struct mf_kerning_cache_stats_s
+{
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    
+    /* Number of character pairs that fit in the cache. */
+    uint32_t entries;
+};
+
+#if MF_USE_KERNING && MF_USE_KERNING_CACHE
+
+/* Give the kerning cache a memory area to use, and empty it. After this,
+ * mf_compute_kerning stores the adjustments in a hash table, so that
+ * laying out the same text again does not need to compute them. When two
+ * pairs hash to the same slot, the older one is replaced. Pass NULL to
+ * stop using the cache.
+ *
+ * The fonts are constant, so the cache never has to be invalidated.
+ * However, if a font structure in RAM is changed or reused for another
+ * font, such as with mf_scale_font, the cache must be initialized again.
+ *
+ * arena: Memory to store the pairs in. Must be aligned for a pointer.
+ * size:  Size of the memory area in bytes.
+ */
+MF_EXTERN void mf_kerning_cache_init(void *arena, uint32_t size);
+
+/* Get the hit and miss counts of the kerning cache.
+ *
+ * stats: Pointer to a structure that will be filled in.
+ */
+MF_EXTERN void mf_get_kerning_cache_stats(struct mf_kerning_cache_stats_s *stats);
+
+#endif
+
 #endif
\ No newline at end of file
@@ -1,4 +1,8 @@
+#define MF_RLEFONT_INTERNALS
 #include "mf_rlefont.h"
+#include "mf_clip.h"
+#include "mf_framebuffer.h"
+#include "mf_spans.h"
 
 /* Number of reserved codes before the dictionary entries. */
 #define DICT_START 24
@@ -22,12 +26,9 @@
 #define DICT_START3BIT  244
 #define DICT_START2BIT  252
 
-/* Find a pointer to the glyph matching a given character by searching
- * through the character ranges. If the character is not found, return
- * pointer to the default glyph.
- */
-static const uint8_t *find_glyph(const struct mf_rlefont_s *font,
-                                 uint16_t character)
+/* Find the character range that contains a given glyph. */
+static const struct mf_rlefont_char_range_s *search_char_range(
+    const struct mf_rlefont_s *font, uint16_t character)
 {
    unsigned i, index;
    const struct mf_rlefont_char_range_s *range;
@@ -37,16 +38,60 @@ static const uint8_t *find_glyph(const struct mf_rlefont_s *font,
        index = character - range->first_char;
        if (character >= range->first_char && index < range->char_count)
        {
-           uint16_t offset = range->glyph_offsets[index];
-           return &range->glyph_data[offset];
+           return range;
        }
    }
-
+   
    return 0;
 }
 
+/* Find the character range and index that contains a given glyph.
+ * The range is looked up through the glyph lookup cache if enabled. */
+static const struct mf_rlefont_char_range_s *find_char_range(
+    const struct mf_rlefont_s *font, uint16_t character, uint16_t *index_ret)
+{
+    const struct mf_rlefont_char_range_s *range;
+    
+#if MF_GLYPH_LOOKUP_CACHE
+    const void *cached;
+    if (mf_glyph_lookup_get(&font->font, character, &cached))
+    {
+        range = cached;
+    }
+    else
+    {
+        range = search_char_range(font, character);
+        mf_glyph_lookup_put(&font->font, character, range);
+    }
+#else
+    range = search_char_range(font, character);
+#endif
+    
+    if (range)
+        *index_ret = character - range->first_char;
+    
+    return range;
+}
+
+/* Find a pointer to the glyph matching a given character. If the
+ * character is not found, return a null pointer.
+ */
+static const uint8_t *find_glyph(const struct mf_rlefont_s *font,
+                                 uint16_t character)
+{
+    const struct mf_rlefont_char_range_s *range;
+    uint16_t index;
+    
+    range = find_char_range(font, character, &index);
+    if (!range)
+        return 0;
+    
+    return &range->glyph_data[range->glyph_offsets[index]];
+}
+
 /* Structure to keep track of coordinates of the next pixel to be written,
- * and also the bounds of the character. */
+ * and also the bounds of the character. For column-major fonts, x and y
+ * are swapped: x runs down the column and y steps through the columns. */
 struct renderstate_r
 {
     int16_t x_begin;
@@ -56,8 +101,72 @@ struct renderstate_r
     int16_t y_end;
     mf_pixel_callback_t callback;
     void *state;
+    bool column_major;
+#if MF_USE_FRAMEBUFFER
+    const struct mf_framebuffer_s *fb;
+#endif
+#if MF_USE_SPAN_BATCH
+    struct mf_span_batch_s *batch;
+#endif
+#if MF_USE_CLIPPING
+    struct mf_cliprect_s clip;
+#endif
+#if MF_USE_EXPANDED_DICTIONARY
+    const struct expanded_dict_s *dict;
+#endif
 };
 
+/* Pass a run of pixels on one row to the output, without clipping. */
+static void output_unclipped(struct renderstate_r *rstate, int16_t x,
+                             int16_t y, uint8_t count, uint8_t alpha)
+{
+#if MF_USE_FRAMEBUFFER
+    if (rstate->fb)
+    {
+        mf_framebuffer_fill(rstate->fb, x, y, count, alpha);
+        return;
+    }
+#endif
+#if MF_USE_SPAN_BATCH
+    if (rstate->batch)
+    {
+        mf_span_batch_add(rstate->batch, x, y, count, alpha);
+        return;
+    }
+#endif
+    
+    rstate->callback(x, y, count, alpha, rstate->state);
+}
+
+/* Pass a run of pixels in the glyph data to the output. For column-major
+ * fonts the run is vertical: it is clipped once and written to a
+ * framebuffer as a single column, or otherwise one pixel at a time. */
+static void output_pixels(struct renderstate_r *rstate, int16_t x, int16_t y,
+                          uint8_t count, uint8_t alpha)
+{
+#if MF_USE_CLIPPING
+    if (!mf_clip_run(&rstate->clip, &x, y, &count))
+        return;
+#endif
+    
+    if (!rstate->column_major)
+    {
+        output_unclipped(rstate, x, y, count, alpha);
+        return;
+    }
+    
+#if MF_USE_FRAMEBUFFER
+    if (rstate->fb)
+    {
+        mf_framebuffer_fill_column(rstate->fb, y, x, count, alpha);
+        return;
+    }
+#endif
+    
+    while (count--)
+        output_unclipped(rstate, y, x++, 1, alpha);
+}
+
 /* Call the callback to write one pixel to screen, and advance to next
  * pixel position. */
 static void write_pixels(struct renderstate_r *rstate, uint16_t count,
@@ -69,7 +178,7 @@ static void write_pixels(struct renderstate_r *rstate, uint16_t count,
     while (rstate->x + count >= rstate->x_end)
     {
         rowlen = rstate->x_end - rstate->x;
-        rstate->callback(rstate->x, rstate->y, rowlen, alpha, rstate->state);
+        output_pixels(rstate, rstate->x, rstate->y, rowlen, alpha);
         count -= rowlen;
         rstate->x = rstate->x_begin;
         rstate->y++;
@@ -78,7 +187,7 @@ static void write_pixels(struct renderstate_r *rstate, uint16_t count,
     /* Write the remaining part */
     if (count)
     {
-        rstate->callback(rstate->x, rstate->y, count, alpha, rstate->state);
+        output_pixels(rstate, rstate->x, rstate->y, count, alpha);
         rstate->x += count;
     }
 }
@@ -222,11 +331,297 @@ static void write_ref_dictentry(const struct mf_rlefont_s *font,
     }
 }
 
+#if MF_USE_EXPANDED_DICTIONARY
+/* Types of the runs in the expanded dictionary. */
+#define RUN_SKIP        0
+#define RUN_WRITE       1
+#define RUN_FILLZEROS   2
+
+/* Limit for merged runs, same as the longest run of a single code. */
+#define MAX_RUN         4096
+
+/* A run of pixels in the expanded dictionary. */
+struct dict_run_s
+{
+    uint16_t count;
+    uint8_t alpha;
+    uint8_t type;
+};
+
+/* Header of the expanded dictionary, stored at the start of the buffer
+ * given by the caller. The offsets and runs follow it. */
+struct expanded_dict_s
+{
+    struct expanded_dict_s *next;
+    const struct mf_rlefont_s *font;
+    
+    /* Index of the first run of each entry, dict_entry_count + 1 items. */
+    const uint16_t *offsets;
+    
+    const struct dict_run_s *runs;
+};
+
+/* List of the fonts that have an expanded dictionary. */
+static struct expanded_dict_s *expanded_dicts = 0;
+
+/* Output of the expansion. When runs is null, only counts the runs. */
+struct expansion_s
+{
+    struct dict_run_s *runs;
+    uint32_t count;
+    struct dict_run_s last;
+    bool has_last;
+};
+
+/* Add a run to the expansion, merging it with the previous run in the
+ * same entry if they have the same type and alpha. */
+static void add_run(struct expansion_s *e, uint8_t type, uint16_t count,
+                    uint8_t alpha)
+{
+    if (count == 0 && type != RUN_FILLZEROS)
+        return;
+    
+    if (e->has_last && type != RUN_FILLZEROS &&
+        e->last.type == type && e->last.alpha == alpha &&
+        e->last.count + count <= MAX_RUN)
+    {
+        e->last.count += count;
+    }
+    else
+    {
+        e->last.count = count;
+        e->last.alpha = alpha;
+        e->last.type = type;
+        e->has_last = true;
+        e->count++;
+    }
+    
+    if (e->runs)
+        e->runs[e->count - 1] = e->last;
+}
+
+/* Expand a RLE-encoded dictionary entry, like write_rle_dictentry. */
+static void expand_rle_dictentry(const struct mf_rlefont_s *font,
+                                 struct expansion_s *e, uint8_t index)
+{
+    uint16_t offset = font->dictionary_offsets[index];
+    uint16_t length = font->dictionary_offsets[index + 1] - offset;
+    uint16_t i;
+    
+    for (i = 0; i < length; i++)
+    {
+        uint8_t code = font->dictionary_data[offset + i];
+        if ((code & RLE_CODEMASK) == RLE_ZEROS)
+        {
+            add_run(e, RUN_SKIP, code & RLE_VALMASK, 0);
+        }
+        else if ((code & RLE_CODEMASK) == RLE_64ZEROS)
+        {
+            add_run(e, RUN_SKIP, ((code & RLE_VALMASK) + 1) * 64, 0);
+        }
+        else if ((code & RLE_CODEMASK) == RLE_ONES)
+        {
+            add_run(e, RUN_WRITE, (code & RLE_VALMASK) + 1, 255);
+        }
+        else if ((code & RLE_CODEMASK) == RLE_SHADE)
+        {
+            uint8_t count, alpha;
+            count = ((code & RLE_VALMASK) >> 4) + 1;
+            alpha = ((code & RLE_VALMASK) & 0xF) * 0x11;
+            add_run(e, RUN_WRITE, count, alpha);
+        }
+    }
+}
+
+/* Expand a reference codeword, like write_ref_codeword. */
+static void expand_ref_codeword(const struct mf_rlefont_s *font,
+                                struct expansion_s *e, uint8_t code)
+{
+    if (code <= 15)
+    {
+        add_run(e, RUN_WRITE, 1, 0x11 * code);
+    }
+    else if (code == REF_FILLZEROS)
+    {
+        add_run(e, RUN_FILLZEROS, 0, 0);
+    }
+    else if (code < DICT_START)
+    {
+        /* Reserved */
+    }
+    else if (code < DICT_START + font->rle_entry_count)
+    {
+        expand_rle_dictentry(font, e, code - DICT_START);
+    }
+    else
+    {
+        uint8_t bitcount = fillentry_bitcount(code);
+        uint8_t byte = code - DICT_START7BIT;
+        
+        while (bitcount--)
+        {
+            if (byte & 1)
+                add_run(e, RUN_WRITE, 1, 255);
+            else
+                add_run(e, RUN_SKIP, 1, 0);
+            
+            byte >>= 1;
+        }
+    }
+}
+
+/* Expand all the dictionary entries of the font. */
+static void expand_dictionary(const struct mf_rlefont_s *font,
+                              struct expansion_s *e, uint16_t *offsets)
+{
+    uint8_t index;
+    uint16_t offset, length, i;
+    
+    e->count = 0;
+    
+    for (index = 0; index < font->dict_entry_count; index++)
+    {
+        if (offsets)
+            offsets[index] = e->count;
+        
+        e->has_last = false;
+        
+        if (index < font->rle_entry_count)
+        {
+            expand_rle_dictentry(font, e, index);
+        }
+        else
+        {
+            offset = font->dictionary_offsets[index];
+            length = font->dictionary_offsets[index + 1] - offset;
+            for (i = 0; i < length; i++)
+                expand_ref_codeword(font, e, font->dictionary_data[offset + i]);
+        }
+    }
+    
+    if (offsets)
+        offsets[index] = e->count;
+}
+
+/* Get the number of runs in the expanded dictionary. */
+static uint32_t count_runs(const struct mf_rlefont_s *font)
+{
+    struct expansion_s e;
+    e.runs = 0;
+    expand_dictionary(font, &e, 0);
+    return e.count;
+}
+
+/* Size of the header and the offset table, rounded for the runs. */
+static uint32_t header_size(const struct mf_rlefont_s *font)
+{
+    uint32_t size = sizeof(struct expanded_dict_s);
+    size += sizeof(uint16_t) * (font->dict_entry_count + 1);
+    size += sizeof(struct dict_run_s) - 1;
+    size -= size % sizeof(struct dict_run_s);
+    return size;
+}
+
+uint32_t mf_rlefont_expanded_size(const struct mf_font_s *font)
+{
+    const struct mf_rlefont_s *rlefont = (const struct mf_rlefont_s*)font;
+    uint32_t runs;
+    
+    if (font->render_character != mf_rlefont_render_character)
+        return 0;
+    
+    runs = count_runs(rlefont);
+    if (runs > 0xFFFF)
+        return 0;
+    
+    return header_size(rlefont) + runs * sizeof(struct dict_run_s);
+}
+
+bool mf_rlefont_expand_dictionary(const struct mf_font_s *font,
+                                  void *buffer, uint32_t size)
+{
+    const struct mf_rlefont_s *rlefont = (const struct mf_rlefont_s*)font;
+    struct expanded_dict_s **pp;
+    struct expanded_dict_s *dict = buffer;
+    struct expansion_s e;
+    uint16_t *offsets;
+    uint32_t needed;
+    
+    /* Remove any previous expansion of the font. */
+    for (pp = &expanded_dicts; *pp; pp = &(*pp)->next)
+    {
+        if ((*pp)->font == rlefont)
+        {
+            *pp = (*pp)->next;
+            break;
+        }
+    }
+    
+    needed = mf_rlefont_expanded_size(font);
+    if (!buffer || needed == 0 || size < needed)
+        return false;
+    
+    offsets = (uint16_t*)(dict + 1);
+    e.runs = (struct dict_run_s*)((uint8_t*)buffer + header_size(rlefont));
+    expand_dictionary(rlefont, &e, offsets);
+    
+    dict->font = rlefont;
+    dict->offsets = offsets;
+    dict->runs = e.runs;
+    dict->next = expanded_dicts;
+    expanded_dicts = dict;
+    return true;
+}
+
+/* Find the expanded dictionary of the font, if any. */
+static const struct expanded_dict_s *find_expanded_dict(
+    const struct mf_rlefont_s *font)
+{
+    const struct expanded_dict_s *dict;
+    
+    for (dict = expanded_dicts; dict; dict = dict->next)
+    {
+        if (dict->font == font)
+            return dict;
+    }
+    
+    return 0;
+}
+
+/* Write out a dictionary entry from the expanded runs. */
+static void write_expanded_dictentry(struct renderstate_r *rstate,
+                                     uint8_t index)
+{
+    const struct dict_run_s *run, *end;
+    run = rstate->dict->runs + rstate->dict->offsets[index];
+    end = rstate->dict->runs + rstate->dict->offsets[index + 1];
+    
+    for (; run != end; run++)
+    {
+        if (run->type == RUN_SKIP)
+            skip_pixels(rstate, run->count);
+        else if (run->type == RUN_WRITE)
+            write_pixels(rstate, run->count, run->alpha);
+        else
+            rstate->y = rstate->y_end;
+    }
+}
+#endif
+
 /* Decode and write out an arbitrary glyph codeword */
 static void write_glyph_codeword(const struct mf_rlefont_s *font,
                                 struct renderstate_r *rstate,
                                 uint8_t code)
 {
+#if MF_USE_EXPANDED_DICTIONARY
+    if (rstate->dict && code >= DICT_START &&
+        code < DICT_START + font->dict_entry_count)
+    {
+        write_expanded_dictentry(rstate, code - DICT_START);
+        return;
+    }
+#endif
+    
     if (code >= DICT_START + font->rle_entry_count &&
         code < DICT_START + font->dict_entry_count)
     {
@@ -239,39 +634,120 @@ static void write_glyph_codeword(const struct mf_rlefont_s *font,
 }
 
 
-uint8_t mf_rlefont_render_character(const struct mf_font_s *font,
-                                    int16_t x0, int16_t y0,
-                                    uint16_t character,
-                                    mf_pixel_callback_t callback,
-                                    void *state)
+/* Decode the glyph data starting at p. Returns the glyph width. */
+static uint8_t render_glyph(const struct mf_rlefont_s *rlefont,
+                            int16_t x0, int16_t y0, const uint8_t *p,
+                            mf_pixel_callback_t callback,
+                            void *state)
 {
-    const uint8_t *p;
+    const struct mf_font_s *font = &rlefont->font;
     uint8_t width;
     
     struct renderstate_r rstate;
-    rstate.x_begin = x0;
-    rstate.x_end = x0 + font->width;
-    rstate.x = x0;
-    rstate.y = y0;
-    rstate.y_end = y0 + font->height;
+#if MF_USE_CLIPPING
+    mf_clip_get_rect(&rstate.clip, &callback, &state);
+#endif
+    rstate.column_major = rlefont->column_major;
+    if (rstate.column_major)
+    {
+        rstate.x_begin = y0;
+        rstate.x_end = y0 + font->height;
+        rstate.x = y0;
+        rstate.y = x0;
+        rstate.y_end = x0 + font->width;
+    }
+    else
+    {
+        rstate.x_begin = x0;
+        rstate.x_end = x0 + font->width;
+        rstate.x = x0;
+        rstate.y = y0;
+        rstate.y_end = y0 + font->height;
+    }
     rstate.callback = callback;
     rstate.state = state;
-    
-    p = find_glyph((struct mf_rlefont_s*)font, character);
-    if (!p)
-        return 0;
+#if MF_USE_FRAMEBUFFER
+    rstate.fb = (callback == mf_framebuffer_callback) ? state : 0;
+#endif
+#if MF_USE_SPAN_BATCH
+    rstate.batch = (callback == mf_span_batch_callback) ? state : 0;
+#endif
+#if MF_USE_EXPANDED_DICTIONARY
+    rstate.dict = find_expanded_dict(rlefont);
+#endif
     
     width = *p++;
+    
+#if MF_USE_CLIPPING
+    /* Skip glyphs that are completely clipped, and stop decoding when
+     * the bottom (or right, for column-major fonts) edge of the clip
+     * rectangle is reached. */
+    if (rstate.clip.x0 >= x0 + font->width || rstate.clip.x1 <= x0 ||
+        rstate.clip.y0 >= y0 + font->height || rstate.clip.y1 <= y0)
+        return width;
+    
+    /* Runs are clipped in the decoding order, so swap the axes of the
+     * clip rectangle for column-major fonts. */
+    if (rstate.column_major)
+    {
+        struct mf_cliprect_s rect = rstate.clip;
+        rstate.clip.x0 = rect.y0;
+        rstate.clip.y0 = rect.x0;
+        rstate.clip.x1 = rect.y1;
+        rstate.clip.y1 = rect.x1;
+    }
+    
+    if (rstate.y_end > rstate.clip.y1)
+        rstate.y_end = rstate.clip.y1;
+#endif
+    
     while (rstate.y < rstate.y_end)
     {
-        write_glyph_codeword((struct mf_rlefont_s*)font, &rstate, *p++);
+        write_glyph_codeword(rlefont, &rstate, *p++);
     }
     
     return width;
 }
 
+uint8_t mf_rlefont_render_character(const struct mf_font_s *font,
+                                    int16_t x0, int16_t y0,
+                                    mf_char character,
+                                    mf_pixel_callback_t callback,
+                                    void *state)
+{
+    const struct mf_rlefont_s *rlefont = (const struct mf_rlefont_s*)font;
+    const uint8_t *p;
+    
+    p = find_glyph(rlefont, character);
+    if (!p)
+        return 0;
+    
+    return render_glyph(rlefont, x0, y0, p, callback, state);
+}
+
+uint8_t mf_rlefont_render_glyph_ref(const struct mf_font_s *font,
+                                    int16_t x0, int16_t y0,
+                                    const struct mf_glyph_ref_s *glyph,
+                                    mf_pixel_callback_t callback,
+                                    void *state)
+{
+    const struct mf_rlefont_s *rlefont = (const struct mf_rlefont_s*)font;
+    const struct mf_rlefont_char_range_s *range;
+    
+    if (glyph->range >= rlefont->char_range_count)
+        return 0;
+    
+    range = &rlefont->char_ranges[glyph->range];
+    if (glyph->index >= range->char_count)
+        return 0;
+    
+    return render_glyph(rlefont, x0, y0,
+                        &range->glyph_data[range->glyph_offsets[glyph->index]],
+                        callback, state);
+}
+
 uint8_t mf_rlefont_character_width(const struct mf_font_s *font,
-                                   uint16_t character)
+                                   mf_char character)
 {
     const uint8_t *p;
     p = find_glyph((struct mf_rlefont_s*)font, character);
@@ -280,3 +756,19 @@ uint8_t mf_rlefont_character_width(const struct mf_font_s *font,
     
     return *p;
 }
+
+#if MF_USE_KERNING
+const uint8_t *mf_rlefont_kerning_edges(const struct mf_font_s *font,
+                                        mf_char character)
+{
+    const struct mf_rlefont_s *rlefont = (const struct mf_rlefont_s*)font;
+    const struct mf_rlefont_char_range_s *range;
+    uint16_t index;
+    
+    range = find_char_range(rlefont, character, &index);
+    if (!range || !range->kerning_edges)
+        return 0;
+    
+    return range->kerning_edges + index * MF_KERNING_EDGE_BYTES;
+}
+#endif
@@ -10,6 +10,9 @@
 /* Versions of the RLE font format that are supported. */
 #define MF_RLEFONT_VERSION_4_SUPPORTED 1
 
+/* The decoder supports glyph data stored column-by-column. */
+#define MF_RLEFONT_COLUMN_MAJOR_SUPPORTED 1
+
 /* Structure for a range of characters. This implements a sparse storage of
  * character indices, so that you can e.g. pick a 100 characters in the middle
  * of the UTF16 range and just store them. */
@@ -26,6 +29,10 @@ struct mf_rlefont_char_range_s
     
     /* The encoded glyph data for glyphs in this range. */
     const uint8_t *glyph_data;
+    
+    /* Precomputed kerning edges for the glyphs in this range, or NULL.
+     * See mf_kerning.h for the format. */
+    const uint8_t *kerning_edges;
 };
 
 /* Structure for a single encoded font. */
@@ -57,8 +64,37 @@ struct mf_rlefont_s
     
     /* Array of the character ranges */
     const struct mf_rlefont_char_range_s *char_ranges;
+    
+    /* Nonzero if the glyphs are encoded column-by-column. The pixels are
+     * then output in column order, one pixel per callback. */
+    const uint8_t column_major;
 };
 
+#if MF_USE_EXPANDED_DICTIONARY
+/* Get the size of the buffer needed by mf_rlefont_expand_dictionary.
+ *
+ * font: Pointer to the font definition.
+ *
+ * Returns the number of bytes, or 0 if the font is not a rlefont or the
+ * dictionary is too large to expand.
+ */
+MF_EXTERN uint32_t mf_rlefont_expanded_size(const struct mf_font_s *font);
+
+/* Expand the dictionary of the font into flat lists of pixel runs, so that
+ * rendering does not need to decode the nested dictionary entries. The
+ * buffer must stay valid as long as the font is used. Pass a NULL buffer
+ * to stop using a previous expansion.
+ *
+ * font:   Pointer to the font definition.
+ * buffer: Memory to store the expansion in. Must be aligned for a pointer.
+ * size:   Size of the buffer in bytes.
+ *
+ * Returns false if the buffer is too small or the font is not a rlefont.
+ */
+MF_EXTERN bool mf_rlefont_expand_dictionary(const struct mf_font_s *font,
+                                            void *buffer, uint32_t size);
+#endif
+
 #ifdef MF_RLEFONT_INTERNALS
 /* Internal functions, don't use these directly. */
 MF_EXTERN uint8_t mf_rlefont_render_character(const struct mf_font_s *font,
@@ -67,8 +103,19 @@ MF_EXTERN uint8_t mf_rlefont_render_character(const struct mf_font_s *font,
                                               mf_pixel_callback_t callback,
                                               void *state);
 
+MF_EXTERN uint8_t mf_rlefont_render_glyph_ref(const struct mf_font_s *font,
+                                              int16_t x0, int16_t y0,
+                                              const struct mf_glyph_ref_s *glyph,
+                                              mf_pixel_callback_t callback,
+                                              void *state);
+
 MF_EXTERN uint8_t mf_rlefont_character_width(const struct mf_font_s *font,
                                              mf_char character);
+
+#if MF_USE_KERNING
+MF_EXTERN const uint8_t *mf_rlefont_kerning_edges(const struct mf_font_s *font,
+                                                  mf_char character);
+#endif
 #endif
 
 #endif
@@ -1,31 +1,336 @@
 #include "mf_scaledfont.h"
+#include "mf_clip.h"
+#include "mf_framebuffer.h"
+
+/* Number of fractional bits in the scale factors. */
+#define SCALE_SHIFT 8
+
+#if MF_USE_SCALE_SMOOTHING
+/* One pixel run, in the coordinates of the base font. */
+struct scaled_run
+{
+    int16_t x;
+    uint8_t count;
+    uint8_t alpha;
+};
+#endif
 
 struct scaled_renderstate
 {
     mf_pixel_callback_t orig_callback;
     void *orig_state;
-    uint8_t x_scale;
-    uint8_t y_scale;
+    uint16_t x_scale;
+    uint16_t y_scale;
     int16_t x0;
     int16_t y0;
+    
+#if MF_USE_SCALE_SMOOTHING
+    /* Runs of the current row of the base font. */
+    int16_t row;
+    uint8_t count;
+    struct scaled_run runs[MF_SCALE_ROW_RUNS];
+    
+    /* Output row that is shared by several rows of the base font. The
+     * alpha of the runs has already been weighted by the vertical
+     * coverage. */
+    int16_t pending_row;
+    uint8_t pending_count;
+    struct scaled_run pending[2 * MF_SCALE_ROW_RUNS];
+#endif
 };
 
+/* Pass a pixel run of any length to the original callback. */
+static void write_run(struct scaled_renderstate *rstate,
+                      int32_t x, int16_t y, int32_t count, uint8_t alpha)
+{
+    while (count > 0)
+    {
+        uint8_t part = (count > 255) ? 255 : count;
+        
+        if (alpha)
+            rstate->orig_callback(x, y, part, alpha, rstate->orig_state);
+        
+        x += part;
+        count -= part;
+    }
+}
+
+/* Nearest-neighbor scaling. The run is scaled once, and then written to
+ * each of the output rows that the base row maps to. A framebuffer gets
+ * all the rows as one rectangle, other callbacks are called once per row.
+ * When scaling down, runs that map to no output pixels are left out. */
 static void scaled_pixel_callback(int16_t x, int16_t y, uint8_t count,
                                   uint8_t alpha, void *state)
 {
     struct scaled_renderstate *rstate = state;
-    uint8_t dy;
+    int32_t start, end;
+    int16_t row, last;
+    
+    start = ((int32_t)x * rstate->x_scale) >> SCALE_SHIFT;
+    end = (((int32_t)x + count) * rstate->x_scale) >> SCALE_SHIFT;
+    row = ((int32_t)y * rstate->y_scale) >> SCALE_SHIFT;
+    last = (((int32_t)y + 1) * rstate->y_scale) >> SCALE_SHIFT;
+    
+    start += rstate->x0;
+    end += rstate->x0;
+    row += rstate->y0;
+    last += rstate->y0;
+    
+    if (end <= start || last <= row)
+        return;
+    
+#if MF_USE_FRAMEBUFFER
+    if (rstate->orig_callback == mf_framebuffer_callback)
+    {
+        mf_framebuffer_fill_rect(rstate->orig_state, start, row,
+                                 end - start, last - row, alpha);
+        return;
+    }
+#endif
+    
+    if (end - start <= 255)
+    {
+        for (; row < last; row++)
+        {
+            rstate->orig_callback(start, row, end - start, alpha,
+                                  rstate->orig_state);
+        }
+    }
+    else
+    {
+        for (; row < last; row++)
+            write_run(rstate, start, row, end - start, alpha);
+    }
+}
+
+#if MF_USE_SCALE_SMOOTHING
+/* Write one output row from a list of runs in base font coordinates. The
+ * pixels that a run covers only partially are collected to edge_sum, so
+ * that the runs on both sides of an edge produce a single pixel. */
+static void write_smooth_row(struct scaled_renderstate *rstate, int16_t y,
+                             const struct scaled_run *runs, uint8_t count)
+{
+    uint8_t i;
+    int32_t edge_x = 0;
+    uint16_t edge_sum = 0;
+    
+    y += rstate->y0;
+    
+    for (i = 0; i < count; i++)
+    {
+        int32_t start = (int32_t)runs[i].x * rstate->x_scale;
+        int32_t end = start + (int32_t)runs[i].count * rstate->x_scale;
+        
+        while (start < end)
+        {
+            int32_t pixel = start >> SCALE_SHIFT;
+            int32_t next = (pixel + 1) << SCALE_SHIFT;
+            
+            if (pixel != edge_x)
+            {
+                write_run(rstate, rstate->x0 + edge_x, y, 1,
+                          (edge_sum + 128) >> SCALE_SHIFT);
+                edge_x = pixel;
+                edge_sum = 0;
+            }
+            
+            if (start == (pixel << SCALE_SHIFT) && end >= next)
+            {
+                write_run(rstate, rstate->x0 + pixel, y,
+                          (end >> SCALE_SHIFT) - pixel, runs[i].alpha);
+                start = (end >> SCALE_SHIFT) << SCALE_SHIFT;
+                edge_x = start >> SCALE_SHIFT;
+            }
+            else
+            {
+                int32_t part = ((end < next) ? end : next) - start;
+                edge_sum += runs[i].alpha * part;
+                if (edge_sum > 255 << SCALE_SHIFT)
+                    edge_sum = 255 << SCALE_SHIFT;
+                start += part;
+            }
+        }
+    }
+    
+    write_run(rstate, rstate->x0 + edge_x, y, 1,
+              (edge_sum + 128) >> SCALE_SHIFT);
+}
+
+static void flush_pending(struct scaled_renderstate *rstate)
+{
+    write_smooth_row(rstate, rstate->pending_row,
+                     rstate->pending, rstate->pending_count);
+    rstate->pending_count = 0;
+}
+
+/* Add the weighted runs of the current base row to the pending row. Both
+ * lists are sorted by x, so they are merged by sweeping over them. Returns
+ * false if the result does not fit in the buffer. */
+static bool merge_pending(struct scaled_renderstate *rstate,
+                          uint16_t weight)
+{
+    struct scaled_run result[2 * MF_SCALE_ROW_RUNS];
+    const struct scaled_run *a = rstate->pending;
+    const struct scaled_run *b = rstate->runs;
+    uint8_t i = 0, j = 0, count = 0;
+    int16_t pos = -32767 - 1;
+    
+    while (i < rstate->pending_count || j < rstate->count)
+    {
+        int16_t a_start = 32767, a_end = 32767;
+        int16_t b_start = 32767, b_end = 32767;
+        int16_t end;
+        uint16_t alpha;
+        
+        if (i < rstate->pending_count)
+        {
+            a_start = (a[i].x > pos) ? a[i].x : pos;
+            a_end = a[i].x + a[i].count;
+        }
+        
+        if (j < rstate->count)
+        {
+            b_start = (b[j].x > pos) ? b[j].x : pos;
+            b_end = b[j].x + b[j].count;
+        }
+        
+        if (a_start < b_start)
+        {
+            pos = a_start;
+            end = (a_end < b_start) ? a_end : b_start;
+            alpha = a[i].alpha;
+        }
+        else if (b_start < a_start)
+        {
+            pos = b_start;
+            end = (b_end < a_start) ? b_end : a_start;
+            alpha = (b[j].alpha * weight + 128) >> SCALE_SHIFT;
+        }
+        else
+        {
+            pos = a_start;
+            end = (a_end < b_end) ? a_end : b_end;
+            alpha = a[i].alpha + ((b[j].alpha * weight + 128) >> SCALE_SHIFT);
+        }
+        
+        if (alpha > 255)
+            alpha = 255;
+        
+        if (count && result[count - 1].x + result[count - 1].count == pos &&
+            result[count - 1].alpha == alpha &&
+            result[count - 1].count + (end - pos) <= 255)
+        {
+            result[count - 1].count += end - pos;
+        }
+        else if (count == 2 * MF_SCALE_ROW_RUNS)
+        {
+            return false;
+        }
+        else
+        {
+            result[count].x = pos;
+            result[count].count = end - pos;
+            result[count].alpha = alpha;
+            count++;
+        }
+        
+        pos = end;
+        if (i < rstate->pending_count && a_end <= pos) i++;
+        if (j < rstate->count && b_end <= pos) j++;
+    }
+    
+    for (i = 0; i < count; i++)
+        rstate->pending[i] = result[i];
+    rstate->pending_count = count;
+    return true;
+}
+
+static void add_pending(struct scaled_renderstate *rstate, int16_t row,
+                        uint16_t weight)
+{
+    if (rstate->pending_count && rstate->pending_row != row)
+        flush_pending(rstate);
     
-    count *= rstate->x_scale;
-    x = rstate->x0 + x * rstate->x_scale;
-    y = rstate->y0 + y * rstate->y_scale;
+    rstate->pending_row = row;
+    if (!merge_pending(rstate, weight))
+    {
+        flush_pending(rstate);
+        merge_pending(rstate, weight);
+    }
+}
+
+/* Write out the output rows of the buffered base row. The rows that the
+ * base row covers completely are written directly, and the partially
+ * covered ones are blended with the neighboring base rows. */
+static void flush_row(struct scaled_renderstate *rstate)
+{
+    int32_t top = (int32_t)rstate->row * rstate->y_scale;
+    int32_t bottom = top + rstate->y_scale;
     
-    for (dy = 0; dy < rstate->y_scale; dy++)
+    if (!rstate->count)
+        return;
+    
+    while (top < bottom)
     {
-        rstate->orig_callback(x, y + dy, count, alpha, rstate->orig_state);
+        int16_t y = top >> SCALE_SHIFT;
+        int32_t next = (int32_t)(y + 1) << SCALE_SHIFT;
+        
+        if (top == ((int32_t)y << SCALE_SHIFT) && bottom >= next)
+        {
+            if (rstate->pending_count)
+                flush_pending(rstate);
+            write_smooth_row(rstate, y, rstate->runs, rstate->count);
+        }
+        else
+        {
+            if (next > bottom)
+                next = bottom;
+            add_pending(rstate, y, next - top);
+        }
+        
+        top = next;
     }
+    
+    rstate->count = 0;
 }
+
+/* Smoothed scaling. The runs are collected until the row of the base font
+ * changes, because the partially covered pixels depend on the neighboring
+ * runs. */
+static void smooth_pixel_callback(int16_t x, int16_t y, uint8_t count,
+                                  uint8_t alpha, void *state)
+{
+    struct scaled_renderstate *rstate = state;
+    struct scaled_run *run;
+    
+    if (rstate->count &&
+        (y != rstate->row || rstate->count == MF_SCALE_ROW_RUNS))
+    {
+        flush_row(rstate);
+    }
+    
+    rstate->row = y;
+    run = &rstate->runs[rstate->count++];
+    run->x = x;
+    run->count = count;
+    run->alpha = alpha;
+}
+#endif
+
+/* Scale a dimension of the font, limiting it to the range of uint8_t. */
+static uint8_t scale_value(uint8_t value, uint16_t scale, bool round_up)
+{
+    uint32_t result = (uint32_t)value * scale;
     
+    if (round_up)
+        result += (1 << SCALE_SHIFT) - 1;
+    else
+        result += 1 << (SCALE_SHIFT - 1);
+    
+    result >>= SCALE_SHIFT;
+    return (result > 255) ? 255 : result;
+}
+
 static uint8_t scaled_character_width(const struct mf_font_s *font,
                                       mf_char character)
 {
@@ -34,9 +339,31 @@ static uint8_t scaled_character_width(const struct mf_font_s *font,
     
     basewidth = sfont->basefont->character_width(sfont->basefont, character);
     
-    return sfont->x_scale * basewidth;
+    return scale_value(basewidth, sfont->x_scale, false);
 }
 
+#if MF_USE_CLIPPING
+/* Convert a clip edge to the coordinates of the base font, rounding
+ * outwards so that partially covered base pixels are included. */
+static int16_t unscale_edge(int16_t edge, int16_t origin, uint16_t scale,
+                            bool round_up)
+{
+    int32_t pos = ((int32_t)edge - origin) << SCALE_SHIFT;
+    
+    if (round_up)
+        pos += scale - 1;
+    
+    /* Division rounding towards negative infinity. */
+    if (pos < 0)
+        pos -= scale - 1;
+    pos /= scale;
+    
+    if (pos < -32768) pos = -32768;
+    if (pos > 32767) pos = 32767;
+    return pos;
+}
+#endif
+
 static uint8_t scaled_render_character(const struct mf_font_s *font,
                                        int16_t x0, int16_t y0,
                                        mf_char character,
@@ -45,7 +372,11 @@ static uint8_t scaled_render_character(const struct mf_font_s *font,
 {
     struct mf_scaledfont_s *sfont = (struct mf_scaledfont_s*)font;
     struct scaled_renderstate rstate;
+    mf_pixel_callback_t scaled_callback = scaled_pixel_callback;
     uint8_t basewidth;
+#if MF_USE_CLIPPING
+    struct mf_clip_s clip;
+#endif
     
     rstate.orig_callback = callback;
     rstate.orig_state = state;
@@ -54,30 +385,87 @@ static uint8_t scaled_render_character(const struct mf_font_s *font,
     rstate.x0 = x0;
     rstate.y0 = y0;
     
-    basewidth = sfont->basefont->render_character(sfont->basefont, 0, 0,
-                            character, scaled_pixel_callback, &rstate);
+#if MF_USE_SCALE_SMOOTHING
+    if (sfont->smooth)
+    {
+        scaled_callback = smooth_pixel_callback;
+        rstate.row = 0;
+        rstate.count = 0;
+        rstate.pending_row = 0;
+        rstate.pending_count = 0;
+    }
+#endif
     
-    return sfont->x_scale * basewidth;
+#if MF_USE_CLIPPING
+    /* Let the base font skip the clipped areas. The original callback
+     * still trims the scaled runs to the exact rectangle. */
+    if (mf_clip_get_rect(&clip.rect, &callback, &state))
+    {
+        clip.rect.x0 = unscale_edge(clip.rect.x0, x0, rstate.x_scale, false);
+        clip.rect.y0 = unscale_edge(clip.rect.y0, y0, rstate.y_scale, false);
+        clip.rect.x1 = unscale_edge(clip.rect.x1, x0, rstate.x_scale, true);
+        clip.rect.y1 = unscale_edge(clip.rect.y1, y0, rstate.y_scale, true);
+        clip.callback = scaled_callback;
+        clip.state = &rstate;
+        
+        basewidth = sfont->basefont->render_character(sfont->basefont, 0, 0,
+                                character, mf_clip_callback, &clip);
+    }
+    else
+#endif
+    {
+        basewidth = sfont->basefont->render_character(sfont->basefont, 0, 0,
+                                character, scaled_callback, &rstate);
+    }
+    
+#if MF_USE_SCALE_SMOOTHING
+    if (sfont->smooth)
+    {
+        flush_row(&rstate);
+        if (rstate.pending_count)
+            flush_pending(&rstate);
+    }
+#endif
+    
+    return scale_value(basewidth, sfont->x_scale, false);
 }
 
 void mf_scale_font(struct mf_scaledfont_s *newfont,
                    const struct mf_font_s *basefont,
                    uint8_t x_scale, uint8_t y_scale)
+{
+    mf_scale_font_fixed(newfont, basefont, x_scale * MF_SCALE_ONE,
+                        y_scale * MF_SCALE_ONE, false);
+}
+
+void mf_scale_font_fixed(struct mf_scaledfont_s *newfont,
+                         const struct mf_font_s *basefont,
+                         uint16_t x_scale, uint16_t y_scale,
+                         bool smooth)
 {
     newfont->font = *basefont;
     newfont->basefont = basefont;
     
-    newfont->font.width *= x_scale;
-    newfont->font.height *= y_scale;
-    newfont->font.baseline_x *= x_scale;
-    newfont->font.baseline_y *= y_scale;
-    newfont->font.min_x_advance *= x_scale;
-    newfont->font.max_x_advance *= x_scale;
-    newfont->font.line_height *= y_scale;
+    newfont->font.width = scale_value(basefont->width, x_scale, true);
+    newfont->font.height = scale_value(basefont->height, y_scale, true);
+    newfont->font.baseline_x = scale_value(basefont->baseline_x,
+                                           x_scale, false);
+    newfont->font.baseline_y = scale_value(basefont->baseline_y,
+                                           y_scale, false);
+    newfont->font.min_x_advance = scale_value(basefont->min_x_advance,
+                                              x_scale, false);
+    newfont->font.max_x_advance = scale_value(basefont->max_x_advance,
+                                              x_scale, false);
+    newfont->font.line_height = scale_value(basefont->line_height,
+                                            y_scale, false);
     newfont->font.character_width = &scaled_character_width;
     newfont->font.render_character = &scaled_render_character;
+    newfont->font.render_glyph_ref = 0;
+    newfont->font.kerning_edges = 0;
+    newfont->font.kerning_table = 0;
+    newfont->font.metrics = 0;
     
     newfont->x_scale = x_scale;
     newfont->y_scale = y_scale;
+    newfont->smooth = smooth;
 }
-
@@ -1,5 +1,7 @@
 /* Generate scaled (nearest-neighbor) fonts. This can be used for displaying
  * larger text without spending the memory required for including larger fonts.
+ * The scale factors can also be fractional, and the edges of the scaled
+ * pixels can optionally be smoothed with partial alpha.
  */
 
 #ifndef _MF_SCALEDFONT_H_
@@ -7,17 +9,50 @@
 
 #include "mf_font.h"
 
+/* Scale factor of 1.0 for mf_scale_font_fixed(). For example 1.5 is
+ * 3 * MF_SCALE_ONE / 2. */
+#define MF_SCALE_ONE 256
+
 struct mf_scaledfont_s
 {
     struct mf_font_s font;
     
     const struct mf_font_s *basefont;
-    uint8_t x_scale;
-    uint8_t y_scale;
+    uint16_t x_scale; /* In units of 1 / MF_SCALE_ONE. */
+    uint16_t y_scale;
+    bool smooth;
 };
 
+/* Make a font that is scaled by integer factors.
+ *
+ * newfont:  Structure to initialize, usually allocated statically.
+ * basefont: The font to scale.
+ * x_scale:  Horizontal scale factor.
+ * y_scale:  Vertical scale factor.
+ */
 MF_EXTERN void mf_scale_font(struct mf_scaledfont_s *newfont,
                              const struct mf_font_s *basefont,
                              uint8_t x_scale, uint8_t y_scale);
 
+/* Make a font that is scaled by fixed-point factors, such as 1.5 or 2.5.
+ * With fractional factors, some rows and columns of the base font become
+ * one pixel wider than the others. Smoothing renders the partially covered
+ * pixels with partial alpha instead, which looks more even on grayscale
+ * displays. Each pixel is then written once, except with fonts exported
+ * in column order, which do not decode the glyph rows in order. Factors
+ * below 1.0 shrink the font, dropping some of the rows and columns of the
+ * base font unless it is smoothed.
+ *
+ * newfont:  Structure to initialize, usually allocated statically.
+ * basefont: The font to scale.
+ * x_scale:  Horizontal scale factor, MF_SCALE_ONE for 1.0.
+ * y_scale:  Vertical scale factor, MF_SCALE_ONE for 1.0.
+ * smooth:   True to smooth the edges. Ignored if MF_USE_SCALE_SMOOTHING
+ *           is disabled.
+ */
+MF_EXTERN void mf_scale_font_fixed(struct mf_scaledfont_s *newfont,
+                                   const struct mf_font_s *basefont,
+                                   uint16_t x_scale, uint16_t y_scale,
+                                   bool smooth);
+
 #endif
@@ -0,0 +1,67 @@
+#include "mf_spans.h"
+
+#if MF_USE_SPAN_BATCH
+
+void mf_span_batch_init(struct mf_span_batch_s *batch,
+                        mf_span_callback_t callback, void *state,
+                        bool flush_rows)
+{
+    batch->callback = callback;
+    batch->state = state;
+    batch->flush_rows = flush_rows;
+    batch->count = 0;
+}
+
+void mf_span_batch_add(struct mf_span_batch_s *batch,
+                       int16_t x, int16_t y, uint8_t count,
+                       uint8_t alpha)
+{
+    struct mf_span_s *span;
+    
+    if (batch->count == MF_SPAN_BATCH_SIZE ||
+        (batch->flush_rows && batch->count &&
+         batch->spans[batch->count - 1].y != y))
+    {
+        mf_span_batch_flush(batch);
+    }
+    
+    span = &batch->spans[batch->count++];
+    span->x = x;
+    span->y = y;
+    span->count = count;
+    span->alpha = alpha;
+}
+
+void mf_span_batch_flush(struct mf_span_batch_s *batch)
+{
+    if (batch->count)
+    {
+        batch->callback(batch->spans, batch->count, batch->state);
+        batch->count = 0;
+    }
+}
+
+void mf_span_batch_callback(int16_t x, int16_t y, uint8_t count,
+                            uint8_t alpha, void *state)
+{
+    mf_span_batch_add(state, x, y, count, alpha);
+}
+
+uint8_t mf_render_character_spans(const struct mf_font_s *font,
+                                  int16_t x0, int16_t y0,
+                                  mf_char character,
+                                  mf_span_callback_t callback,
+                                  void *state)
+{
+    struct mf_span_batch_s batch;
+    uint8_t width;
+    
+    mf_span_batch_init(&batch, callback, state, false);
+    width = mf_render_character(font, x0, y0, character,
+                                mf_span_batch_callback, &batch);
+    mf_span_batch_flush(&batch);
+    
+    return width;
+}
+
+#endif
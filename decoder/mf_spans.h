@@ -0,0 +1,90 @@
+/* Batched output of pixel runs. Instead of calling the pixel callback for
+ * every run, the runs are collected into a small buffer and passed to the
+ * span callback as an array. This allows the display driver to set up the
+ * transfer once and stream the data.
+ */
+
+#ifndef _MF_SPANS_H_
+#define _MF_SPANS_H_
+
+#include "mf_font.h"
+
+/* One horizontal run of pixels, with the same meaning as the parameters
+ * of mf_pixel_callback_t. */
+struct mf_span_s
+{
+    int16_t x;
+    int16_t y;
+    uint8_t count;
+    uint8_t alpha;
+};
+
+/* Callback function that receives a batch of spans.
+ *
+ * spans: Array of the spans, in the order they were rendered.
+ * count: Number of spans in the array.
+ * state: Free variable that was passed to mf_span_batch_init().
+ */
+typedef void (*mf_span_callback_t) (const struct mf_span_s *spans,
+                                    uint8_t count, void *state);
+
+/* Buffer for collecting the spans. Usually allocated on stack. */
+struct mf_span_batch_s
+{
+    mf_span_callback_t callback;
+    void *state;
+    
+    /* True to flush the buffer whenever a new row begins. */
+    bool flush_rows;
+    
+    /* Number of spans currently in the buffer. */
+    uint8_t count;
+    
+    struct mf_span_s spans[MF_SPAN_BATCH_SIZE];
+};
+
+/* Initialize a span batch buffer.
+ *
+ * batch:      Pointer to the buffer.
+ * callback:   Function to call with each batch of spans.
+ * state:      Free variable for caller to use (can be NULL).
+ * flush_rows: True to pass each row as a separate batch, false to flush
+ *             only when the buffer is full or mf_span_batch_flush is called.
+ */
+MF_EXTERN void mf_span_batch_init(struct mf_span_batch_s *batch,
+                                  mf_span_callback_t callback, void *state,
+                                  bool flush_rows);
+
+/* Add a span to the batch, flushing it first if needed. */
+MF_EXTERN void mf_span_batch_add(struct mf_span_batch_s *batch,
+                                 int16_t x, int16_t y, uint8_t count,
+                                 uint8_t alpha);
+
+/* Pass any spans in the buffer to the span callback. */
+MF_EXTERN void mf_span_batch_flush(struct mf_span_batch_s *batch);
+
+/* Pixel callback that adds the pixels to a batch. Pass a pointer to the
+ * struct mf_span_batch_s as the state. This works with any font type, and
+ * the built-in decoders detect it and add the spans without calling back.
+ * Remember to call mf_span_batch_flush() after rendering.
+ */
+MF_EXTERN void mf_span_batch_callback(int16_t x, int16_t y, uint8_t count,
+                                      uint8_t alpha, void *state);
+
+/* Render a single character, passing the spans in batches.
+ *
+ * font:      Pointer to the font definition.
+ * x0, y0:    Upper left corner of the target area.
+ * character: The character code (unicode) to render.
+ * callback:  Callback function to receive the spans.
+ * state:     Free variable for caller to use (can be NULL).
+ *
+ * Returns width of the character.
+ */
+MF_EXTERN uint8_t mf_render_character_spans(const struct mf_font_s *font,
+                                            int16_t x0, int16_t y0,
+                                            mf_char character,
+                                            mf_span_callback_t callback,
+                                            void *state);
+
+#endif
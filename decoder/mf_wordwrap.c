@@ -6,59 +6,140 @@ static bool is_wrap_space(uint16_t c)
     return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '-';
 }
 
-#if MF_USE_ADVANCED_WORDWRAP
+/* Measure the width of a line without the trailing whitespace, the same
+ * way as mf_measure_line() does it without kerning. Tabs are rounded to
+ * the next tab stop, and a line that was split inside a word does not
+ * count the non-breaking spaces at its end. Advances the text pointer past the characters and
+ * returns the last character in *last. */
+static int16_t measure_line(const struct mf_font_s *font, mf_str *text,
+                            uint16_t count, mf_char *last)
+{
+    int16_t width = 0, trimmed = 0;
+    mf_char c = 0;
+    
+    while (count-- && **text)
+    {
+        c = mf_getchar(text);
+        
+        if (c == '\t')
+        {
+#if MF_USE_TABS
+            int16_t tabw = mf_character_width(font, 'm') * MF_TABSIZE;
+            width += mf_character_width(font, ' ');
+            width += tabw - (width + font->baseline_x) % tabw;
+#else
+            width += mf_character_width(font, ' ');
+#endif
+        }
+        else
+        {
+            width += mf_character_width(font, c);
+        }
+        
+        if ((!is_wrap_space(c) && c != 0xA0) || c == '-')
+            trimmed = width;
+    }
+    
+    *last = c;
+    return trimmed;
+}
+
+#if MF_USE_ADVANCED_WORDWRAP || MF_USE_OPTIMAL_WORDWRAP
 
 /* Represents a single word and the whitespace after it. */
 struct wordlen_s
 {
+    mf_str start; /* Start of the word in the text. */
     int16_t word; /* Length of the word in pixels. */
     int16_t space; /* Length of the whitespace in pixels. */
     uint16_t chars; /* Number of characters in word + space, combined. */
+    bool linebreak; /* True if the word ends in a linebreak. */
+    bool split; /* True if the word was too long and has been split. */
 };
 
-/* Take the next word from the string and compute its width.
- * Returns true if the word ends in a linebreak. */
-static bool get_wordlen(const struct mf_font_s *font, mf_str *text,
-                        struct wordlen_s *result)
+/* Reads the text one word at a time. The character following the previous
+ * word has already been decoded and measured, so that each character is
+ * processed only once. */
+struct wordreader_s
 {
-    mf_char c;
-    mf_str prev;
+    mf_str pos; /* Position of the lookahead character. */
+    mf_str next; /* Position after the lookahead character. */
+    mf_char c; /* The lookahead character, 0 at the end of text. */
+    uint8_t width; /* Width of the lookahead character, if not a space. */
+    bool tab; /* True if the whitespace after the last word has a tab. */
+};
+
+/* Move on to the next character in the text. */
+static void next_char(const struct mf_font_s *font, struct wordreader_s *r)
+{
+    r->pos = r->next;
+    r->c = mf_getchar(&r->next);
     
+    if (r->c && !is_wrap_space(r->c))
+        r->width = mf_character_width(font, r->c);
+}
+
+/* Take the next word from the text and compute its width. Words that are
+ * too long to fit on a line are split at max_width. */
+static void get_wordlen(const struct mf_font_s *font, int16_t max_width,
+                        struct wordreader_s *r, struct wordlen_s *result)
+{
+    result->start = r->pos;
     result->word = 0;
     result->space = 0;
     result->chars = 0;
+    result->linebreak = false;
+    result->split = false;
+    r->tab = false;
     
-    c = mf_getchar(text);
-    while (c && !is_wrap_space(c))
+    while (r->c && !is_wrap_space(r->c))
     {
+        if (result->word + r->width > max_width && result->chars)
+        {
+            /* We have a very long word, cut it off here. */
+            result->split = true;
+            return;
+        }
+        
         result->chars++;
-        result->word += mf_character_width(font, c);
-        c = mf_getchar(text);
+        result->word += r->width;
+        next_char(font, r);
     }
     
-    prev = *text;
-    while (c && is_wrap_space(c))
+    while (r->c && is_wrap_space(r->c))
     {
         result->chars++;
         
-        if (c == ' ')
-            result->space += mf_character_width(font, c);
-        else if (c == '\t')
+        if (r->c == ' ')
+            result->space += mf_character_width(font, ' ');
+        else if (r->c == '-')
+        {
+            /* The hyphen stays visible at the end of the line, so it
+             * belongs to the word, as does any space before it. */
+            result->word += result->space + mf_character_width(font, '-');
+            result->space = 0;
+        }
+        else if (r->c == '\t')
+        {
             result->space += mf_character_width(font, 'm') * MF_TABSIZE;
-        else if (c == '\n')
-            break;
+            r->tab = true;
+        }
+        else if (r->c == '\n')
+            result->linebreak = true;
         
-        prev = *text;
-        c = mf_getchar(text);
+        next_char(font, r);
+        
+        if (result->linebreak)
+            return;
     }
     
-    /* The last loop reads the first character of next word, put it back. */
-    if (c)
-        *text = prev;
-    
-    return (c == '\0' || c == '\n');
+    result->linebreak = (r->c == 0);
 }
 
+#endif
+
+#if MF_USE_ADVANCED_WORDWRAP
+
 /* Represents the rendered length for a single line. */
 struct linelen_s
 {
@@ -66,53 +147,33 @@ struct linelen_s
     uint16_t chars; /* Total number of characters on the line. */
     int16_t width; /* Total length of all words + whitespace on the line in pixels. */
     bool linebreak; /* True if line ends in a linebreak */
+    bool tabs; /* True if the line may have tabs, which widen it. */
+    mf_str greedy; /* End of the line before balancing. */
+    bool moved; /* True if a word was moved onto the line in balancing. */
     struct wordlen_s last_word; /* Last word on the line. */
     struct wordlen_s last_word_2; /* Second to last word on the line. */
 };
 
-/* Append word onto the line if it fits. If it would overflow, don't add and
- * return false. */
-static bool append_word(const struct mf_font_s *font, int16_t width,
-                        struct linelen_s *current, mf_str *text)
+/* Add a word to the end of the line. */
+static void add_word(struct linelen_s *current, const struct wordlen_s *wordlen)
 {
-    mf_str tmp = *text;
-    struct wordlen_s wordlen;
-    bool linebreak;
-    
-    linebreak = get_wordlen(font, &tmp, &wordlen);
-    
-    if (current->width + wordlen.word <= width)
-    {
-        *text = tmp;
-        current->last_word_2 = current->last_word;
-        current->last_word = wordlen;
-        current->linebreak = linebreak;
-        current->chars += wordlen.chars;
-        current->width += wordlen.word + wordlen.space;
-        return true;
-    }
-    else
-    {
-        return false;
-    }
+    current->last_word_2 = current->last_word;
+    current->last_word = *wordlen;
+    current->linebreak = wordlen->linebreak;
+    current->chars += wordlen->chars;
+    current->width += wordlen->word + wordlen->space;
 }
 
-/* Append a character to the line if it fits. */
-static bool append_char(const struct mf_font_s *font, int16_t width,
-                        struct linelen_s *current, mf_str *text)
+/* Append word onto the line if it fits. If it would overflow, don't add and
+ * return false. Words that have been split only go on an empty line. */
+static bool append_word(int16_t width, struct linelen_s *current,
+                        const struct wordlen_s *wordlen)
 {
-    mf_str tmp = *text;
-    mf_char c;
-    uint16_t w;
-    
-    c = mf_getchar(&tmp);
-    w = mf_character_width(font, c);
+    bool fits = !wordlen->split && current->width + wordlen->word <= width;
     
-    if (current->width + w <= width)
+    if (fits || !current->chars)
     {
-        *text = tmp;
-        current->chars++;
-        current->width += w;
+        add_word(current, wordlen);
         return true;
     }
     else
@@ -155,49 +216,67 @@ static void tune_lines(struct linelen_s *current, struct linelen_s *previous,
         current->chars += chars;
         previous->width -= previous->last_word.word + previous->last_word.space;
         current->width += previous->last_word.word + previous->last_word.space;
+        current->moved = true;
+        
+        if (previous->tabs)
+            current->tabs = true;
+        
         previous->last_word = previous->last_word_2;
         
         while (chars--) mf_rewind(&current->start);
     }
 }
 
-void mf_wordwrap(const struct mf_font_s *font, int16_t width,
-                 mf_str text, mf_line_callback_t callback, void *state)
+/* Callback for each line from wrap_lines(). Returns false to stop. */
+typedef bool (*line_dispatch_t)(const struct linelen_s *line, void *state);
+
+/* The main loop of the word wrap. Starts with the reader at the beginning
+ * of a line, and the line before it in 'previous' waiting to be balanced
+ * against it, or empty at the start of the text. */
+static void wrap_lines(const struct mf_font_s *font, int16_t width,
+                       struct wordreader_s *reader, struct linelen_s *previous,
+                       line_dispatch_t dispatch, void *state)
 {
     struct linelen_s current = {};
-    struct linelen_s previous = {};
+    struct wordlen_s word;
     bool full;
     
-    current.start = text;
+    /* The next word is read ahead, so that a word that does not fit on
+     * the line is carried over to the next line without measuring again. */
+    get_wordlen(font, width, reader, &word);
+    current.start = word.start;
     
-    while (*text)
+    while (word.chars)
     {
-        full = !append_word(font, width, &current, &text);
+        full = !append_word(width, &current, &word);
+        
+        /* The reader still refers to the word that was read ahead. */
+        if (!full && reader->tab)
+            current.tabs = true;
+        
+        if (!full)
+            get_wordlen(font, width, reader, &word);
         
         if (full || current.linebreak)
         {
-            if (!current.chars)
-            {
-                /* We have a very long word. We must just cut it off at some
-                 * point. */
-                while (append_char(font, width, &current, &text));
-            }
-            
-            if (previous.chars)
+            if (previous->chars)
             {
                 /* Tune the length and dispatch the previous line. */
-                if (!previous.linebreak && !current.linebreak)
-                    tune_lines(&current, &previous, width);
+                if (!previous->linebreak && !current.linebreak)
+                    tune_lines(&current, previous, width);
                 
-                if (!callback(previous.start, previous.chars, state))
+                if (!dispatch(previous, state))
                     return;
             }
             
-            previous = current;
-            current.start = text;
+            *previous = current;
+            previous->greedy = word.start;
+            current.start = word.start;
             current.chars = 0;
             current.width = 0;
             current.linebreak = false;
+            current.tabs = false;
+            current.moved = false;
             current.last_word.word = 0;
             current.last_word.space = 0;
             current.last_word.chars = 0;
@@ -205,16 +284,391 @@ void mf_wordwrap(const struct mf_font_s *font, int16_t width,
     }
     
     /* Dispatch the last lines. */
-    if (previous.chars)
+    if (previous->chars)
     {
-        if (!callback(previous.start, previous.chars, state))
+        if (!dispatch(previous, state))
             return;
     }
     
     if (current.chars)
-        callback(current.start, current.chars, state);
+    {
+        current.greedy = word.start;
+        dispatch(&current, state);
+    }
 }
 
+struct callback_s
+{
+    mf_line_callback_t callback;
+    void *state;
+};
+
+static bool call_callback(const struct linelen_s *line, void *state)
+{
+    struct callback_s *s = (struct callback_s*)state;
+    return s->callback(line->start, line->chars, s->state);
+}
+
+void mf_wordwrap(const struct mf_font_s *font, int16_t width,
+                 mf_str text, mf_line_callback_t callback, void *state)
+{
+    struct linelen_s previous = {};
+    struct wordreader_s reader;
+    struct callback_s s;
+    
+    s.callback = callback;
+    s.state = state;
+    
+    reader.next = text;
+    next_char(font, &reader);
+    wrap_lines(font, width, &reader, &previous, call_callback, &s);
+}
+
+struct linelist_s
+{
+    const struct mf_font_s *font;
+    int16_t width;
+    struct mf_lineinfo_s *lines;
+    uint16_t max_lines;
+    uint16_t count;
+};
+
+static bool store_lineinfo(const struct linelen_s *line, void *state)
+{
+    struct linelist_s *s = (struct linelist_s*)state;
+    struct mf_lineinfo_s *info;
+    
+    if (s->count < s->max_lines)
+    {
+        info = &s->lines[s->count];
+        info->start = line->start;
+        info->chars = line->chars;
+        info->width = line->width - line->last_word.space;
+        info->linebreak = line->linebreak;
+        
+        if (line->tabs || line->last_word.split)
+        {
+            /* The word wrap counts a fixed width for each tab, and keeps
+             * the non-breaking spaces at the end of a split word. Measure
+             * these lines again the same way as they are rendered. */
+            mf_str p = line->start;
+            mf_char c;
+            
+            info->width = measure_line(s->font, &p, line->chars, &c);
+        }
+        else if (!line->last_word.chars && line->chars)
+        {
+            /* The last word was moved away by tune_lines() and the line only
+             * has a word that was moved onto it. Measure it again. */
+            struct wordreader_s reader;
+            struct wordlen_s word;
+            
+            reader.next = line->start;
+            next_char(s->font, &reader);
+            get_wordlen(s->font, s->width, &reader, &word);
+            info->width = word.word;
+        }
+    }
+    
+    s->count++;
+    return true;
+}
+
+uint16_t mf_wordwrap_lines(const struct mf_font_s *font, int16_t width,
+                           mf_str text, struct mf_lineinfo_s *lines,
+                           uint16_t max_lines)
+{
+    struct linelen_s previous = {};
+    struct wordreader_s reader;
+    struct linelist_s s;
+    
+    s.font = font;
+    s.width = width;
+    s.lines = lines;
+    s.max_lines = max_lines;
+    s.count = 0;
+    
+    reader.next = text;
+    next_char(font, &reader);
+    wrap_lines(font, width, &reader, &previous, store_lineinfo, &s);
+    return s.count;
+}
+
+#if MF_USE_INCREMENTAL_WORDWRAP
+
+/* State for storing the lines of an updated layout. The old lines that
+ * follow the restart point are kept at the end of the lines array, so that
+ * the new lines can be compared against them. */
+struct relayout_s
+{
+    struct mf_wordwrap_layout_s *layout;
+    mf_str text;
+    uint16_t position; /* Start of the edit. */
+    uint16_t edit_end; /* End of the edit in the new text. */
+    uint16_t index; /* Index of the next line to store. */
+    uint16_t old; /* Next old line after the edit that could match. */
+    uint16_t old_offset; /* Position of the old lines minus their index. */
+    uint16_t first; /* First line that has changed. */
+    uint16_t last; /* Line after the last line that has changed. */
+    bool converged; /* True if the rest of the old lines are still valid. */
+};
+
+/* Move lines within the array, the ranges may overlap.
+ * Avoids a dependency on libc. */
+static void move_lines(struct mf_wrapline_s *dest,
+                       const struct mf_wrapline_s *src, uint16_t count)
+{
+    if (dest < src)
+    {
+        while (count--)
+            *dest++ = *src++;
+    }
+    else
+    {
+        dest += count;
+        src += count;
+        while (count--)
+            *--dest = *--src;
+    }
+}
+
+static bool store_line(const struct linelen_s *line, void *state)
+{
+    struct relayout_s *s = (struct relayout_s*)state;
+    struct mf_wordwrap_layout_s *l = s->layout;
+    struct mf_wrapline_s *old;
+    uint16_t start = line->start - s->text;
+    uint16_t greedy = line->greedy - s->text;
+    uint32_t pos;
+    
+    if (s->index == l->max_lines)
+        return false;
+    
+    /* The old lines at positions before index have been overwritten. */
+    if (s->old < s->index)
+        s->old = s->index;
+    
+    while (s->old < l->max_lines && l->lines[s->old].start < start)
+        s->old++;
+    
+    /* Once a line after the edit starts and wraps at the same place as
+     * before, the rest of the lines will be the same as well. */
+    if (start >= s->edit_end && s->old < l->max_lines &&
+        l->lines[s->old].start == start && l->lines[s->old].greedy == greedy &&
+        l->lines[s->old].moved == line->moved)
+    {
+        uint16_t remaining = l->max_lines - s->old;
+        uint16_t old_count = l->max_lines - s->old_offset;
+        
+        move_lines(&l->lines[s->index], &l->lines[s->old], remaining);
+        
+        /* If lines were added or removed, the rest of them have moved. */
+        if (s->old - s->old_offset == s->index)
+            s->last = s->index;
+        else if (s->index + remaining > old_count)
+            s->last = s->index + remaining;
+        else
+            s->last = old_count;
+        
+        s->index += remaining;
+        s->converged = true;
+        return false;
+    }
+    
+    /* Compare with the old line that had the same index. */
+    pos = s->index + s->old_offset;
+    if (pos >= l->max_lines || l->lines[pos].start != start ||
+        l->lines[pos].chars != line->chars ||
+        (start >= s->position && start < s->edit_end))
+    {
+        if (s->index < s->first)
+            s->first = s->index;
+    }
+    
+    old = &l->lines[s->index++];
+    old->start = start;
+    old->chars = line->chars;
+    old->greedy = greedy;
+    old->moved = line->moved;
+    return true;
+}
+
+void mf_wordwrap_layout(struct mf_wordwrap_layout_s *layout,
+                        const struct mf_font_s *font, int16_t width,
+                        struct mf_wrapline_s *lines, uint16_t max_lines,
+                        mf_str text)
+{
+    uint16_t first, last;
+    
+    layout->font = font;
+    layout->width = width;
+    layout->lines = lines;
+    layout->max_lines = max_lines;
+    layout->count = 0;
+    
+    mf_wordwrap_update(layout, text, 0, 0, 0, &first, &last);
+}
+
+/* Wrap the text again, starting from a line that has stayed the same, or
+ * from the beginning of the text if line is NULL. */
+static void rewrap(struct relayout_s *s, const struct mf_wrapline_s *line)
+{
+    const struct mf_wordwrap_layout_s *l = s->layout;
+    struct linelen_s previous = {};
+    struct wordreader_s reader;
+    struct wordlen_s word;
+    
+    if (line)
+    {
+        /* Rebuild the line from the words it had before balancing. */
+        reader.next = s->text + line->start;
+        next_char(l->font, &reader);
+        previous.start = reader.pos;
+        previous.greedy = s->text + line->greedy;
+        previous.moved = line->moved;
+        
+        while (reader.pos < previous.greedy)
+        {
+            get_wordlen(l->font, l->width, &reader, &word);
+            if (!word.chars)
+                break;
+            add_word(&previous, &word);
+            
+            if (reader.tab)
+                previous.tabs = true;
+        }
+        
+        /* A word moved by tune_lines() is not tracked as the second to
+         * last word. */
+        if (line->moved && previous.last_word_2.start == previous.start)
+        {
+            previous.last_word_2.word = 0;
+            previous.last_word_2.space = 0;
+            previous.last_word_2.chars = 0;
+        }
+    }
+    else
+    {
+        reader.next = s->text;
+        next_char(l->font, &reader);
+    }
+    
+    wrap_lines(l->font, l->width, &reader, &previous, store_line, s);
+}
+
+void mf_wordwrap_update(struct mf_wordwrap_layout_s *layout,
+                        mf_str text, uint16_t position,
+                        uint16_t removed, uint16_t inserted,
+                        uint16_t *first, uint16_t *last)
+{
+    struct mf_wrapline_s *lines = layout->lines;
+    struct mf_wrapline_s restart_line;
+    struct relayout_s s;
+    uint16_t restart, block, i;
+    bool found = false;
+    
+    /* Find the last line that was laid out without looking at the edited
+     * text. Its state is decided when the next line has been wrapped. */
+    restart = 0;
+    for (i = layout->count; i > 1 && !found; i--)
+    {
+        if (lines[i - 1].greedy < position)
+        {
+            restart = i - 2;
+            restart_line = lines[restart];
+            found = true;
+        }
+    }
+    
+    /* Move the old lines out of the way to the end of the array, and adjust
+     * their offsets to the edited text. */
+    block = layout->max_lines - (layout->count - restart);
+    move_lines(&lines[block], &lines[restart], layout->count - restart);
+    
+    s.old = layout->max_lines;
+    for (i = layout->max_lines; i > block; i--)
+    {
+        struct mf_wrapline_s *line = &lines[i - 1];
+        
+        if (line->start >= position + removed)
+        {
+            line->start += inserted - removed;
+            line->greedy += inserted - removed;
+            s.old = i - 1;
+        }
+        else if (line->start >= position)
+        {
+            /* The line started in the removed text, so it cannot match. */
+            line->start = 0xFFFF;
+        }
+    }
+    
+    s.layout = layout;
+    s.text = text;
+    s.position = position;
+    s.edit_end = position + inserted;
+    s.index = restart;
+    s.old_offset = block - restart;
+    s.first = 0xFFFF;
+    s.last = 0;
+    s.converged = false;
+    
+    rewrap(&s, found ? &restart_line : 0);
+    
+    /* If lines were removed from a layout that did not fit all of the
+     * text, continue it from the last line. */
+    if (s.converged && s.index < layout->max_lines &&
+        text[lines[s.index - 1].greedy] != 0)
+    {
+        restart_line = lines[--s.index];
+        s.old = layout->max_lines;
+        s.old_offset = layout->max_lines;
+        s.converged = false;
+        rewrap(&s, &restart_line);
+    }
+    
+    if (!s.converged)
+    {
+        s.last = layout->count;
+        if (s.index > s.last)
+            s.last = s.index;
+    }
+    
+    layout->count = s.index;
+    
+    /* The line with the edit has always changed. */
+    i = mf_wordwrap_find_line(layout, position);
+    if (i < s.first && i < layout->count)
+        s.first = i;
+    if (s.first > s.last)
+        s.first = s.last;
+    
+    *first = s.first;
+    *last = s.last;
+}
+
+uint16_t mf_wordwrap_find_line(const struct mf_wordwrap_layout_s *layout,
+                               uint16_t position)
+{
+    uint16_t low = 0;
+    uint16_t high = layout->count;
+    
+    /* Find the last line that starts at or before position. */
+    while (high - low > 1)
+    {
+        uint16_t mid = (low + high) / 2;
+        
+        if (layout->lines[mid].start <= position)
+            low = mid;
+        else
+            high = mid;
+    }
+    
+    return low;
+}
+
+#endif
+
 #else
 
 void mf_wordwrap(const struct mf_font_s *font, int16_t width,
@@ -236,7 +690,7 @@ void mf_wordwrap(const struct mf_font_s *font, int16_t width,
     {
         cc_prev = 0;
         ls_prev = text;
-    
+        
         while (*text)
         {
             mf_char c;
@@ -287,4 +741,204 @@ void mf_wordwrap(const struct mf_font_s *font, int16_t width,
     }
 }
 
+struct linelist_s
+{
+    const struct mf_font_s *font;
+    struct mf_lineinfo_s *lines;
+    uint16_t max_lines;
+    uint16_t count;
+};
+
+static bool store_lineinfo(mf_str line, uint16_t count, void *state)
+{
+    struct linelist_s *s = (struct linelist_s*)state;
+    struct mf_lineinfo_s *info;
+    mf_str p = line;
+    mf_char c;
+    
+    if (s->count < s->max_lines)
+    {
+        info = &s->lines[s->count];
+        info->start = line;
+        info->chars = count;
+        info->width = measure_line(s->font, &p, count, &c);
+        info->linebreak = (c == '\n' || !*p);
+    }
+    
+    s->count++;
+    return true;
+}
+
+uint16_t mf_wordwrap_lines(const struct mf_font_s *font, int16_t width,
+                           mf_str text, struct mf_lineinfo_s *lines,
+                           uint16_t max_lines)
+{
+    struct linelist_s s;
+    
+    s.font = font;
+    s.lines = lines;
+    s.max_lines = max_lines;
+    s.count = 0;
+    
+    mf_wordwrap(font, width, text, store_lineinfo, &s);
+    return s.count;
+}
+
+#endif
+
+#if MF_USE_OPTIMAL_WORDWRAP
+
+/* One word in the scratch buffer of the optimal word wrap. The cost and
+ * the line information refer to the break just before this word. */
+struct optimal_word_s
+{
+    struct wordlen_s word;
+    uint32_t cost; /* Minimum cost of the lines before this word. */
+    uint16_t first; /* First word of the line that ends before this word. */
+    uint16_t next; /* Word after the line that starts with this word. */
+};
+
+/* Add two costs, saturating instead of wrapping around. */
+static uint32_t add_cost(uint32_t a, uint32_t b)
+{
+    return (a > 0xFFFFFFFF - b) ? 0xFFFFFFFF : a + b;
+}
+
+/* Find the line breaks that minimize the sum of squared space left at the
+ * end of the lines, for words 0 to count - 1. The last line is free, as
+ * the last line of a paragraph is expected to be short. */
+static void find_breaks(struct optimal_word_s *words, uint16_t count,
+                        int16_t width)
+{
+    uint16_t i, j;
+    int32_t linew;
+    uint32_t slack, cost;
+    
+    words[0].cost = 0;
+    for (j = 1; j <= count; j++)
+    {
+        words[j].cost = 0xFFFFFFFF;
+        words[j].first = j - 1;
+        linew = words[j - 1].word.word;
+        
+        /* Try each possible start for the line that ends before word j. */
+        for (i = j; i > 0; i--)
+        {
+            const struct wordlen_s *w = &words[i - 1].word;
+            
+            if (i < j)
+            {
+                linew += w->word + w->space;
+                if (linew > width)
+                    break;
+            }
+            
+            cost = words[i - 1].cost;
+            if (j != count)
+            {
+                slack = (linew < width) ? width - linew : linew - width;
+                cost = add_cost(cost, slack * slack);
+            }
+            
+            if (cost < words[j].cost)
+            {
+                words[j].cost = cost;
+                words[j].first = i - 1;
+            }
+            
+            /* Words that have been split always start a line. */
+            if (w->split)
+                break;
+        }
+    }
+}
+
+/* Dispatch the lines for words 0 to count - 1. If partial is set, the
+ * paragraph continues after the last word, so only the lines in the first
+ * half are dispatched and the rest are laid out again with the following
+ * words. Returns false if the callback requested to stop. */
+static bool dispatch_lines(struct optimal_word_s *words, uint16_t count,
+                           int16_t width, bool partial, uint16_t *dispatched,
+                           mf_line_callback_t callback, void *state)
+{
+    uint16_t i, j, k, chars;
+    
+    find_breaks(words, count, width);
+    
+    /* Follow the breaks backwards to get them in order. */
+    for (j = count; j > 0; j = i)
+    {
+        i = words[j].first;
+        words[i].next = j;
+    }
+    
+    for (i = 0; i < count; i = j)
+    {
+        j = words[i].next;
+        if (partial && j > count / 2 && i > 0)
+            break;
+        
+        chars = 0;
+        for (k = i; k < j; k++)
+            chars += words[k].word.chars;
+        
+        if (!callback(words[i].word.start, chars, state))
+            return false;
+    }
+    
+    *dispatched = i;
+    return true;
+}
+
+void mf_wordwrap_optimal(const struct mf_font_s *font, int16_t width,
+                         mf_str text, void *scratch, uint32_t size,
+                         mf_line_callback_t callback, void *state)
+{
+    struct optimal_word_s *words = scratch;
+    struct wordreader_s reader;
+    uint32_t max_words;
+    uint16_t count, done, i;
+    bool end;
+    
+    /* One entry is needed for the break after the last word. */
+    max_words = size / sizeof(struct optimal_word_s);
+    if (max_words > 0xFFFF)
+        max_words = 0xFFFF;
+    
+    if (max_words < 3)
+    {
+        mf_wordwrap(font, width, text, callback, state);
+        return;
+    }
+    max_words--;
+    
+    reader.next = text;
+    next_char(font, &reader);
+    count = 0;
+    
+    do
+    {
+        get_wordlen(font, width, &reader, &words[count].word);
+        end = (words[count].word.chars == 0);
+        if (!end)
+            count++;
+        
+        /* Lay out the paragraph when it ends, or the first part of it
+         * when the buffer gets full. */
+        if (end || words[count - 1].word.linebreak || count == max_words)
+        {
+            bool partial = !end && !words[count - 1].word.linebreak;
+            
+            if (!dispatch_lines(words, count, width, partial, &done,
+                                callback, state))
+                return;
+            
+            /* Move the remaining words to the start of the buffer. */
+            for (i = done; i < count; i++)
+                words[i - done] = words[i];
+            count -= done;
+        }
+    } while (!end);
+}
+
 #endif
@@ -28,5 +28,124 @@ typedef bool (*mf_line_callback_t) (mf_str line, uint16_t count,
  */
 MF_EXTERN void mf_wordwrap(const struct mf_font_s *font, int16_t width,
                            mf_str text, mf_line_callback_t callback, void *state);
+
+/* Information about one line of word wrapped text. */
+struct mf_lineinfo_s
+{
+    mf_str start; /* Pointer to the beginning of the line. */
+    uint16_t chars; /* Number of characters on the line. */
+    int16_t width; /* Width in pixels, without trailing whitespace. */
+    bool linebreak; /* True if the line ends in a linebreak or end of text. */
+};
+
+/* Word wrap a piece of text in one pass and store the lines into an array.
+ * The lines are the same as mf_wordwrap() gives, and the array can be used
+ * to render, compute the text height or scroll to any line without
+ * wrapping the text again. The width is measured the same way as
+ * mf_measure_line() does it without kerning, with tabs rounded to the tab
+ * stops.
+ *
+ * font:      Font to use for metrics.
+ * width:     Maximum line width in pixels.
+ * text:      Pointer to the start of the text to process.
+ * lines:     Array to store the lines into.
+ * max_lines: Number of entries in the lines array.
+ *
+ * Returns: Total number of lines in the text. Only the first max_lines of
+ *          them are stored, so the array can be sized by calling this
+ *          first with max_lines = 0.
+ */
+MF_EXTERN uint16_t mf_wordwrap_lines(const struct mf_font_s *font,
+                                     int16_t width, mf_str text,
+                                     struct mf_lineinfo_s *lines,
+                                     uint16_t max_lines);
+
+#if MF_USE_OPTIMAL_WORDWRAP
+/* Word wrap a piece of text so that the total raggedness of the lines is
+ * minimized, instead of balancing only two lines at a time. The breaks are
+ * chosen by dynamic programming over the words of each paragraph. Calls
+ * the callback function for each line.
+ *
+ * Paragraphs longer than fit in the scratch buffer are processed in parts,
+ * which makes the result slightly less optimal. Each word takes at most 24
+ * bytes, and a buffer for 64 words is enough for most texts. If the buffer
+ * is too small for 2 words, falls back to mf_wordwrap().
+ *
+ * font:    Font to use for metrics.
+ * width:   Maximum line width in pixels.
+ * text:    Pointer to the start of the text to process.
+ * scratch: Memory to use during the layout. Must be aligned for a pointer.
+ * size:    Size of the scratch memory in bytes.
+ * state:   Free variable for caller to use (can be NULL).
+ */
+MF_EXTERN void mf_wordwrap_optimal(const struct mf_font_s *font, int16_t width,
+                                   mf_str text, void *scratch, uint32_t size,
+                                   mf_line_callback_t callback, void *state);
+#endif
+
+#if MF_USE_ADVANCED_WORDWRAP && MF_USE_INCREMENTAL_WORDWRAP
+/* Position of one line in a text laid out by mf_wordwrap_layout().
+ * Offsets are counted in mf_str units, i.e. bytes for UTF-8.
+ */
+struct mf_wrapline_s
+{
+    uint16_t start; /* Offset of the first character of the line. */
+    uint16_t chars; /* Number of characters on the line. */
+    uint16_t greedy; /* Internal: end of the line before balancing. */
+    bool moved; /* Internal: a word was moved onto the line in balancing. */
+};
+
+/* Word wrapped layout of a text, which can be updated when the text is
+ * edited. The lines are the same as mf_wordwrap() gives.
+ */
+struct mf_wordwrap_layout_s
+{
+    const struct mf_font_s *font;
+    int16_t width;
+    struct mf_wrapline_s *lines; /* Storage for the lines. */
+    uint16_t max_lines; /* Size of the lines array. */
+    uint16_t count; /* Number of lines in the layout. */
+};
+
+/* Word wrap a piece of text and store the positions of the lines.
+ * Any text after max_lines lines is left out of the layout.
+ *
+ * layout:    Layout structure to initialize.
+ * font:      Font to use for metrics.
+ * width:     Maximum line width in pixels.
+ * lines:     Caller-allocated storage for the lines.
+ * max_lines: Number of entries in the lines array.
+ * text:      Pointer to the start of the text to process.
+ */
+MF_EXTERN void mf_wordwrap_layout(struct mf_wordwrap_layout_s *layout,
+                                  const struct mf_font_s *font, int16_t width,
+                                  struct mf_wrapline_s *lines,
+                                  uint16_t max_lines, mf_str text);
+
+/* Update the layout after an edit, where 'removed' units of text at
+ * 'position' have been replaced by 'inserted' new ones. The text is wrapped
+ * again from the line before the edit, until the line breaks line up with
+ * the old layout. Lines first to last - 1 have changed and need to be
+ * redrawn. If the number of lines changed, the range extends to the end.
+ *
+ * layout:   Layout of the text before the edit.
+ * text:     Pointer to the start of the edited text.
+ * position: Offset of the edit in the text.
+ * removed:  Length of the text removed at position.
+ * inserted: Length of the text inserted at position.
+ * first:    Returns the index of the first changed line.
+ * last:     Returns the index after the last changed line.
+ */
+MF_EXTERN void mf_wordwrap_update(struct mf_wordwrap_layout_s *layout,
+                                  mf_str text, uint16_t position,
+                                  uint16_t removed, uint16_t inserted,
+                                  uint16_t *first, uint16_t *last);
+
+/* Find the line that contains the given offset in the text.
+ * Returns the index of the line, or 0 if the layout is empty.
+ */
+MF_EXTERN uint16_t mf_wordwrap_find_line(
+    const struct mf_wordwrap_layout_s *layout, uint16_t position);
+#endif
               
 #endif
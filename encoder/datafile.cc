@@ -4,25 +4,37 @@
 #include <cctype>
 #include <stdexcept>
 
-#define DATAFILE_FORMAT_VERSION 1
+// Version 2 added the Kerning lines. Files without kerning pairs are still
+// saved as version 1, so that older tools can read them. Files with pairs
+// are refused by the older tools instead of silently losing the pairs.
+#define DATAFILE_FORMAT_VERSION 2
 
 namespace mcufont {
 
 DataFile::DataFile(const std::vector<dictentry_t> &dictionary,
                    const std::vector<glyphentry_t> &glyphs,
-                   const fontinfo_t &fontinfo):
-    m_dictionary(dictionary), m_glyphtable(glyphs), m_fontinfo(fontinfo)
+                   const fontinfo_t &fontinfo,
+                   const std::vector<kerningpair_t> &kerning):
+    m_dictionary(dictionary), m_glyphtable(glyphs), m_fontinfo(fontinfo),
+    m_kerning(kerning)
 {
     dictentry_t dummy = {};
     while (m_dictionary.size() < dictionarysize)
         m_dictionary.push_back(dummy);
     
+    auto comparison = [](const kerningpair_t &a, const kerningpair_t &b)
+    {
+        return a.first < b.first || (a.first == b.first && a.second < b.second);
+    };
+    std::sort(m_kerning.begin(), m_kerning.end(), comparison);
+    
     UpdateLowScoreIndex();
 }
 
 void DataFile::Save(std::ostream &file) const
 {
-    file << "Version " << DATAFILE_FORMAT_VERSION << std::endl;
+    file << "Version " << (m_kerning.empty() ? 1 : DATAFILE_FORMAT_VERSION);
+    file << std::endl;
     file << "FontName " << m_fontinfo.name << std::endl;
     file << "MaxWidth " << m_fontinfo.max_width << std::endl;
     file << "MaxHeight " << m_fontinfo.max_height << std::endl;
@@ -51,6 +63,12 @@ void DataFile::Save(std::ostream &file) const
         }
         file << " " << g.width << " " << g.data << std::endl;
     }
+    
+    for (const kerningpair_t &k : m_kerning)
+    {
+        file << "Kerning " << k.first << " " << k.second << " ";
+        file << k.adjust << std::endl;
+    }
 }
 
 std::unique_ptr<DataFile> DataFile::Load(std::istream &file)
@@ -58,6 +76,7 @@ std::unique_ptr<DataFile> DataFile::Load(std::istream &file)
     fontinfo_t fontinfo = {};
     std::vector<dictentry_t> dictionary;
     std::vector<glyphentry_t> glyphtable;
+    std::vector<kerningpair_t> kerning;
     uint32_t seed = 1234;
     int version = -1;
     
@@ -130,14 +149,20 @@ std::unique_ptr<DataFile> DataFile::Load(std::istream &file)
             
             glyphtable.push_back(g);
         }
+        else if (tag == "Kerning")
+        {
+            kerningpair_t k = {};
+            input >> k.first >> k.second >> k.adjust;
+            kerning.push_back(k);
+        }
     }
     
-    if (version != DATAFILE_FORMAT_VERSION)
+    if (version < 1 || version > DATAFILE_FORMAT_VERSION)
     {
         return std::unique_ptr<DataFile>(nullptr);
     }
     
-    std::unique_ptr<DataFile> result(new DataFile(dictionary, glyphtable, fontinfo));
+    std::unique_ptr<DataFile> result(new DataFile(dictionary, glyphtable, fontinfo, kerning));
     result->SetSeed(seed);
     return result;
 }
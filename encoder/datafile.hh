@@ -44,13 +44,22 @@ public:
         int flags;
     };
     
+    struct kerningpair_t
+    {
+        int first; // Character on the left side.
+        int second; // Character on the right side.
+        int adjust; // Adjustment to the advance of the first char, in pixels.
+    };
+    
     static const int FLAG_MONOSPACE = 0x01;
     static const int FLAG_BW = 0x02;
     
     // Construct from data in memory.
     DataFile(const std::vector<dictentry_t> &dictionary,
              const std::vector<glyphentry_t> &glyphs,
-             const fontinfo_t &fontinfo);
+             const fontinfo_t &fontinfo,
+             const std::vector<kerningpair_t> &kerning =
+                std::vector<kerningpair_t>());
     
     // Save to a file (custom format)
     void Save(std::ostream &file) const;
@@ -87,6 +96,11 @@ public:
     const fontinfo_t &GetFontInfo() const
         { return m_fontinfo; }
     
+    // Get the kerning pairs that were imported from the font file.
+    // The pairs are sorted by the first and then the second character.
+    const std::vector<kerningpair_t> &GetKerningPairs() const
+        { return m_kerning; }
+    
     // Show a glyph as text.
     std::string GlyphToText(size_t index) const;
     
@@ -100,6 +114,7 @@ private:
     std::vector<dictentry_t> m_dictionary;
     std::vector<glyphentry_t> m_glyphtable;
     fontinfo_t m_fontinfo;
+    std::vector<kerningpair_t> m_kerning;
     uint32_t m_seed;
     
     size_t m_lowscoreindex;
@@ -150,11 +165,31 @@ public:
         
         TS_ASSERT_EQUALS(f1->GetFontInfo().name, f2->GetFontInfo().name);
         TS_ASSERT(f1->GetGlyphEntry(0).data == f2->GetGlyphEntry(0).data);
+        TS_ASSERT_EQUALS(f2->GetKerningPairs().size(), 2);
+        TS_ASSERT_EQUALS(f2->GetKerningPairs().at(0).first, 1);
+        TS_ASSERT_EQUALS(f2->GetKerningPairs().at(0).second, 5);
+        TS_ASSERT_EQUALS(f2->GetKerningPairs().at(0).adjust, -1);
+        TS_ASSERT_EQUALS(text.substr(0, 10), "Version 2\n");
+    }
+    
+    void testFileVersion()
+    {
+        // Files without kerning pairs keep the old version number.
+        std::vector<DataFile::glyphentry_t> glyphs;
+        DataFile::fontinfo_t fi = {};
+        DataFile f1(std::vector<DataFile::dictentry_t>(), glyphs, fi);
+        std::ostringstream os;
+        f1.Save(os);
+        TS_ASSERT_EQUALS(os.str().substr(0, 10), "Version 1\n");
+        
+        // Versions newer than the tool are refused.
+        std::istringstream is("Version 3\nFontName Test\n");
+        TS_ASSERT(!DataFile::Load(is));
     }
     
 private:
     static constexpr const char *testfile =
-        "Version 1\n"
+        "Version 2\n"
         "FontName Sans Serif\n"
         "MaxWidth 4\n"
         "MaxHeight 6\n"
@@ -165,7 +200,9 @@ private:
         "DictEntry 1 0 F0F0F0\n"
         "Glyph 1,2,3 4 0F0F0F0F0F0F0F0F0F0F0F0F\n"
         "Glyph 4 4 0F0F0F0F0F0F0F0F0F0F0F0F\n"
-        "Glyph 5 4 0F0F0F0F0F0F0F0F0F0F0F0F\n";
+        "Glyph 5 4 0F0F0F0F0F0F0F0F0F0F0F0F\n"
+        "Kerning 4 1 -2\n"
+        "Kerning 1 5 -1\n";
 };
 
 #endif
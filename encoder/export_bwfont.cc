@@ -17,7 +17,7 @@ namespace bwfont {
 static void encode_glyph(const DataFile::glyphentry_t &glyph,
                          const DataFile::fontinfo_t &fontinfo,
                          std::vector<unsigned> &dest,
-                         int num_cols)
+                         int num_cols, bool row_major)
 {
     const int threshold = 8;
     
@@ -35,6 +35,30 @@ static void encode_glyph(const DataFile::glyphentry_t &glyph,
         }
     }
     
+    if (row_major)
+    {
+        // Write the bits row by row, padding each row to whole bytes
+        for (int y = 0; y < fontinfo.max_height; y++)
+        {
+            for (int x = 0; x < num_cols; x += 8)
+            {
+                size_t remain = std::min(8, num_cols - x);
+                uint8_t byte = 0;
+                for (size_t i = 0; i < remain; i++)
+                {
+                    size_t index = y * fontinfo.max_width + x + i;
+                    if (glyph.data.at(index) >= threshold)
+                    {
+                        byte |= (1 << i);
+                    }
+                }
+                dest.push_back(byte);
+            }
+        }
+        
+        return;
+    }
+    
     // Write the bits that compose the glyph
     for (int x = 0; x < num_cols; x++)
     {
@@ -69,6 +93,7 @@ static void encode_character_range(std::ostream &out,
                                    const DataFile &datafile,
                                    const char_range_t &range,
                                    unsigned range_index,
+                                   const export_options_t &options,
                                    cropinfo_t &cropinfo)
 {
     std::vector<DataFile::glyphentry_t> glyphs;
@@ -122,11 +147,16 @@ static void encode_character_range(std::ostream &out,
     std::vector<unsigned> widths;
     size_t stride = cropinfo.height_bytes;
     
+    // Row-major offsets are multiplied by the height instead, so that the
+    // difference gives the number of bytes per row.
+    if (options.row_major)
+        stride = cropinfo.height_pixels;
+    
     for (const DataFile::glyphentry_t &g : glyphs)
     {
         offsets.push_back(data.size() / stride);
         widths.push_back(g.width);
-        encode_glyph(g, new_fi, data, width);
+        encode_glyph(g, new_fi, data, width, options.row_major);
     }    
     offsets.push_back(data.size() / stride);
     
@@ -137,9 +167,49 @@ static void encode_character_range(std::ostream &out,
         write_const_table(out, offsets, "uint16_t", "mf_bwfont_" + name + "_glyph_offsets_" + std::to_string(range_index), 4);
         write_const_table(out, widths, "uint8_t", "mf_bwfont_" + name + "_glyph_widths_" + std::to_string(range_index));
     }
-}
     
-void write_source(std::ostream &out, std::string name, const DataFile &datafile)
+    // The edges are computed from the uncropped glyphs, so that they are
+    // relative to the font bounding box like in the renderer.
+    if (options.kerning_zones)
+    {
+        write_kerning_edges_table(out, datafile, range.glyph_indices,
+            options.kerning_zones, 8, "mf_bwfont_" + name + "_kerning_edges_" + std::to_string(range_index));
+    }
+}
+
+std::vector<char_range_t> compute_ranges(const DataFile &datafile,
+                                         const export_options_t &options)
+{
+    DataFile::fontinfo_t f = datafile.GetFontInfo();
+    size_t glyph_size = f.max_width * ((f.max_height + 7) / 8);
+    if (options.row_major)
+        glyph_size = f.max_height * ((f.max_width + 7) / 8);
+    auto get_glyph_size = [=](size_t i) { return glyph_size; };
+    char_range_cost_t cost;
+    cost.range_size = 28; // 2 x uint16_t + 6 x uint8_t + 3 pointers
+    if (f.flags & DataFile::FLAG_MONOSPACE)
+    {
+        // Constant width ranges have no tables, but need space in glyph data.
+        cost.offset_size = 0;
+        cost.missing_size = glyph_size;
+    }
+    else
+    {
+        cost.offset_size = 3; // uint16_t offset + uint8_t width
+        cost.missing_size = 0;
+    }
+    if (options.kerning_zones)
+    {
+        cost.range_size += 4; // Pointer to the kerning edges
+        cost.offset_size += 2 + options.kerning_zones;
+        cost.missing_size += 2 + options.kerning_zones;
+    }
+    cost.speed_weight = options.range_speed_weight;
+    return compute_char_ranges(datafile, get_glyph_size, 65536, cost);
+}
+
+void write_source(std::ostream &out, std::string name, const DataFile &datafile,
+                  const export_options_t &options)
 {
     name = filename_to_identifier(name);
     
@@ -159,19 +229,27 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "#endif" << std::endl;
     out << std::endl;
     
+    if (options.row_major)
+    {
+        out << "#ifndef MF_BWFONT_ROW_MAJOR_SUPPORTED" << std::endl;
+        out << "#error The font file needs row-major bwfont support." << std::endl;
+        out << "#endif" << std::endl;
+        out << std::endl;
+    }
+    
+    if (options.kerning_zones)
+        write_kerning_edges_macro(out, options.kerning_zones);
+    
     // Split the characters into ranges
-    DataFile::fontinfo_t f = datafile.GetFontInfo();
-    size_t glyph_size = f.max_width * ((f.max_height + 7) / 8);
-    auto get_glyph_size = [=](size_t i) { return glyph_size; };
-    std::vector<char_range_t> ranges = compute_char_ranges(datafile,
-        get_glyph_size, 65536, 16);
-
+    std::vector<char_range_t> ranges = compute_ranges(datafile, options);
+    
     // Write out glyph data for character ranges
     std::vector<cropinfo_t> crops;
     for (size_t i = 0; i < ranges.size(); i++)
     {
         cropinfo_t cropinfo;
-        encode_character_range(out, name, datafile, ranges.at(i), i, cropinfo);
+        encode_character_range(out, name, datafile, ranges.at(i), i,
+                               options, cropinfo);
         crops.push_back(cropinfo);
     }
     
@@ -181,6 +259,9 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     {
         std::string offsets = (crops[i].width) ? "0" : "mf_bwfont_" + name + "_glyph_offsets_" + std::to_string(i);
         std::string widths = (crops[i].width) ? "0" : "mf_bwfont_" + name + "_glyph_widths_" + std::to_string(i);
+        std::string edges = "0";
+        if (options.kerning_zones)
+            edges = "MF_KERNING_EDGES(mf_bwfont_" + name + "_kerning_edges_" + std::to_string(i) + ")";
         
         out << "    {" << std::endl;
         out << "        " << ranges.at(i).first_char << ", /* first char */" << std::endl;
@@ -193,11 +274,32 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
         out << "        " << widths << ", /* glyph widths */" << std::endl;
         out << "        " << offsets << ", /* glyph offsets */" << std::endl;
         out << "        " << "mf_bwfont_" << name << "_glyph_data_" << i << ", /* glyph data */" << std::endl;
+        out << "        " << (options.row_major ? 1 : 0) << ", /* row major */" << std::endl;
+        out << "        " << edges << ", /* kerning edges */" << std::endl;
         out << "    }," << std::endl;
     }
     out << "};" << std::endl;
     out << std::endl;
     
+    // Write out the kerning pairs from the font file
+    bool kerning_table = options.kerning_table &&
+        write_kerning_table(out, datafile, "mf_bwfont_" + name + "_kerning_table");
+    
+    // Write out the widths of the ASCII characters
+    if (options.ascii_metrics)
+    {
+        // Constant width ranges give the same width for missing glyphs.
+        auto get_width = [&](size_t range_index, size_t char_index)
+        {
+            int glyph_index = ranges.at(range_index).glyph_indices.at(char_index);
+            if (crops.at(range_index).width)
+                return (int)(crops.at(range_index).width + crops.at(range_index).offset_x);
+            return (glyph_index < 0) ? 0 : datafile.GetGlyphEntry(glyph_index).width;
+        };
+        write_font_metrics(out, compute_ascii_widths(datafile, ranges, get_width),
+                           "mf_bwfont_" + name + "_metrics");
+    }
+    
     // Fonts in this format are always black & white
     int flags = datafile.GetFontInfo().flags | DataFile::FLAG_BW;
     
@@ -217,6 +319,19 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "    " << select_fallback_char(datafile) << ", /* fallback character */" << std::endl;
     out << "    " << "&mf_bwfont_character_width," << std::endl;
     out << "    " << "&mf_bwfont_render_character," << std::endl;
+    out << "    " << "&mf_bwfont_render_glyph_ref," << std::endl;
+    if (options.kerning_zones)
+        out << "    " << "MF_KERNING_EDGES(&mf_bwfont_kerning_edges)," << std::endl;
+    else
+        out << "    " << "0, /* kerning edges */" << std::endl;
+    if (kerning_table)
+        out << "    " << "MF_KERNING_TABLE(&mf_bwfont_" << name << "_kerning_table)," << std::endl;
+    else
+        out << "    " << "0, /* kerning table */" << std::endl;
+    if (options.ascii_metrics)
+        out << "    " << "MF_FONT_METRICS(&mf_bwfont_" << name << "_metrics)," << std::endl;
+    else
+        out << "    " << "0, /* metrics */" << std::endl;
     out << "    }," << std::endl;
     
     out << "    " << BWFONT_FORMAT_VERSION << ", /* version */" << std::endl;
@@ -236,11 +351,29 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "#define MF_INCLUDED_FONTS (&mf_bwfont_" << name << "_listentry)" << std::endl;
     out << "#endif" << std::endl;
     
+    if (options.kerning_zones)
+    {
+        out << std::endl;
+        out << "#undef MF_KERNING_EDGES" << std::endl;
+    }
+    
+    if (kerning_table)
+    {
+        out << std::endl;
+        out << "#undef MF_KERNING_TABLE" << std::endl;
+    }
+    
+    if (options.ascii_metrics)
+    {
+        out << std::endl;
+        out << "#undef MF_FONT_METRICS" << std::endl;
+    }
+    
     out << std::endl;
     out << std::endl;
     out << "/* End of automatically generated font definition for " << name << ". */" << std::endl;
     out << std::endl;
 }
-    
-    
+
+
 }}
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "datafile.hh"
+#include "exporttools.hh"
 #include <iostream>
 
 namespace mcufont {
@@ -10,7 +11,12 @@ namespace bwfont {
 
 void write_header(std::ostream &out, std::string name, const DataFile &datafile);
 
-void write_source(std::ostream &out, std::string name, const DataFile &datafile);
+// Divide the characters into ranges the same way as write_source().
+std::vector<char_range_t> compute_ranges(const DataFile &datafile,
+                                         const export_options_t &options);
+
+void write_source(std::ostream &out, std::string name, const DataFile &datafile,
+                  const export_options_t &options = export_options_t());
 
 } }
 
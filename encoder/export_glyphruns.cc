@@ -0,0 +1,433 @@
+#include "export_glyphruns.hh"
+#include "exporttools.hh"
+#include <algorithm>
+#include <map>
+
+namespace mcufont {
+namespace glyphruns {
+
+bool parse_layout_option(const std::string &arg, layout_options_t &options)
+{
+    size_t pos = arg.find('=');
+    if (pos == std::string::npos)
+        return false;
+
+    std::string name = arg.substr(0, pos);
+    std::string value = arg.substr(pos + 1);
+
+    if (name == "kerning")
+    {
+        if (value == "auto")
+            options.kerning = KERNING_AUTO;
+        else if (value == "table")
+            options.kerning = KERNING_TABLE;
+        else if (value == "none")
+            options.kerning = KERNING_NONE;
+        else
+            return false;
+
+        return true;
+    }
+
+    int *target;
+    int min_value = 0, max_value = 255;
+    if (name == "tab_size")
+    {
+        target = &options.tab_size;
+        min_value = 1;
+    }
+    else if (name == "kerning_zones")
+    {
+        target = &options.kerning_zones;
+        min_value = 1;
+    }
+    else if (name == "kerning_space_percent")
+    {
+        target = &options.kerning_space_percent;
+    }
+    else if (name == "kerning_space_pixels")
+    {
+        target = &options.kerning_space_pixels;
+    }
+    else if (name == "kerning_limit")
+    {
+        target = &options.kerning_limit;
+        max_value = 100;
+    }
+    else
+    {
+        return false;
+    }
+
+    *target = std::stoi(value);
+    return *target >= min_value && *target <= max_value;
+}
+
+// Decode a line of UTF-8 text the same way as mf_getchar().
+static std::vector<int> decode_utf8(const std::string &text)
+{
+    std::vector<int> result;
+    size_t i = 0;
+
+    while (i < text.size())
+    {
+        uint8_t c = text[i++];
+
+        if ((c & 0x80) == 0 || (c & 0xC0) == 0x80 ||
+            i >= text.size() || (text[i] & 0xC0) == 0xC0)
+        {
+            // ASCII character or corrupted multibyte sequence.
+            result.push_back(c);
+            continue;
+        }
+
+        int seqlen = 2;
+        uint8_t tmp = 0x20;
+        int value = 0;
+        while ((c & tmp) && seqlen < 5 && i < text.size())
+        {
+            seqlen++;
+            tmp >>= 1;
+            value = (value << 6) | (text[i++] & 0x3F);
+        }
+
+        if (i < text.size())
+            value = (value << 6) | (text[i++] & 0x3F);
+
+        value |= (c & (tmp - 1)) << ((seqlen - 1) * 6);
+        result.push_back(value & 0xFFFF);
+    }
+
+    return result;
+}
+
+bool read_string_table(std::istream &in, std::vector<string_entry_t> &strings)
+{
+    std::string line;
+    strings.clear();
+
+    while (std::getline(in, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+
+        if (line.empty() || line.at(0) == '#')
+            continue;
+
+        size_t pos = line.find('=');
+        if (pos == std::string::npos || pos == 0)
+            return false;
+
+        string_entry_t entry;
+        entry.name = line.substr(0, pos);
+        entry.chars = decode_utf8(line.substr(pos + 1));
+        strings.push_back(entry);
+    }
+
+    return true;
+}
+
+// Access to the glyphs of the font by character, following the fallback
+// rules of the decoder.
+class glyph_lookup_t
+{
+public:
+    glyph_lookup_t(const DataFile &datafile, const layout_options_t &options):
+        m_datafile(datafile), m_options(options),
+        m_char_to_glyph(datafile.GetCharToGlyphMap())
+    {
+        m_fallback = select_fallback_char(datafile);
+
+        for (const DataFile::kerningpair_t &k : datafile.GetKerningPairs())
+        {
+            if (k.adjust >= -128 && k.adjust <= 127)
+                m_pairs[std::make_pair(k.first, k.second)] = k.adjust;
+        }
+    }
+
+    // Character whose glyph the decoder renders for the character.
+    int resolve(int c) const
+    {
+        return (find(c) < 0) ? m_fallback : c;
+    }
+
+    // Width of a character, as returned by mf_character_width().
+    int width(int c) const
+    {
+        int glyph = find(resolve(c));
+        return (glyph < 0) ? 0 : m_datafile.GetGlyphEntry(glyph).width;
+    }
+
+    // Kerning adjustment between two characters, as returned by
+    // mf_compute_kerning().
+    int kerning(int c1, int c2) const
+    {
+        if (m_options.kerning == KERNING_NONE ||
+            (m_datafile.GetFontInfo().flags & DataFile::FLAG_MONOSPACE))
+            return 0;
+
+        if (m_options.kerning == KERNING_TABLE)
+        {
+            auto iter = m_pairs.find(std::make_pair(c1, c2));
+            return (iter == m_pairs.end()) ? 0 : iter->second;
+        }
+
+        if (!do_kerning(c1) || !do_kerning(c2))
+            return 0;
+
+        int zones = m_options.kerning_zones;
+        int w1 = width(c1);
+        int w2 = width(c2);
+        std::vector<unsigned> e1, e2;
+        edges(c1, c2, e1, e2);
+
+        // Find the minimum horizontal space between the glyphs, with the
+        // same 8-bit arithmetic as the decoder.
+        uint8_t min_space = 255;
+        for (int i = 0; i < zones; i++)
+        {
+            unsigned left = e2.at(i);
+            unsigned right = e1.at(zones + i);
+            if (left == 255 || right == 0)
+                continue;
+
+            uint8_t space = w1 - right + left;
+            min_space = std::min(min_space, space);
+        }
+
+        if (min_space == 255)
+            return 0;
+
+        int normal_space = (w1 + w2) / 2 * m_options.kerning_space_percent / 100;
+        normal_space += m_options.kerning_space_pixels;
+        int adjust = normal_space - min_space;
+        int max_adjust = -std::max(w1, w2) * m_options.kerning_limit / 100;
+
+        if (adjust > 0) adjust = 0;
+        if (adjust < max_adjust) adjust = max_adjust;
+
+        return adjust;
+    }
+
+private:
+    const DataFile &m_datafile;
+    layout_options_t m_options;
+    std::map<size_t, size_t> m_char_to_glyph;
+    std::map<std::pair<int, int>, int> m_pairs;
+    int m_fallback;
+
+    int find(int c) const
+    {
+        auto iter = m_char_to_glyph.find(c);
+        if (iter == m_char_to_glyph.end())
+            return -1;
+        if (m_datafile.GetGlyphEntry(iter->second).width == 0)
+            return -1;
+        return iter->second;
+    }
+
+    // Edges of the two glyphs as the decoder sees them. The edges exported
+    // with the font are used only if both characters are in the font.
+    void edges(int c1, int c2, std::vector<unsigned> &e1,
+               std::vector<unsigned> &e2) const
+    {
+        int zones = m_options.kerning_zones;
+        e1 = compute_kerning_edges(m_datafile, find(resolve(c1)), zones, 1);
+        e2 = compute_kerning_edges(m_datafile, find(resolve(c2)), zones, 1);
+
+        if (m_options.font_kerning_zones == zones &&
+            find(c1) >= 0 && find(c2) >= 0)
+        {
+            e1 = unpack_edges(pack_kerning_edges(e1));
+            e2 = unpack_edges(pack_kerning_edges(e2));
+        }
+    }
+
+    // Inverse of pack_kerning_edges(), like unpack_edges() in mf_kerning.c.
+    static std::vector<unsigned> unpack_edges(const std::vector<unsigned> &packed)
+    {
+        size_t zones = packed.size() - 2;
+        std::vector<unsigned> result(2 * zones);
+
+        for (size_t i = 0; i < zones; i++)
+        {
+            unsigned left = packed.at(2 + i) >> 4;
+            unsigned right = packed.at(2 + i) & 0x0F;
+            result.at(i) = (left == 15) ? 255 : packed.at(0) + left;
+            result.at(zones + i) = (right == 15) ? 0 : packed.at(1) - right;
+        }
+
+        return result;
+    }
+
+    static bool do_kerning(int c)
+    {
+        if (c == ' ' || c == '\n' || c == '\r' || c == '\t')
+            return false;
+
+        return !(c >= '0' && c <= '9');
+    }
+};
+
+glyph_run_t layout_string(const DataFile &datafile,
+                          const std::vector<int> &chars,
+                          const layout_options_t &options)
+{
+    glyph_lookup_t lookup(datafile, options);
+    glyph_run_t run;
+
+    // Leave out the trailing whitespace, like mf_measure_line().
+    size_t count = chars.size();
+    while (count > 0 && (chars[count - 1] == ' ' || chars[count - 1] == 0xA0 ||
+           chars[count - 1] == '\n' || chars[count - 1] == '\r' ||
+           chars[count - 1] == '\t'))
+    {
+        count--;
+    }
+
+    int x = 0;
+    int c1 = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        int c2 = chars[i];
+
+        if (c2 == '\t')
+        {
+            int tabw = lookup.width('m') * options.tab_size;
+            x += lookup.width(' ');
+            x += tabw - (x % tabw);
+            c1 = ' ';
+            continue;
+        }
+
+        if (c1 != 0)
+            x += lookup.kerning(c1, c2);
+
+        run.chars.push_back(c2);
+        run.glyph_chars.push_back(lookup.resolve(c2));
+        run.positions.push_back(x);
+        x += lookup.width(c2);
+        c1 = c2;
+    }
+
+    run.width = x;
+    return run;
+}
+
+// Find the glyph references of the run in the character ranges of the
+// font. Returns false if some of the characters are not in the ranges.
+static bool find_glyph_refs(const glyph_run_t &run,
+                            const std::vector<char_range_t> &ranges,
+                            std::vector<std::pair<int, int>> &refs)
+{
+    refs.clear();
+
+    for (int c : run.glyph_chars)
+    {
+        size_t i = 0;
+        while (i < ranges.size() && (c < ranges[i].first_char ||
+               c >= ranges[i].first_char + ranges[i].char_count))
+        {
+            i++;
+        }
+
+        if (i == ranges.size() || i > 255)
+            return false;
+
+        refs.push_back(std::make_pair(i, c - ranges[i].first_char));
+    }
+
+    return true;
+}
+
+void write_source(std::ostream &out, std::string name, const DataFile &datafile,
+                  const std::vector<string_entry_t> &strings,
+                  const layout_options_t &options,
+                  const std::vector<char_range_t> &ranges)
+{
+    name = filename_to_identifier(name);
+
+    out << std::endl;
+    out << std::endl;
+    out << "/* Start of automatically generated glyph runs for " << name << ". */" << std::endl;
+    out << std::endl;
+    out << "#include \"mf_justify.h\"" << std::endl;
+    out << std::endl;
+
+    std::vector<std::string> runs;
+    for (const string_entry_t &s : strings)
+    {
+        std::string prefix = "mf_glyphrun_" + name + "_" + filename_to_identifier(s.name);
+        glyph_run_t run = layout_string(datafile, s.chars, options);
+        runs.push_back(prefix);
+
+        std::vector<std::pair<int, int>> refs;
+        bool have_refs = !ranges.empty() && !run.chars.empty() &&
+                         find_glyph_refs(run, ranges, refs);
+
+        std::vector<unsigned> chars(run.chars.begin(), run.chars.end());
+        if (!chars.empty())
+        {
+            write_const_table(out, chars, "uint16_t", prefix + "_chars", 4);
+
+            // The positions can be negative, so they are written in decimal.
+            out << "static const int16_t " << prefix << "_positions";
+            out << "[" << run.positions.size() << "] = {" << std::endl;
+            for (size_t i = 0; i < run.positions.size(); i++)
+            {
+                if (i % 16 == 0)
+                    out << (i ? "\n    " : "    ");
+                out << run.positions[i] << ", ";
+            }
+            out << std::endl << "};" << std::endl;
+            out << std::endl;
+        }
+
+        if (have_refs)
+        {
+            out << "static const struct mf_glyph_ref_s " << prefix << "_glyphs";
+            out << "[" << refs.size() << "] = {" << std::endl;
+            for (size_t i = 0; i < refs.size(); i++)
+            {
+                if (i % 8 == 0)
+                    out << (i ? "\n    " : "    ");
+                out << "{" << refs[i].first << ", " << refs[i].second << "}, ";
+            }
+            out << std::endl << "};" << std::endl;
+            out << std::endl;
+        }
+
+        out << "const struct mf_glyph_run_s " << prefix << " = {" << std::endl;
+        out << "    " << run.chars.size() << ", /* glyph count */" << std::endl;
+        out << "    " << run.width << ", /* width */" << std::endl;
+        if (chars.empty())
+        {
+            out << "    0, /* characters */" << std::endl;
+            out << "    0, /* positions */" << std::endl;
+        }
+        else
+        {
+            out << "    " << prefix << "_chars," << std::endl;
+            out << "    " << prefix << "_positions," << std::endl;
+        }
+        if (have_refs)
+            out << "    " << prefix << "_glyphs," << std::endl;
+        else
+            out << "    0, /* glyphs */" << std::endl;
+        out << "};" << std::endl;
+        out << std::endl;
+    }
+
+    // Null terminated list of the runs, in the order of the string table.
+    out << "const struct mf_glyph_run_s *const mf_glyphruns_" << name << "[] = {" << std::endl;
+    for (const std::string &run : runs)
+        out << "    &" << run << "," << std::endl;
+    out << "    0" << std::endl;
+    out << "};" << std::endl;
+
+    out << std::endl;
+    out << "/* End of automatically generated glyph runs for " << name << ". */" << std::endl;
+    out << std::endl;
+}
+
+} }
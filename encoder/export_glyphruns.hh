@@ -0,0 +1,211 @@
+// Write out strings as glyph runs that have been laid out in advance, so
+// that static texts can be drawn with mf_render_glyph_run() without
+// decoding or measuring them at runtime.
+
+#pragma once
+
+#include "datafile.hh"
+#include "exporttools.hh"
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace mcufont {
+namespace glyphruns {
+
+// How the space between the glyphs is adjusted.
+enum kerning_mode_t
+{
+    KERNING_NONE,  // Plain advance widths.
+    KERNING_AUTO,  // Same as the automatic kerning in mf_kerning.c.
+    KERNING_TABLE  // Kerning pairs imported from the font file.
+};
+
+// Decoder configuration that the layout is computed for. The defaults
+// match mf_config.h.
+struct layout_options_t
+{
+    kerning_mode_t kerning;
+    int tab_size; // MF_TABSIZE
+    int kerning_zones; // MF_KERNING_ZONES
+    int kerning_space_percent; // MF_KERNING_SPACE_PERCENT
+    int kerning_space_pixels; // MF_KERNING_SPACE_PIXELS
+    int kerning_limit; // MF_KERNING_LIMIT
+
+    // Number of zones in the kerning edges exported with the font, or 0 if
+    // the font has none. The decoder uses the packed edges, which can give
+    // less kerning than the exact ones.
+    int font_kerning_zones;
+
+    layout_options_t(): kerning(KERNING_AUTO), tab_size(8), kerning_zones(16),
+        kerning_space_percent(15), kerning_space_pixels(3), kerning_limit(20),
+        font_kerning_zones(0) {}
+};
+
+// Parse one name=value option of the layout: kerning=auto|table|none,
+// tab_size, kerning_zones, kerning_space_percent, kerning_space_pixels or
+// kerning_limit. Returns false if the option is not known or the value is
+// out of range.
+bool parse_layout_option(const std::string &arg, layout_options_t &options);
+
+// One named string from the string table.
+struct string_entry_t
+{
+    std::string name;
+    std::vector<int> chars;
+};
+
+// One string after layout.
+struct glyph_run_t
+{
+    std::vector<int> chars; // Character of each glyph.
+    std::vector<int> glyph_chars; // Character that is drawn, after fallback.
+    std::vector<int> positions; // X coordinate of each glyph.
+    int width; // Width of the whole run.
+
+    glyph_run_t(): width(0) {}
+};
+
+// Read a string table with one name=text entry per line. The text is in
+// UTF-8. Empty lines and lines starting with # are ignored. Returns false
+// if a line is not in the correct format.
+bool read_string_table(std::istream &in, std::vector<string_entry_t> &strings);
+
+// Lay out a string the same way as mf_render_aligned() renders it with
+// the given decoder configuration. Trailing whitespace is left out and
+// tabs only move the position of the next glyph.
+glyph_run_t layout_string(const DataFile &datafile,
+                          const std::vector<int> &chars,
+                          const layout_options_t &options);
+
+// Write out the glyph runs of all the strings as mf_glyph_run_s structures,
+// followed by a null terminated array of all the runs. If the character
+// ranges of the exported font are given, the runs also get glyph references
+// for mf_render_glyph_run_pixels().
+void write_source(std::ostream &out, std::string name, const DataFile &datafile,
+                  const std::vector<string_entry_t> &strings,
+                  const layout_options_t &options,
+                  const std::vector<char_range_t> &ranges = std::vector<char_range_t>());
+
+} }
+
+
+#ifdef CXXTEST_RUNNING
+#include <cxxtest/TestSuite.h>
+#include <sstream>
+
+using namespace mcufont;
+using namespace mcufont::glyphruns;
+
+class GlyphRunsTests: public CxxTest::TestSuite
+{
+public:
+    void testStringTable()
+    {
+        std::istringstream in("# Comment\n\ntitle=Ab\xc3\xa4\nempty=\n");
+        std::vector<string_entry_t> strings;
+        TS_ASSERT(read_string_table(in, strings));
+        TS_ASSERT_EQUALS(strings.size(), 2);
+        TS_ASSERT_EQUALS(strings.at(0).name, "title");
+        TS_ASSERT_EQUALS(strings.at(0).chars.size(), 3);
+        TS_ASSERT_EQUALS(strings.at(0).chars.at(2), 0xE4);
+        TS_ASSERT_EQUALS(strings.at(1).chars.size(), 0);
+
+        std::istringstream bad("no equals sign\n");
+        TS_ASSERT(!read_string_table(bad, strings));
+    }
+
+    void testLayoutOptions()
+    {
+        layout_options_t options;
+        TS_ASSERT(parse_layout_option("kerning=table", options));
+        TS_ASSERT_EQUALS(options.kerning, KERNING_TABLE);
+        TS_ASSERT(parse_layout_option("tab_size=4", options));
+        TS_ASSERT_EQUALS(options.tab_size, 4);
+        TS_ASSERT(parse_layout_option("kerning_space_percent=20", options));
+        TS_ASSERT_EQUALS(options.kerning_space_percent, 20);
+        TS_ASSERT(!parse_layout_option("tab_size=0", options));
+        TS_ASSERT(!parse_layout_option("kerning_zones=0", options));
+        TS_ASSERT(!parse_layout_option("unknown=1", options));
+    }
+
+    void testLayout()
+    {
+        // 'A' has width 3, 'V' width 4, '?' is the fallback with width 5.
+        std::vector<DataFile::glyphentry_t> glyphs(3);
+        const char chars[] = {'A', 'V', '?'};
+        const int widths[] = {3, 4, 5};
+        for (int i = 0; i < 3; i++)
+        {
+            glyphs[i].data.resize(4);
+            glyphs[i].chars.push_back(chars[i]);
+            glyphs[i].width = widths[i];
+        }
+
+        DataFile::fontinfo_t fi = {};
+        fi.max_width = fi.max_height = 2;
+        std::vector<DataFile::kerningpair_t> pairs = {{'A', 'V', -1}};
+        DataFile f(std::vector<DataFile::dictentry_t>(), glyphs, fi, pairs);
+
+        // The missing character uses the fallback width, trailing space
+        // is left out.
+        layout_options_t options;
+        options.kerning = KERNING_NONE;
+        std::vector<int> text = {'A', 'x', 'V', ' '};
+        glyph_run_t run = layout_string(f, text, options);
+        TS_ASSERT_EQUALS(run.chars.size(), 3);
+        TS_ASSERT_EQUALS(run.glyph_chars.at(1), '?');
+        TS_ASSERT_EQUALS(run.positions.at(1), 3);
+        TS_ASSERT_EQUALS(run.positions.at(2), 8);
+        TS_ASSERT_EQUALS(run.width, 12);
+
+        // Kerning pairs move the glyphs closer.
+        options.kerning = KERNING_TABLE;
+        text = {'A', 'V', 'A'};
+        run = layout_string(f, text, options);
+        TS_ASSERT_EQUALS(run.positions.at(1), 2);
+        TS_ASSERT_EQUALS(run.positions.at(2), 6);
+        TS_ASSERT_EQUALS(run.width, 9);
+
+        // Tab stops are tab_size times the width of 'm', which is missing
+        // and has the fallback width.
+        options.tab_size = 2;
+        text = {'A', '\t', 'V'};
+        run = layout_string(f, text, options);
+        TS_ASSERT_EQUALS(run.positions.at(1), 10);
+    }
+
+    void testGlyphRefs()
+    {
+        std::vector<DataFile::glyphentry_t> glyphs(2);
+        glyphs[0].chars = {'A', 'B'};
+        glyphs[1].chars = {'?'};
+        for (DataFile::glyphentry_t &g : glyphs)
+        {
+            g.data.resize(4);
+            g.width = 2;
+        }
+
+        DataFile::fontinfo_t fi = {};
+        fi.max_width = fi.max_height = 2;
+        DataFile f(std::vector<DataFile::dictentry_t>(), glyphs, fi);
+
+        char_range_t r1, r2;
+        r1.first_char = 'A';
+        r1.char_count = 2;
+        r2.first_char = '?';
+        r2.char_count = 1;
+        std::vector<char_range_t> ranges = {r1, r2};
+
+        std::vector<string_entry_t> strings(1);
+        strings[0].name = "s";
+        strings[0].chars = {'B', 'x'};
+
+        std::ostringstream out;
+        write_source(out, "font", f, strings, layout_options_t(), ranges);
+        TS_ASSERT_DIFFERS(out.str().find("{0, 1}, {1, 0},"), std::string::npos);
+        TS_ASSERT_DIFFERS(out.str().find("&mf_glyphrun_font_s,"), std::string::npos);
+    }
+};
+
+#endif
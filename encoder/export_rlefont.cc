@@ -7,6 +7,7 @@
 #include <string>
 #include <cctype>
 #include "exporttools.hh"
+#include "importtools.hh"
 
 #define RLEFONT_FORMAT_VERSION 4
 
@@ -46,7 +47,8 @@ static void encode_character_range(std::ostream &out,
                               const DataFile &datafile,
                               const encoded_font_t& encoded,
                               const char_range_t& range,
-                              unsigned range_index)
+                              unsigned range_index,
+                              int kerning_zones)
 {
     std::vector<unsigned> offsets;
     std::vector<unsigned> data;
@@ -79,12 +81,72 @@ static void encode_character_range(std::ostream &out,
     
     write_const_table(out, data, "uint8_t", "mf_rlefont_" + name + "_glyph_data_" + std::to_string(range_index));
     write_const_table(out, offsets, "uint16_t", "mf_rlefont_" + name + "_glyph_offsets_" + std::to_string(range_index), 4);
+    
+    // Any pixel that is not fully transparent counts for kerning.
+    if (kerning_zones)
+    {
+        write_kerning_edges_table(out, datafile, range.glyph_indices,
+            kerning_zones, 1, "mf_rlefont_" + name + "_kerning_edges_" + std::to_string(range_index));
+    }
+}
+
+// Encode the glyphs in the order given by the layout option.
+static std::unique_ptr<encoded_font_t> encode(const DataFile &datafile,
+                                              const export_options_t &options)
+{
+    // For column order, encode a transposed copy of the glyphs. The
+    // dictionary should have been optimized with rlefont_optimize
+    // layout=columns, otherwise the result is noticeably larger.
+    std::unique_ptr<encoded_font_t> encoded;
+    if (options.column_major)
+    {
+        std::vector<DataFile::glyphentry_t> glyphs = datafile.GetGlyphTable();
+        DataFile::fontinfo_t fontinfo = datafile.GetFontInfo();
+        transpose_glyphs(glyphs, fontinfo);
+        DataFile transposed(datafile.GetDictionary(), glyphs, fontinfo);
+        encoded = encode_font(transposed, false);
+    }
+    else
+    {
+        encoded = encode_font(datafile, false);
+    }
+    
+    return encoded;
 }
 
-void write_source(std::ostream &out, std::string name, const DataFile &datafile)
+// Divide the characters into ranges according to the encoded glyph sizes.
+static std::vector<char_range_t> split_ranges(const DataFile &datafile,
+                                              const encoded_font_t &encoded,
+                                              const export_options_t &options)
+{
+    auto get_glyph_size = [&encoded](size_t i)
+    {
+        return encoded.glyphs[i].size();
+    };
+    char_range_cost_t cost;
+    cost.range_size = 12; // 2 x uint16_t + 2 pointers
+    cost.offset_size = 2; // uint16_t glyph offset
+    cost.missing_size = 0; // Missing glyphs share one dummy entry
+    if (options.kerning_zones)
+    {
+        cost.range_size += 4; // Pointer to the kerning edges
+        cost.offset_size += 2 + options.kerning_zones;
+    }
+    cost.speed_weight = options.range_speed_weight;
+    return compute_char_ranges(datafile, get_glyph_size, 65536, cost);
+}
+
+std::vector<char_range_t> compute_ranges(const DataFile &datafile,
+                                         const export_options_t &options)
+{
+    return split_ranges(datafile, *encode(datafile, options), options);
+}
+
+void write_source(std::ostream &out, std::string name, const DataFile &datafile,
+                  const export_options_t &options)
 {
     name = filename_to_identifier(name);
-    std::unique_ptr<encoded_font_t> encoded = encode_font(datafile, false);
+    std::unique_ptr<encoded_font_t> encoded = encode(datafile, options);
     
     out << std::endl;
     out << std::endl;
@@ -102,35 +164,63 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "#endif" << std::endl;
     out << std::endl;
     
+    if (options.column_major)
+    {
+        out << "#ifndef MF_RLEFONT_COLUMN_MAJOR_SUPPORTED" << std::endl;
+        out << "#error The font file needs column-major rlefont support." << std::endl;
+        out << "#endif" << std::endl;
+        out << std::endl;
+    }
+    
+    if (options.kerning_zones)
+        write_kerning_edges_macro(out, options.kerning_zones);
+    
     // Write out the dictionary entries
     encode_dictionary(out, name, datafile, *encoded);
     
     // Split the characters into ranges
-    auto get_glyph_size = [&encoded](size_t i)
-    {
-        return encoded->glyphs[i].size();
-    };
-    std::vector<char_range_t> ranges = compute_char_ranges(datafile,
-        get_glyph_size, 65536, 16);
-
+    std::vector<char_range_t> ranges = split_ranges(datafile, *encoded, options);
+    
     // Write out glyph data for character ranges
     for (size_t i = 0; i < ranges.size(); i++)
     {
-        encode_character_range(out, name, datafile, *encoded, ranges.at(i), i);
+        encode_character_range(out, name, datafile, *encoded, ranges.at(i), i,
+                               options.kerning_zones);
     }
     
     // Write out a table describing the character ranges
     out << "static const struct mf_rlefont_char_range_s mf_rlefont_" << name << "_char_ranges[] = {" << std::endl;
     for (size_t i = 0; i < ranges.size(); i++)
     {
+        std::string edges = "0";
+        if (options.kerning_zones)
+            edges = "MF_KERNING_EDGES(mf_rlefont_" + name + "_kerning_edges_" + std::to_string(i) + ")";
+        
         out << "    {" << ranges.at(i).first_char
             << ", " << ranges.at(i).char_count
             << ", mf_rlefont_" << name << "_glyph_offsets_" << i
-            << ", mf_rlefont_" << name << "_glyph_data_" << i << "}," << std::endl; 
+            << ", mf_rlefont_" << name << "_glyph_data_" << i
+            << ", " << edges << "}," << std::endl; 
     }
     out << "};" << std::endl;
     out << std::endl;
     
+    // Write out the kerning pairs from the font file
+    bool kerning_table = options.kerning_table &&
+        write_kerning_table(out, datafile, "mf_rlefont_" + name + "_kerning_table");
+    
+    // Write out the widths of the ASCII characters
+    if (options.ascii_metrics)
+    {
+        auto get_width = [&](size_t range_index, size_t char_index)
+        {
+            int glyph_index = ranges.at(range_index).glyph_indices.at(char_index);
+            return (glyph_index < 0) ? 0 : datafile.GetGlyphEntry(glyph_index).width;
+        };
+        write_font_metrics(out, compute_ascii_widths(datafile, ranges, get_width),
+                           "mf_rlefont_" + name + "_metrics");
+    }
+    
     // Pull it all together in the rlefont_s structure.
     out << "const struct mf_rlefont_s mf_rlefont_" << name << " = {" << std::endl;
     out << "    {" << std::endl;
@@ -147,6 +237,19 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "    " << select_fallback_char(datafile) << ", /* fallback character */" << std::endl;
     out << "    " << "&mf_rlefont_character_width," << std::endl;
     out << "    " << "&mf_rlefont_render_character," << std::endl;
+    out << "    " << "&mf_rlefont_render_glyph_ref," << std::endl;
+    if (options.kerning_zones)
+        out << "    " << "MF_KERNING_EDGES(&mf_rlefont_kerning_edges)," << std::endl;
+    else
+        out << "    " << "0, /* kerning edges */" << std::endl;
+    if (kerning_table)
+        out << "    " << "MF_KERNING_TABLE(&mf_rlefont_" << name << "_kerning_table)," << std::endl;
+    else
+        out << "    " << "0, /* kerning table */" << std::endl;
+    if (options.ascii_metrics)
+        out << "    " << "MF_FONT_METRICS(&mf_rlefont_" << name << "_metrics)," << std::endl;
+    else
+        out << "    " << "0, /* metrics */" << std::endl;
     out << "    }," << std::endl;
     
     out << "    " << RLEFONT_FORMAT_VERSION << ", /* version */" << std::endl;
@@ -156,6 +259,7 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "    " << encoded->ref_dictionary.size() + encoded->rle_dictionary.size() << ", /* total dict count */" << std::endl;
     out << "    " << ranges.size() << ", /* char range count */" << std::endl;
     out << "    " << "mf_rlefont_" << name << "_char_ranges," << std::endl;
+    out << "    " << (options.column_major ? 1 : 0) << ", /* column major */" << std::endl;
     out << "};" << std::endl;
     
     // Write the font lookup structure
@@ -170,6 +274,24 @@ void write_source(std::ostream &out, std::string name, const DataFile &datafile)
     out << "#define MF_INCLUDED_FONTS (&mf_rlefont_" << name << "_listentry)" << std::endl;
     out << "#endif" << std::endl;
     
+    if (options.kerning_zones)
+    {
+        out << std::endl;
+        out << "#undef MF_KERNING_EDGES" << std::endl;
+    }
+    
+    if (kerning_table)
+    {
+        out << std::endl;
+        out << "#undef MF_KERNING_TABLE" << std::endl;
+    }
+    
+    if (options.ascii_metrics)
+    {
+        out << std::endl;
+        out << "#undef MF_FONT_METRICS" << std::endl;
+    }
+    
     out << std::endl;
     out << std::endl;
     out << "/* End of automatically generated font definition for " << name << ". */" << std::endl;
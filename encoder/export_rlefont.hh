@@ -4,12 +4,18 @@
 
 #include "datafile.hh"
 #include "encode_rlefont.hh"
+#include "exporttools.hh"
 #include <iostream>
 
 namespace mcufont {
 namespace rlefont {
 
-void write_source(std::ostream &out, std::string name, const DataFile &datafile);
+// Divide the characters into ranges the same way as write_source().
+std::vector<char_range_t> compute_ranges(const DataFile &datafile,
+                                         const export_options_t &options);
+
+void write_source(std::ostream &out, std::string name, const DataFile &datafile,
+                  const export_options_t &options = export_options_t());
 
 } }
 
@@ -1,6 +1,9 @@
 #include "exporttools.hh"
 #include <iomanip>
 #include <set>
+#include <limits>
+#include <algorithm>
+#include <cmath>
 
 namespace mcufont {
     
@@ -113,13 +116,15 @@ int select_fallback_char(const DataFile &datafile)
 }
 
 // Decide how to best divide the characters in the font into ranges.
-// Limitations are:
-//  - Gaps longer than minimum_gap should result in separate ranges.
-//  - Each range can have encoded data size of at most maximum_size.
+// This is done by dynamic programming over the sorted character codes:
+// best[i] is the lowest cost of encoding the first i characters. A range
+// never needs to begin in the middle of a block of consecutive characters,
+// unless the size limit forces it, which keeps the search fast even for
+// large fonts.
 std::vector<char_range_t> compute_char_ranges(const DataFile &datafile,
     std::function<size_t(size_t)> get_encoded_glyph_size,
     size_t maximum_size,
-    size_t minimum_gap)
+    const char_range_cost_t &cost)
 {
     std::vector<char_range_t> result;
     std::map<size_t, size_t> char_to_glyph = datafile.GetCharToGlyphMap();
@@ -129,51 +134,412 @@ std::vector<char_range_t> compute_char_ranges(const DataFile &datafile,
     for (auto iter : char_to_glyph)
         chars.push_back(iter.first);
     
-    // Pick out ranges until we have processed all characters
-    size_t i = 0;
-    while (i < chars.size())
+    // Cumulative data sizes and the starts of the consecutive blocks.
+    size_t n = chars.size();
+    std::vector<size_t> data_sizes(n + 1, 0);
+    std::vector<size_t> block_starts;
+    for (size_t i = 0; i < n; i++)
     {
-        char_range_t range;
-        range.first_char = chars.at(i);
+        data_sizes[i + 1] = data_sizes[i] +
+            get_encoded_glyph_size(char_to_glyph[chars[i]]);
         
-        // Find the point where there is a gap larger than minimum_gap.
-        i++;
-        while (i < chars.size() && chars.at(i) - chars.at(i - 1) < minimum_gap)
-            i++;
+        if (i == 0 || chars[i] != chars[i - 1] + 1)
+            block_starts.push_back(i);
+    }
+    
+    const size_t infinity = std::numeric_limits<size_t>::max();
+    std::vector<size_t> best(n + 1, infinity);
+    std::vector<size_t> range_start(n + 1, 0);
+    best[0] = 0;
+    
+    // Cost of the range containing characters j to i-1.
+    auto range_cost = [&](size_t j, size_t i)
+    {
+        size_t slots = chars[i - 1] - chars[j] + 1;
+        size_t missing = slots - (i - j);
+        return cost.range_size + cost.speed_weight +
+               slots * cost.offset_size + missing * cost.missing_size;
+    };
+    
+    size_t first_allowed = 0; // Earliest start permitted by maximum_size
+    size_t block = 0; // Index of the last block start below i
+    for (size_t i = 1; i <= n; i++)
+    {
+        while (first_allowed < i - 1 &&
+               data_sizes[i] - data_sizes[first_allowed] > maximum_size)
+            first_allowed++;
+        
+        while (block + 1 < block_starts.size() && block_starts[block + 1] < i)
+            block++;
         
-        uint16_t last_char = chars.at(i - 1);
+        // The candidates are the block starts within the size limit and
+        // the split point forced by the size limit.
+        std::vector<size_t> candidates(1, first_allowed);
+        for (size_t k = block + 1; k-- > 0 && block_starts[k] > first_allowed; )
+            candidates.push_back(block_starts[k]);
         
-        // Then store the indices of glyphs for each character
-        size_t data_length = 0;
-        for (size_t j = range.first_char; j <= last_char; j++)
+        for (size_t j : candidates)
         {
-            if (char_to_glyph.count(j) == 0)
-            {
-                // Missing character
-                range.glyph_indices.push_back(-1);
+            if (best[j] == infinity)
                 continue;
-            }
-            
-            int glyph_index = char_to_glyph[j];
             
-            // Monitor the amount of the data in the range and split it
-            // if it grows too large.
-            data_length += get_encoded_glyph_size(glyph_index);
-            if (data_length > maximum_size)
+            size_t total = best[j] + range_cost(j, i);
+            if (total < best[i])
             {
-                last_char = j - 1;
-                break;
+                best[i] = total;
+                range_start[i] = j;
             }
-            
-            range.glyph_indices.push_back(glyph_index);
         }
-        
+    }
+    
+    // Walk back from the end to recover the chosen ranges.
+    for (size_t i = n; i > 0; i = range_start[i])
+    {
+        char_range_t range;
+        size_t last_char = chars[i - 1];
+        range.first_char = chars[range_start[i]];
         range.char_count = last_char - range.first_char + 1;
+        
+        for (size_t c = range.first_char; c <= last_char; c++)
+        {
+            if (char_to_glyph.count(c))
+                range.glyph_indices.push_back(char_to_glyph[c]);
+            else
+                range.glyph_indices.push_back(-1); // Missing character
+        }
+        
         result.push_back(range);
     }
     
+    std::reverse(result.begin(), result.end());
     return result;
 }
+
+std::vector<unsigned> compute_kerning_edges(const DataFile &datafile,
+                                            int glyph_index, int zones,
+                                            int threshold)
+{
+    std::vector<unsigned> left(zones, 255);
+    std::vector<unsigned> right(zones, 0);
     
+    if (glyph_index >= 0)
+    {
+        const DataFile::fontinfo_t &fi = datafile.GetFontInfo();
+        const DataFile::glyphentry_t &glyph = datafile.GetGlyphEntry(glyph_index);
+        
+        // Same zone height as computed by the decoder.
+        int zoneheight = std::max(1, (fi.max_height + zones - 1) / zones);
+        
+        for (int y = 0; y < fi.max_height; y++)
+        {
+            int zone = y / zoneheight;
+            for (int x = 0; x < fi.max_width; x++)
+            {
+                if (glyph.data.at(y * fi.max_width + x) >= threshold)
+                {
+                    left.at(zone) = std::min<unsigned>(left.at(zone), x);
+                    right.at(zone) = std::max<unsigned>(right.at(zone), x);
+                }
+            }
+        }
+    }
     
+    left.insert(left.end(), right.begin(), right.end());
+    return left;
 }
+
+std::vector<unsigned> pack_kerning_edges(const std::vector<unsigned> &edges)
+{
+    size_t zones = edges.size() / 2;
+    unsigned leftmost = 255, rightmost = 0;
+    
+    for (size_t i = 0; i < zones; i++)
+    {
+        if (edges.at(i) != 255)
+        {
+            leftmost = std::min(leftmost, edges.at(i));
+            rightmost = std::max(rightmost, edges.at(zones + i));
+        }
+    }
+    
+    if (leftmost == 255)
+        leftmost = 0;
+    
+    std::vector<unsigned> result = {leftmost, rightmost};
+    for (size_t i = 0; i < zones; i++)
+    {
+        if (edges.at(i) == 255)
+        {
+            result.push_back(0xFF);
+        }
+        else
+        {
+            unsigned left = std::min(14u, edges.at(i) - leftmost);
+            unsigned right = std::min(14u, rightmost - edges.at(zones + i));
+            result.push_back((left << 4) | right);
+        }
+    }
+    
+    return result;
+}
+
+void write_kerning_edges_macro(std::ostream &out, int zones)
+{
+    out << "#if MF_USE_KERNING && MF_KERNING_ZONES == " << zones << std::endl;
+    out << "#define MF_KERNING_EDGES(x) x" << std::endl;
+    out << "#else" << std::endl;
+    out << "#define MF_KERNING_EDGES(x) 0" << std::endl;
+    out << "#endif" << std::endl;
+    out << std::endl;
+}
+
+void write_kerning_edges_table(std::ostream &out, const DataFile &datafile,
+                               const std::vector<int> &glyph_indices,
+                               int zones, int threshold,
+                               const std::string &tablename)
+{
+    std::vector<unsigned> data;
+    for (int glyph_index : glyph_indices)
+    {
+        std::vector<unsigned> edges = pack_kerning_edges(
+            compute_kerning_edges(datafile, glyph_index, zones, threshold));
+        data.insert(data.end(), edges.begin(), edges.end());
+    }
+    
+    out << "#if MF_USE_KERNING && MF_KERNING_ZONES == " << zones << std::endl;
+    write_const_table(out, data, "uint8_t", tablename);
+    out << "#endif" << std::endl;
+    out << std::endl;
+}
+
+// Give each distinct value of the key a class number, starting from 1.
+template <typename K>
+static int classify(const std::map<int, K> &items, std::map<int, int> &classes)
+{
+    std::map<K, int> numbers;
+    for (const auto &item : items)
+    {
+        auto iter = numbers.find(item.second);
+        if (iter == numbers.end())
+        {
+            int number = numbers.size() + 1;
+            iter = numbers.insert(std::make_pair(item.second, number)).first;
+        }
+        
+        classes[item.first] = iter->second;
+    }
+    
+    return numbers.size();
+}
+
+kerning_classes_t compute_kerning_classes(
+    const std::vector<DataFile::kerningpair_t> &pairs)
+{
+    kerning_classes_t result;
+    
+    // Characters on the left side are in the same class if they have the
+    // same adjustments against all the characters on the right side.
+    std::map<int, std::map<int, int> > rows;
+    for (const DataFile::kerningpair_t &k : pairs)
+        rows[k.first][k.second] = k.adjust;
+    result.first_class_count = classify(rows, result.first_classes);
+    
+    // Characters on the right side then only have to match against the
+    // classes of the left side.
+    std::map<int, std::map<int, int> > columns;
+    for (const DataFile::kerningpair_t &k : pairs)
+        columns[k.second][result.first_classes[k.first]] = k.adjust;
+    result.second_class_count = classify(columns, result.second_classes);
+    
+    result.adjustments.resize(result.first_class_count *
+                              result.second_class_count);
+    for (const DataFile::kerningpair_t &k : pairs)
+    {
+        int first = result.first_classes[k.first];
+        int second = result.second_classes[k.second];
+        result.adjustments.at((first - 1) * result.second_class_count +
+                              second - 1) = k.adjust;
+    }
+    
+    return result;
+}
+
+bool write_kerning_table(std::ostream &out, const DataFile &datafile,
+                         const std::string &tablename)
+{
+    // Adjustments that do not fit in int8_t are not real kerning.
+    std::vector<DataFile::kerningpair_t> pairs;
+    for (const DataFile::kerningpair_t &k : datafile.GetKerningPairs())
+    {
+        if (k.adjust >= -128 && k.adjust <= 127 && k.first <= 0xFFFF &&
+            k.second <= 0xFFFF)
+        {
+            pairs.push_back(k);
+        }
+    }
+    
+    kerning_classes_t k = compute_kerning_classes(pairs);
+    if (k.first_class_count == 0)
+        return false;
+    
+    if (k.first_class_count > 255 || k.second_class_count > 255)
+    {
+        std::cerr << "Too many kerning classes, leaving out the kerning table."
+                  << std::endl;
+        return false;
+    }
+    
+    std::vector<unsigned> first_chars, first_classes;
+    for (const auto &c : k.first_classes)
+    {
+        first_chars.push_back(c.first);
+        first_classes.push_back(c.second);
+    }
+    
+    std::vector<unsigned> second_chars, second_classes;
+    for (const auto &c : k.second_classes)
+    {
+        second_chars.push_back(c.first);
+        second_classes.push_back(c.second);
+    }
+    
+    out << "#include \"mf_kerning.h\"" << std::endl;
+    out << std::endl;
+    out << "#if MF_USE_KERNING && MF_USE_KERNING_TABLES" << std::endl;
+    write_const_table(out, first_chars, "uint16_t", tablename + "_first_chars", 4);
+    write_const_table(out, first_classes, "uint8_t", tablename + "_first_classes");
+    write_const_table(out, second_chars, "uint16_t", tablename + "_second_chars", 4);
+    write_const_table(out, second_classes, "uint8_t", tablename + "_second_classes");
+    
+    // The adjustments are signed, so they are written in decimal.
+    out << "static const int8_t " << tablename << "_adjustments";
+    out << "[" << k.adjustments.size() << "] = {" << std::endl;
+    for (size_t i = 0; i < k.adjustments.size(); i++)
+    {
+        if (i % 16 == 0)
+            out << (i ? "\n    " : "    ");
+        out << k.adjustments.at(i) << ", ";
+    }
+    out << std::endl << "};" << std::endl;
+    out << std::endl;
+    
+    out << "static const struct mf_kerning_table_s " << tablename << " = {" << std::endl;
+    out << "    " << first_chars.size() << ", /* first count */" << std::endl;
+    out << "    " << tablename << "_first_chars," << std::endl;
+    out << "    " << tablename << "_first_classes," << std::endl;
+    out << "    " << second_chars.size() << ", /* second count */" << std::endl;
+    out << "    " << tablename << "_second_chars," << std::endl;
+    out << "    " << tablename << "_second_classes," << std::endl;
+    out << "    " << k.second_class_count << ", /* second class count */" << std::endl;
+    out << "    " << tablename << "_adjustments," << std::endl;
+    out << "};" << std::endl;
+    out << std::endl;
+    out << "#define MF_KERNING_TABLE(x) x" << std::endl;
+    out << "#else" << std::endl;
+    out << "#define MF_KERNING_TABLE(x) 0" << std::endl;
+    out << "#endif" << std::endl;
+    out << std::endl;
+    
+    return true;
+}
+
+std::vector<unsigned> compute_ascii_widths(const DataFile &datafile,
+    const std::vector<char_range_t> &ranges,
+    std::function<int(size_t range_index, size_t char_index)> get_width)
+{
+    // Same search as in the decoders, 0 if the character is not found.
+    auto lookup = [&](int c)
+    {
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            const char_range_t &range = ranges.at(i);
+            if (c >= range.first_char && c < range.first_char + range.char_count)
+                return get_width(i, c - range.first_char);
+        }
+        return 0;
+    };
+    
+    int fallback = select_fallback_char(datafile);
+    std::vector<unsigned> result;
+    for (int c = 0x20; c <= 0x7E; c++)
+    {
+        int width = lookup(c);
+        if (!width)
+            width = lookup(fallback);
+        result.push_back(width);
+    }
+    
+    return result;
+}
+
+void write_font_metrics(std::ostream &out,
+                        const std::vector<unsigned> &ascii_widths,
+                        const std::string &tablename)
+{
+    out << "#if MF_USE_FONT_METRICS" << std::endl;
+    out << "static const struct mf_font_metrics_s " << tablename << " = {" << std::endl;
+    out << "    {" << std::endl;
+    wordwrap_vector(out, ascii_widths, "        ", 2);
+    out << std::endl << "    }" << std::endl;
+    out << "};" << std::endl;
+    out << std::endl;
+    out << "#define MF_FONT_METRICS(x) x" << std::endl;
+    out << "#else" << std::endl;
+    out << "#define MF_FONT_METRICS(x) 0" << std::endl;
+    out << "#endif" << std::endl;
+    out << std::endl;
+}
+
+std::vector<unsigned> compute_gamma_table(double gamma, double contrast)
+{
+    std::vector<unsigned> table;
+    for (int i = 0; i < 256; i++)
+    {
+        double value = 255.0 * std::pow(i / 255.0, 1.0 / gamma) * contrast;
+        table.push_back(std::min(255, (int)(value + 0.5)));
+    }
+    
+    return table;
+}
+
+bool parse_export_option(const std::string &arg, export_options_t &options)
+{
+    size_t pos = arg.find('=');
+    if (pos == std::string::npos)
+        return false;
+    
+    std::string name = arg.substr(0, pos);
+    std::string value = arg.substr(pos + 1);
+    
+    if (name == "range_speed")
+    {
+        options.range_speed_weight = std::stoi(value);
+        return true;
+    }
+    else if (name == "kerning_edges")
+    {
+        options.kerning_zones = std::stoi(value);
+        return options.kerning_zones >= 0 && options.kerning_zones <= 255;
+    }
+    else if (name == "kerning" && (value == "table" || value == "auto"))
+    {
+        options.kerning_table = (value == "table");
+        return true;
+    }
+    else if (name == "metrics" && (value == "ascii" || value == "none"))
+    {
+        options.ascii_metrics = (value == "ascii");
+        return true;
+    }
+    else if (name == "layout" && (value == "rows" || value == "columns"))
+    {
+        options.row_major = (value == "rows");
+        options.column_major = (value == "columns");
+        return true;
+    }
+    
+    return false;
+}
+    
+    
+}
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <vector>
 #include <iostream>
 #include <functional>
+#include <map>
 #include "datafile.hh"
 
 namespace mcufont {
@@ -40,13 +41,329 @@ struct char_range_t
     char_range_t(): first_char(0), char_count(0) {}
 };
 
+// Cost model for dividing the characters into ranges. All the costs are
+// expressed in bytes of flash, the lookup time is converted to bytes by
+// speed_weight.
+struct char_range_cost_t
+{
+    size_t range_size; // Size of the range descriptor structure.
+    size_t offset_size; // Size of one entry in the per-glyph lookup tables.
+    size_t missing_size; // Size of the dummy data for a missing glyph.
+    size_t speed_weight; // Penalty for each range the decoder has to search.
+    
+    char_range_cost_t(): range_size(0), offset_size(0),
+        missing_size(0), speed_weight(0) {}
+};
+
 // Decide how to best divide the characters in the font into ranges.
-// Limitations are:
-//  - Gaps longer than minimum_gap should result in separate ranges.
-//  - Each range can have encoded data size of at most maximum_size.
+// Minimizes the total cost of the ranges according to the cost model.
+// Each range can have encoded data size of at most maximum_size.
 std::vector<char_range_t> compute_char_ranges(const DataFile &datafile,
     std::function<size_t(size_t)> get_encoded_glyph_size,
     size_t maximum_size,
-    size_t minimum_gap);
+    const char_range_cost_t &cost);
+
+// Compute the kerning edges of a glyph, in the format used by mf_kerning:
+// the leftmost x coordinate in each zone followed by the rightmost. Pixels
+// with values below threshold are ignored. A negative glyph index gives
+// the edges of an empty glyph.
+std::vector<unsigned> compute_kerning_edges(const DataFile &datafile,
+                                            int glyph_index, int zones,
+                                            int threshold);
+
+// Pack the edges from compute_kerning_edges into the format stored in the
+// fonts: the leftmost left edge and the rightmost right edge of the glyph,
+// followed by one byte per zone with the distances from them in the high
+// and low nibble. Empty zones are stored as 0xFF. Distances are limited to
+// 14 pixels, which can only make the kerning smaller.
+std::vector<unsigned> pack_kerning_edges(const std::vector<unsigned> &edges);
+
+// Write out the MF_KERNING_EDGES macro, which gives the kerning edge tables
+// of a font only if the zone count matches the decoder configuration.
+void write_kerning_edges_macro(std::ostream &out, int zones);
+
+// Write out the kerning edges of the glyphs in a character range.
+void write_kerning_edges_table(std::ostream &out, const DataFile &datafile,
+                               const std::vector<int> &glyph_indices,
+                               int zones, int threshold,
+                               const std::string &tablename);
+
+// Kerning pairs grouped into classes of characters that kern identically.
+// The classes are numbered from 1, characters without kerning have none.
+struct kerning_classes_t
+{
+    std::map<int, int> first_classes; // Class of each left side character.
+    std::map<int, int> second_classes; // Class of each right side character.
+    int first_class_count;
+    int second_class_count;
+    
+    // Adjustment for each pair of classes, in the order of the first class.
+    std::vector<int> adjustments;
+    
+    kerning_classes_t(): first_class_count(0), second_class_count(0) {}
+};
+
+// Group the characters of the kerning pairs into classes.
+kerning_classes_t compute_kerning_classes(
+    const std::vector<DataFile::kerningpair_t> &pairs);
+
+// Write out the kerning pairs of the font as a mf_kerning_table_s with
+// the given name, and the MF_KERNING_TABLE macro that refers to it only if
+// the decoder uses kerning tables. Returns false and writes nothing if the
+// font has no kerning pairs that fit in the table.
+bool write_kerning_table(std::ostream &out, const DataFile &datafile,
+                         const std::string &tablename);
+
+// Compute the widths of the printable ASCII characters 0x20-0x7E as the
+// decoder returns them from mf_character_width(). get_width gives the width
+// stored for a character in a range, or 0 if the glyph is missing, in which
+// case the width of the fallback character is used.
+std::vector<unsigned> compute_ascii_widths(const DataFile &datafile,
+    const std::vector<char_range_t> &ranges,
+    std::function<int(size_t range_index, size_t char_index)> get_width);
+
+// Write out the precomputed metrics of the font as a mf_font_metrics_s with
+// the given name, and the MF_FONT_METRICS macro that refers to it only if
+// the decoder uses them.
+void write_font_metrics(std::ostream &out,
+                        const std::vector<unsigned> &ascii_widths,
+                        const std::string &tablename);
+
+// Compute a table that maps the alpha values of the font to blending
+// weights for a display with the given gamma. Contrast scales the result,
+// 1.0 leaves it unchanged. Used as mf_framebuffer_s::alpha_lut.
+std::vector<unsigned> compute_gamma_table(double gamma, double contrast);
+
+// Options for the export commands, given as name=value pairs.
+struct export_options_t
+{
+    // Weight of lookup speed against flash size when dividing characters
+    // into ranges. Each additional range is considered to cost this many
+    // bytes. 0 gives the smallest output, large values give few ranges.
+    size_t range_speed_weight;
+    
+    // Store bwfont glyphs row-by-row instead of column-by-column. Rows can
+    // be decoded with word operations, but each row is padded to a byte.
+    bool row_major;
+    
+    // Store rlefont glyphs column-by-column instead of row-by-row, so that
+    // the decoder outputs the pixels in column order.
+    bool column_major;
+    
+    // Number of zones in the precomputed kerning edges, or 0 to leave them
+    // out. Has to match MF_KERNING_ZONES of the decoder to be used.
+    int kerning_zones;
+    
+    // Include the kerning pairs that were imported from the font file. The
+    // decoder then uses them instead of the automatic kerning.
+    bool kerning_table;
+    
+    // Include a table of the widths of the printable ASCII characters, so
+    // that the decoder can measure them without searching for the glyphs.
+    bool ascii_metrics;
+    
+    export_options_t():
+        range_speed_weight(20), row_major(false), column_major(false),
+        kerning_zones(0), kerning_table(false), ascii_metrics(false) {}
+};
+
+// Parse a single name=value option. Returns false if the option is unknown.
+bool parse_export_option(const std::string &arg, export_options_t &options);
+
+}
+
+
+#ifdef CXXTEST_RUNNING
+#include <cxxtest/TestSuite.h>
+
+using namespace mcufont;
+
+class ExportToolsTests: public CxxTest::TestSuite
+{
+public:
+    void testCharRanges()
+    {
+        // Characters 0-9, 12 and 100-109.
+        std::vector<DataFile::glyphentry_t> glyphs;
+        for (int c = 0; c < 110; c++)
+        {
+            if (c < 10 || c == 12 || c >= 100)
+            {
+                DataFile::glyphentry_t g = {};
+                g.data.resize(1);
+                g.chars.push_back(c);
+                g.width = 1;
+                glyphs.push_back(g);
+            }
+        }
+        
+        DataFile::fontinfo_t fi = {};
+        fi.max_width = fi.max_height = 1;
+        DataFile f(std::vector<DataFile::dictentry_t>(), glyphs, fi);
+        auto glyph_size = [](size_t i) { return (size_t)4; };
+        
+        char_range_cost_t cost;
+        cost.range_size = 12;
+        cost.offset_size = 2;
+        
+        // Small gap is cheaper to fill, large gap is cheaper to split.
+        std::vector<char_range_t> r = compute_char_ranges(f, glyph_size, 65536, cost);
+        TS_ASSERT_EQUALS(r.size(), 2);
+        TS_ASSERT_EQUALS(r.at(0).first_char, 0);
+        TS_ASSERT_EQUALS(r.at(0).char_count, 13);
+        TS_ASSERT_EQUALS(r.at(0).glyph_indices.at(10), -1);
+        TS_ASSERT_EQUALS(r.at(1).first_char, 100);
+        TS_ASSERT_EQUALS(r.at(1).char_count, 10);
+        
+        // Heavy speed weight results in a single range.
+        cost.speed_weight = 1000;
+        r = compute_char_ranges(f, glyph_size, 65536, cost);
+        TS_ASSERT_EQUALS(r.size(), 1);
+        TS_ASSERT_EQUALS(r.at(0).char_count, 110);
+        
+        // Size limit forces splitting even contiguous characters.
+        r = compute_char_ranges(f, glyph_size, 20, cost);
+        TS_ASSERT_EQUALS(r.size(), 5);
+        for (const char_range_t &range : r)
+            TS_ASSERT_LESS_THAN_EQUALS(range.glyph_indices.size(), 13);
+    }
+    
+    void testGammaTable()
+    {
+        std::vector<unsigned> t = compute_gamma_table(1.0, 1.0);
+        TS_ASSERT_EQUALS(t.size(), 256);
+        TS_ASSERT_EQUALS(t.at(0), 0);
+        TS_ASSERT_EQUALS(t.at(100), 100);
+        TS_ASSERT_EQUALS(t.at(255), 255);
+        
+        // Higher gamma makes the partially covered pixels darker.
+        t = compute_gamma_table(2.2, 1.0);
+        TS_ASSERT_EQUALS(t.at(0), 0);
+        TS_ASSERT_LESS_THAN(128, t.at(64));
+        TS_ASSERT_EQUALS(t.at(255), 255);
+        
+        // Contrast is clamped to the maximum.
+        t = compute_gamma_table(1.0, 2.0);
+        TS_ASSERT_EQUALS(t.at(64), 128);
+        TS_ASSERT_EQUALS(t.at(200), 255);
+    }
+    
+    void testKerningEdges()
+    {
+        // 3x4 glyph with pixels at (1,0), (0,2) and (2,2).
+        std::vector<DataFile::glyphentry_t> glyphs;
+        DataFile::glyphentry_t g = {};
+        g.data = {0, 15, 0,
+                  0, 0, 0,
+                  4, 0, 15,
+                  0, 0, 0};
+        g.chars.push_back('a');
+        g.width = 3;
+        glyphs.push_back(g);
+        
+        DataFile::fontinfo_t fi = {};
+        fi.max_width = 3;
+        fi.max_height = 4;
+        DataFile f(std::vector<DataFile::dictentry_t>(), glyphs, fi);
+        
+        // Two zones of two rows each.
+        std::vector<unsigned> e = compute_kerning_edges(f, 0, 2, 1);
+        std::vector<unsigned> expected = {1, 0, 1, 2};
+        TS_ASSERT(e == expected);
+        
+        // The dimmer pixel is ignored with a higher threshold.
+        e = compute_kerning_edges(f, 0, 2, 8);
+        expected = {1, 2, 1, 2};
+        TS_ASSERT(e == expected);
+        
+        // Empty glyph and zones past the glyph height.
+        e = compute_kerning_edges(f, -1, 8, 1);
+        TS_ASSERT_EQUALS(e.size(), 16);
+        TS_ASSERT_EQUALS(e.at(0), 255);
+        TS_ASSERT_EQUALS(e.at(8), 0);
+    }
+    
+    void testPackKerningEdges()
+    {
+        // Zone 1 is empty. The distances of 27 and 20 pixels are limited.
+        std::vector<unsigned> e = {1, 255, 21, 3, 0, 30};
+        std::vector<unsigned> expected = {1, 30, 0x0E, 0xFF, 0xE0};
+        TS_ASSERT(pack_kerning_edges(e) == expected);
+        
+        // Completely empty glyph.
+        e = {255, 255, 0, 0};
+        expected = {0, 0, 0xFF, 0xFF};
+        TS_ASSERT(pack_kerning_edges(e) == expected);
+    }
+    
+    void testAsciiWidths()
+    {
+        // 'a' has width 3, '?' is the fallback with width 5.
+        std::vector<DataFile::glyphentry_t> glyphs(2);
+        glyphs[0].data.resize(1);
+        glyphs[0].chars.push_back('a');
+        glyphs[0].width = 3;
+        glyphs[1].data.resize(1);
+        glyphs[1].chars.push_back('?');
+        glyphs[1].width = 5;
+        
+        DataFile::fontinfo_t fi = {};
+        fi.max_width = fi.max_height = 1;
+        DataFile f(std::vector<DataFile::dictentry_t>(), glyphs, fi);
+        
+        std::vector<char_range_t> ranges(2);
+        ranges[0].first_char = '?';
+        ranges[0].char_count = 1;
+        ranges[0].glyph_indices.push_back(1);
+        ranges[1].first_char = 'a';
+        ranges[1].char_count = 2;
+        ranges[1].glyph_indices.push_back(0);
+        ranges[1].glyph_indices.push_back(-1);
+        
+        auto get_width = [&](size_t range_index, size_t char_index)
+        {
+            int glyph = ranges.at(range_index).glyph_indices.at(char_index);
+            return (glyph < 0) ? 0 : f.GetGlyphEntry(glyph).width;
+        };
+        
+        std::vector<unsigned> w = compute_ascii_widths(f, ranges, get_width);
+        TS_ASSERT_EQUALS(w.size(), 95);
+        TS_ASSERT_EQUALS(w.at('a' - 0x20), 3);
+        
+        // Missing glyph inside a range and a character outside the ranges.
+        TS_ASSERT_EQUALS(w.at('b' - 0x20), 5);
+        TS_ASSERT_EQUALS(w.at('z' - 0x20), 5);
+    }
+    
+    void testKerningClasses()
+    {
+        // A and L kern identically, so do V and W.
+        std::vector<DataFile::kerningpair_t> pairs = {
+            {'A', 'V', -2}, {'A', 'W', -2}, {'L', 'V', -2}, {'L', 'W', -2},
+            {'F', 'A', -1}, {'V', 'A', -2}
+        };
+        
+        kerning_classes_t k = compute_kerning_classes(pairs);
+        TS_ASSERT_EQUALS(k.first_class_count, 3);
+        TS_ASSERT_EQUALS(k.second_class_count, 2);
+        TS_ASSERT_EQUALS(k.first_classes.at('A'), k.first_classes.at('L'));
+        TS_ASSERT_EQUALS(k.second_classes.at('V'), k.second_classes.at('W'));
+        TS_ASSERT_EQUALS(k.adjustments.size(), 6);
+        
+        for (const DataFile::kerningpair_t &p : pairs)
+        {
+            int first = k.first_classes.at(p.first);
+            int second = k.second_classes.at(p.second);
+            size_t index = (first - 1) * k.second_class_count + second - 1;
+            TS_ASSERT_EQUALS(k.adjustments.at(index), p.adjust);
+        }
+        
+        // F does not kern against V.
+        int first = k.first_classes.at('F');
+        int second = k.second_classes.at('V');
+        size_t index = (first - 1) * k.second_class_count + second - 1;
+        TS_ASSERT_EQUALS(k.adjustments.at(index), 0);
+    }
+};
 
-}
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -1,12 +1,16 @@
 #include "freetype_import.hh"
 #include "importtools.hh"
 #include <map>
+#include <set>
 #include <string>
 #include <stdexcept>
 #include <iostream>
+#include <cmath>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_TRUETYPE_TAGS_H
 
 #undef __FTERRORS_H__
 #define FT_ERRORDEF( e, v, s )  std::make_pair( e, s ),
@@ -71,6 +75,61 @@ static void readfile(std::istream &file, std::vector<char> &data)
     }
 }
 
+// Read the glyph pairs listed in the format 0 subtables of the 'kern' table,
+// which is where FT_Get_Kerning takes its values from. Returns false if the
+// font has no such table or it is in an unknown format.
+static bool read_kern_pairs(FT_Face face,
+                            std::set<std::pair<FT_UInt, FT_UInt> > &pairs)
+{
+    FT_ULong length = 0;
+    if (FT_Load_Sfnt_Table(face, TTAG_kern, 0, nullptr, &length) != 0)
+        return false;
+    
+    std::vector<FT_Byte> table(length);
+    if (length == 0 ||
+        FT_Load_Sfnt_Table(face, TTAG_kern, 0, &table[0], &length) != 0)
+        return false;
+    
+    auto u16 = [&table](size_t pos)
+    {
+        return (unsigned)table.at(pos) << 8 | table.at(pos + 1);
+    };
+    
+    try
+    {
+        if (u16(0) != 0)
+            return false;
+        
+        unsigned count = u16(2);
+        size_t pos = 4;
+        for (unsigned i = 0; i < count; i++)
+        {
+            unsigned format = u16(pos + 4) >> 8;
+            if (format != 0)
+            {
+                pos += u16(pos + 2);
+                continue;
+            }
+            
+            // The 16-bit length field overflows in large tables, so the
+            // size is computed from the pair count instead.
+            unsigned npairs = u16(pos + 6);
+            for (unsigned j = 0; j < npairs; j++)
+            {
+                size_t p = pos + 14 + j * 6;
+                pairs.insert(std::make_pair(u16(p), u16(p + 2)));
+            }
+            pos += 14 + npairs * 6;
+        }
+    }
+    catch (std::out_of_range &e)
+    {
+        return false;
+    }
+    
+    return true;
+}
+
 std::unique_ptr<DataFile> LoadFreetype(std::istream &file, int size, bool bw)
 {
     std::vector<char> data;
@@ -84,6 +143,8 @@ std::unique_ptr<DataFile> LoadFreetype(std::istream &file, int size, bool bw)
     DataFile::fontinfo_t fontinfo = {};
     std::vector<DataFile::glyphentry_t> glyphtable;
     std::vector<DataFile::dictentry_t> dictionary;
+    std::vector<DataFile::kerningpair_t> kerning;
+    std::vector<std::pair<FT_ULong, FT_UInt> > charmap;
    
     // Convert size to pixels and round to nearest.
     int u_per_em = face->units_per_EM;
@@ -160,16 +221,65 @@ std::unique_ptr<DataFile> LoadFreetype(std::istream &file, int size, bool bw)
             }
         }
         glyphtable.push_back(glyph);
+        charmap.push_back(std::make_pair(charcode, gindex));
         
         charcode = FT_Get_Next_Char(face, charcode, &gindex);
     }
     
+    // Import the kerning pairs. The grid-fitted values are used, so that
+    // the adjustments are in whole pixels. Only the pairs listed in the
+    // kern table are queried; other font formats fall back to all pairs.
+    if (FT_HAS_KERNING(face))
+    {
+        std::map<FT_UInt, std::vector<FT_ULong> > glyph_chars;
+        for (const auto &c : charmap)
+            glyph_chars[c.second].push_back(c.first);
+        
+        std::set<std::pair<FT_UInt, FT_UInt> > pairs;
+        if (!read_kern_pairs(face, pairs))
+        {
+            for (const auto &first : glyph_chars)
+            {
+                for (const auto &second : glyph_chars)
+                    pairs.insert(std::make_pair(first.first, second.first));
+            }
+        }
+        
+        for (const auto &pair : pairs)
+        {
+            auto first = glyph_chars.find(pair.first);
+            auto second = glyph_chars.find(pair.second);
+            if (first == glyph_chars.end() || second == glyph_chars.end())
+                continue;
+            
+            FT_Vector delta;
+            checkFT(FT_Get_Kerning(face, pair.first, pair.second,
+                                   FT_KERNING_DEFAULT, &delta));
+            
+            int adjust = std::lround(delta.x / 64.0);
+            if (adjust == 0)
+                continue;
+            
+            for (FT_ULong c1 : first->second)
+            {
+                for (FT_ULong c2 : second->second)
+                {
+                    DataFile::kerningpair_t k = {};
+                    k.first = c1;
+                    k.second = c2;
+                    k.adjust = adjust;
+                    kerning.push_back(k);
+                }
+            }
+        }
+    }
+    
     eliminate_duplicates(glyphtable);
     crop_glyphs(glyphtable, fontinfo);
     detect_flags(glyphtable, fontinfo);
     
     std::unique_ptr<DataFile> result(new DataFile(
-        dictionary, glyphtable, fontinfo));
+        dictionary, glyphtable, fontinfo, kerning));
     return result;
 }
 
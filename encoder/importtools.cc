@@ -1,4 +1,5 @@
 #include "importtools.hh"
+#include <algorithm>
 #include <limits>
 
 namespace mcufont {
@@ -90,6 +91,29 @@ void crop_glyphs(std::vector<DataFile::glyphentry_t> &glyphtable,
     fontinfo.baseline_y -= bbox.top;
 }
 
+void transpose_glyphs(std::vector<DataFile::glyphentry_t> &glyphtable,
+                      DataFile::fontinfo_t &fontinfo)
+{
+    size_t old_w = fontinfo.max_width;
+    size_t old_h = fontinfo.max_height;
+    for (DataFile::glyphentry_t &glyph : glyphtable)
+    {
+        DataFile::pixels_t old = glyph.data;
+        glyph.data.clear();
+        
+        for (size_t x = 0; x < old_w; x++)
+        {
+            for (size_t y = 0; y < old_h; y++)
+            {
+                glyph.data.push_back(old.at(old_w * y + x));
+            }
+        }
+    }
+    
+    std::swap(fontinfo.max_width, fontinfo.max_height);
+    std::swap(fontinfo.baseline_x, fontinfo.baseline_y);
+}
+
 void detect_flags(const std::vector<DataFile::glyphentry_t> &glyphtable,
                   DataFile::fontinfo_t &fontinfo)
 {
@@ -13,6 +13,11 @@ void eliminate_duplicates(std::vector<DataFile::glyphentry_t> &glyphtable);
 void crop_glyphs(std::vector<DataFile::glyphentry_t> &glyphtable,
                  DataFile::fontinfo_t &fontinfo);
 
+// Swap the rows and columns of the glyphs, so that the pixels of each glyph
+// are in column order. Adjust fontinfo accordingly.
+void transpose_glyphs(std::vector<DataFile::glyphentry_t> &glyphtable,
+                      DataFile::fontinfo_t &fontinfo);
+
 // Fill in the flags (BW, monospace) automatically.
 void detect_flags(const std::vector<DataFile::glyphentry_t> &glyphtable,
                   DataFile::fontinfo_t &fontinfo);
@@ -6,6 +6,8 @@
 #include "encode_rlefont.hh"
 #include "optimize_rlefont.hh"
 #include "export_bwfont.hh"
+#include "export_glyphruns.hh"
+#include "exporttools.hh"
 #include <vector>
 #include <string>
 #include <set>
@@ -196,11 +198,19 @@ static status_t cmd_filter(const std::vector<std::string> &args)
         }
     }
     
+    // Filter the kerning pairs
+    std::vector<DataFile::kerningpair_t> newkerning;
+    for (const DataFile::kerningpair_t &k : f->GetKerningPairs())
+    {
+        if (allowed.count(k.first) && allowed.count(k.second))
+            newkerning.push_back(k);
+    }
+    
     DataFile::fontinfo_t fontinfo = f->GetFontInfo();
     crop_glyphs(newglyphs, fontinfo);
     detect_flags(newglyphs, fontinfo);
     
-    f.reset(new DataFile(f->GetDictionary(), newglyphs, fontinfo));
+    f.reset(new DataFile(f->GetDictionary(), newglyphs, fontinfo, newkerning));
     std::cout << "After filtering, " << f->GetGlyphCount() << " glyphs remain." << std::endl;
     
     if (!save_dat(src, f.get()))
@@ -259,13 +269,48 @@ static status_t cmd_show_glyph(const std::vector<std::string> &args)
     return STATUS_OK;
 }
 
+// Parse the arguments common to the export commands:
+// <datfile> [outfile] [name=value ...]
+static bool parse_export_args(const std::vector<std::string> &args,
+                              std::string &src, std::string &dst,
+                              export_options_t &options)
+{
+    if (args.size() < 2)
+        return false;
+    
+    src = args.at(1);
+    dst = strip_extension(src) + ".c";
+    
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        if (args.at(i).find('=') != std::string::npos)
+        {
+            if (!parse_export_option(args.at(i), options))
+            {
+                std::cerr << "Unknown option: " << args.at(i) << std::endl;
+                return false;
+            }
+        }
+        else if (i == 2)
+        {
+            dst = args.at(i);
+        }
+        else
+        {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
 static status_t cmd_rlefont_export(const std::vector<std::string> &args)
 {
-    if (args.size() != 2 && args.size() != 3)
+    std::string src, dst;
+    export_options_t options;
+    if (!parse_export_args(args, src, dst, options))
         return STATUS_INVALID;
     
-    std::string src = args.at(1);
-    std::string dst = (args.size() == 2) ? strip_extension(src) + ".c" : args.at(2);
     std::unique_ptr<DataFile> f = load_dat(src);
     
     if (!f)
@@ -273,13 +318,31 @@ static status_t cmd_rlefont_export(const std::vector<std::string> &args)
     
     {
         std::ofstream source(dst);
-        mcufont::rlefont::write_source(source, dst, *f);
+        mcufont::rlefont::write_source(source, dst, *f, options);
         std::cout << "Wrote " << dst << std::endl;
     }
     
     return STATUS_OK;
 }
 
+static status_t cmd_gamma_table(const std::vector<std::string> &args)
+{
+    if (args.size() != 2 && args.size() != 3)
+        return STATUS_INVALID;
+    
+    double gamma = std::stod(args.at(1));
+    double contrast = 1.0;
+    if (args.size() == 3)
+        contrast = std::stod(args.at(2));
+    
+    if (gamma <= 0 || contrast <= 0)
+        return STATUS_INVALID;
+    
+    write_const_table(std::cout, compute_gamma_table(gamma, contrast),
+                      "uint8_t", "mf_gamma_table");
+    return STATUS_OK;
+}
+
 static status_t cmd_rlefont_size(const std::vector<std::string> &args)
 {
     if (args.size() != 2)
@@ -306,7 +369,7 @@ static status_t cmd_rlefont_size(const std::vector<std::string> &args)
 
 static status_t cmd_rlefont_optimize(const std::vector<std::string> &args)
 {
-    if (args.size() != 2 && args.size() != 3)
+    if (args.size() < 2 || args.size() > 4)
         return STATUS_INVALID;
     
     std::string src = args.at(1);
@@ -315,18 +378,37 @@ static status_t cmd_rlefont_optimize(const std::vector<std::string> &args)
     if (!f)
         return STATUS_ERROR;
     
-    size_t oldsize = mcufont::rlefont::get_encoded_size(*f);
+    int limit = 100;
+    bool column_major = false;
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        if (args.at(i) == "layout=columns")
+            column_major = true;
+        else if (args.at(i) == "layout=rows")
+            column_major = false;
+        else
+            limit = std::stoi(args.at(i));
+    }
+    
+    // For column-major export, optimize the dictionary against a transposed
+    // copy of the glyphs. Only the dictionary is written back to the file.
+    std::unique_ptr<DataFile> transposed;
+    DataFile *target = f.get();
+    if (column_major)
+    {
+        std::vector<DataFile::glyphentry_t> glyphs = f->GetGlyphTable();
+        DataFile::fontinfo_t fontinfo = f->GetFontInfo();
+        transpose_glyphs(glyphs, fontinfo);
+        transposed.reset(new DataFile(f->GetDictionary(), glyphs, fontinfo));
+        target = transposed.get();
+    }
+    
+    size_t oldsize = mcufont::rlefont::get_encoded_size(*target);
     
     std::cout << "Original size is " << oldsize << " bytes" << std::endl;
     std::cout << "Press ctrl-C at any time to stop." << std::endl;
     std::cout << "Results are saved automatically after each iteration." << std::endl;
     
-    int limit = 100;
-    if (args.size() == 3)
-    {
-        limit = std::stoi(args.at(2));
-    }
-    
     if (limit > 0)
         std::cout << "Limit is " << limit << " iterations" << std::endl;
     
@@ -334,9 +416,9 @@ static status_t cmd_rlefont_optimize(const std::vector<std::string> &args)
     time_t oldtime = time(NULL);
     while (!limit || i < limit)
     {
-        mcufont::rlefont::optimize(*f);
-
-        size_t newsize = mcufont::rlefont::get_encoded_size(*f);
+        mcufont::rlefont::optimize(*target);
+        
+        size_t newsize = mcufont::rlefont::get_encoded_size(*target);
         time_t newtime = time(NULL);
         
         int bytes_per_min = (oldsize - newsize) * 60 / (newtime - oldtime + 1);
@@ -346,6 +428,12 @@ static status_t cmd_rlefont_optimize(const std::vector<std::string> &args)
                   << " bytes, speed " << bytes_per_min << " B/min"
                   << std::endl;
         
+        if (target != f.get())
+        {
+            for (size_t j = 0; j < DataFile::dictionarysize; j++)
+                f->SetDictionaryEntry(j, target->GetDictionaryEntry(j));
+        }
+        
         {
             if (!save_dat(src, f.get()))
                 return STATUS_ERROR;
@@ -368,7 +456,7 @@ static status_t cmd_rlefont_show_encoded(const std::vector<std::string> &args)
     
     std::unique_ptr<mcufont::rlefont::encoded_font_t> e =
         mcufont::rlefont::encode_font(*f, false);
-
+    
     int i = 0;
     for (mcufont::rlefont::encoded_font_t::rlestring_t d : e->rle_dictionary)
     {
@@ -400,11 +488,11 @@ static status_t cmd_rlefont_show_encoded(const std::vector<std::string> &args)
 
 static status_t cmd_bwfont_export(const std::vector<std::string> &args)
 {
-    if (args.size() != 2 && args.size() != 3)
+    std::string src, dst;
+    export_options_t options;
+    if (!parse_export_args(args, src, dst, options))
         return STATUS_INVALID;
     
-    std::string src = args.at(1);
-    std::string dst = (args.size() == 2) ? strip_extension(src) + ".c" : args.at(2);
     std::unique_ptr<DataFile> f = load_dat(src);
     
     if (!f)
@@ -417,13 +505,81 @@ static status_t cmd_bwfont_export(const std::vector<std::string> &args)
     
     {
         std::ofstream source(dst);
-        mcufont::bwfont::write_source(source, dst, *f);
+        mcufont::bwfont::write_source(source, dst, *f, options);
         std::cout << "Wrote " << dst << std::endl;
     }
     
     return STATUS_OK;
 }
 
+static status_t cmd_glyph_runs(const std::vector<std::string> &args)
+{
+    if (args.size() < 3)
+        return STATUS_INVALID;
+    
+    std::string src = args.at(1);
+    std::string strings_file = args.at(2);
+    std::string dst = strip_extension(strings_file) + ".c";
+    std::string format;
+    glyphruns::layout_options_t layout;
+    export_options_t options;
+    
+    for (size_t i = 3; i < args.size(); i++)
+    {
+        const std::string &arg = args.at(i);
+        if (arg == "format=rlefont" || arg == "format=bwfont")
+        {
+            format = arg.substr(7);
+        }
+        else if (i == 3 && arg.find('=') == std::string::npos)
+        {
+            dst = arg;
+        }
+        else if (!glyphruns::parse_layout_option(arg, layout) &&
+                 !parse_export_option(arg, options))
+        {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            return STATUS_INVALID;
+        }
+    }
+    
+    std::unique_ptr<DataFile> f = load_dat(src);
+    
+    if (!f)
+        return STATUS_ERROR;
+    
+    std::vector<glyphruns::string_entry_t> strings;
+    {
+        std::ifstream infile(strings_file);
+        if (!infile.good())
+        {
+            std::cerr << "Could not open " << strings_file << std::endl;
+            return STATUS_ERROR;
+        }
+        
+        if (!glyphruns::read_string_table(infile, strings))
+        {
+            std::cerr << "Lines must be in the format name=text" << std::endl;
+            return STATUS_ERROR;
+        }
+    }
+    
+    // The glyph references depend on how the font was exported.
+    std::vector<char_range_t> ranges;
+    if (format == "rlefont")
+        ranges = mcufont::rlefont::compute_ranges(*f, options);
+    else if (format == "bwfont")
+        ranges = mcufont::bwfont::compute_ranges(*f, options);
+    layout.font_kerning_zones = options.kerning_zones;
+    
+    {
+        std::ofstream source(dst);
+        glyphruns::write_source(source, src, *f, strings, layout, ranges);
+        std::cout << "Wrote " << dst << std::endl;
+    }
+    
+    return STATUS_OK;
+}
 
 static const char *usage_msg =
     "Usage: mcufont <command> [options] ...\n"
@@ -435,14 +591,50 @@ static const char *usage_msg =
     "   filter <datfile> <range> ...         Remove everything except specified characters.\n"
     "   show_glyph <datfile> <index>         Show the glyph at index.\n"
     "\n"
+    "Commands for display setup:\n"
+    "   gamma_table <gamma> [contrast]       Print an alpha table for mf_framebuffer.\n"
+    "\n"
     "Commands specific to rlefont format:\n"
     "   rlefont_size <datfile>               Check the encoded size of the data file.\n"
-    "   rlefont_optimize <datfile>           Perform an optimization pass on the data file.\n"
-    "   rlefont_export <datfile> [outfile]   Export to .c source code.\n"
+    "   rlefont_optimize <datfile> [iterations] [layout=rows|columns]\n"
+    "                                        Perform an optimization pass on the data file.\n"
+    "                                        Use layout=columns for fonts that will be\n"
+    "                                        exported with layout=columns.\n"
+    "   rlefont_export <datfile> [outfile] [options]   Export to .c source code.\n"
     "   rlefont_show_encoded <datfile>       Show the encoded data for debugging.\n"
     "\n"
     "Commands specific to bwfont format:\n"
-    "   bwfont_export <datfile> [outfile     Export to .c source code.\n"
+    "   bwfont_export <datfile> [outfile] [options]    Export to .c source code.\n"
+    "\n"
+    "Commands for static texts:\n"
+    "   glyph_runs <datfile> <stringfile> [outfile] [options]\n"
+    "                                        Lay out the name=text lines of the\n"
+    "                                        string file for mf_render_glyph_run().\n"
+    "\n"
+    "Options for the export commands:\n"
+    "   range_speed=<n>     Weight of lookup speed vs. size in character ranges\n"
+    "                       (0 = smallest, default 20).\n"
+    "   layout=rows|columns Order of the glyph pixels. Rows decode faster in\n"
+    "                       bwfont, columns suit column-major displays in\n"
+    "                       rlefont. Default is columns for bwfont and rows\n"
+    "                       for rlefont.\n"
+    "   kerning_edges=<n>   Precompute the kerning edges of the glyphs in n\n"
+    "                       zones. Must match MF_KERNING_ZONES (default 16).\n"
+    "   kerning=table|auto  Use the kerning pairs imported from the font file\n"
+    "                       instead of the automatic kerning. Default is auto.\n"
+    "   metrics=ascii|none  Include a table of the widths of the printable ASCII\n"
+    "                       characters for faster measuring. Default is none.\n"
+    "\n"
+    "Options for glyph_runs:\n"
+    "   format=rlefont|bwfont  Look up the glyphs in advance for a font exported\n"
+    "                       in this format. The export options that affect the\n"
+    "                       character ranges must be the same as for the font.\n"
+    "   kerning=auto|table|none  Kerning to apply. Default is auto.\n"
+    "   tab_size=<n>        MF_TABSIZE of the decoder (default 8).\n"
+    "   kerning_zones=<n>   MF_KERNING_ZONES of the decoder (default 16).\n"
+    "   kerning_space_percent=<n>  MF_KERNING_SPACE_PERCENT (default 15).\n"
+    "   kerning_space_pixels=<n>   MF_KERNING_SPACE_PIXELS (default 3).\n"
+    "   kerning_limit=<n>   MF_KERNING_LIMIT of the decoder (default 20).\n"
     "";
 
 typedef status_t (*cmd_t)(const std::vector<std::string> &args);
@@ -451,11 +643,13 @@ static const std::map<std::string, cmd_t> command_list {
     {"import_bdf",              cmd_import_bdf},
     {"filter",                  cmd_filter},
     {"show_glyph",              cmd_show_glyph},
+    {"gamma_table",             cmd_gamma_table},
     {"rlefont_size",            cmd_rlefont_size},
     {"rlefont_optimize",        cmd_rlefont_optimize},
     {"rlefont_export",          cmd_rlefont_export},
     {"rlefont_show_encoded",    cmd_rlefont_show_encoded},
     {"bwfont_export",           cmd_bwfont_export},
+    {"glyph_runs",              cmd_glyph_runs},
 };
 
 int main(int argc, char **argv)
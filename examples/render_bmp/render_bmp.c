@@ -5,7 +5,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <math.h>
 #include "write_bmp.h"
+#include "glyphruns.h"
 
 /***************************************
  * Parsing of the command line options *
@@ -21,6 +23,26 @@ typedef struct {
     int margin;
     int anchor;
     int scale;
+    int cache_size;
+    int kerning_cache_size;
+    int wrap_buffer_size;
+    bool incremental;
+    bool check_widths;
+    bool check_decode;
+    bool positions;
+    bool expand_dict;
+    bool smooth;
+    int bold;
+    int outline;
+    int shadow;
+    int fb_format;
+    double gamma;
+    double contrast;
+    bool spans;
+    bool page_blit;
+    bool clip;
+    struct mf_cliprect_s clip_rect;
+    bool glyph_runs;
 } options_t;
 
 static const char default_text[] = 
@@ -38,8 +60,49 @@ static const char usage_text[] =
     "    -a l|c|r|j  Align left/center/right/justify.\n"
     "    -w width    Width of the image to render.\n"
     "    -m margin   Margin in the image.\n"
-    "    -s scale    Scale the font.\n";
-    
+    "    -s scale    Scale the font, can be fractional such as 1.5.\n"
+    "    -S          Smooth the edges of a fractionally scaled font.\n"
+    "    -b weight   Make the font bold by given number of pixels.\n"
+    "    -l width    Render only the outline of the glyphs.\n"
+    "    -D offset   Add a half-transparent shadow to the glyphs.\n"
+    "    -c bytes    Use a glyph cache of given size.\n"
+    "    -k bytes    Use a kerning cache of given size.\n"
+    "    -p bytes    Use optimal word wrap with a buffer of given size.\n"
+    "    -i          Wrap incrementally, typing the text in backwards, and\n"
+    "                check the layout after editing it in the middle.\n"
+    "    -W          Check the line widths measured by the word wrap.\n"
+    "    -u          Check mf_decode_utf8() against mf_getchar() on the text.\n"
+    "    -x          Render at the measured character positions, and check\n"
+    "                mf_find_position() on them.\n"
+    "    -d          Expand the font dictionary into RAM.\n"
+    "    -B          Pass the pixels to a span callback in batches.\n"
+    "    -C x0,y0,x1,y1  Only draw the pixels inside a clip rectangle.\n"
+    "    -F format   Render into a framebuffer: a8, a4, 1bpp, rgb565,\n"
+    "                rgb888, pages or argb8888.\n"
+    "    -g gamma[,contrast]  Correct the framebuffer alpha for display gamma.\n"
+    "    -P          Copy bwfont glyphs straight into the pages format.\n"
+    "    -r          Render the glyph runs of fonts/glyph_runs.txt instead\n"
+    "                of the text.\n";
+
+/* Glyph runs laid out by fonts/Makefile for the -r option. */
+static const struct {
+    const char *fontname;
+    const struct mf_glyph_run_s *const *runs;
+} glyph_run_fonts[] = {
+    {"DejaVuSans12", mf_glyphruns_DejaVuSans12},
+    {"DejaVuSans12bw_bwfont", mf_glyphruns_DejaVuSans12bw_bwfont},
+    {"DejaVuSerif16_kerned", mf_glyphruns_DejaVuSerif16_kerned},
+    {NULL, NULL}
+};
+
+#if MF_USE_FRAMEBUFFER
+/* Names of the framebuffer formats for the -F option, in the order of
+ * enum mf_pixel_format_t. */
+static const char *const format_names[] = {
+    "a8", "a4", "1bpp", "rgb565", "rgb888", "pages", "argb8888", NULL
+};
+#endif
+
 /* Parse the command line options */
 static bool parse_options(int argc, const char **argv, options_t *options)
 {
@@ -53,7 +116,8 @@ static bool parse_options(int argc, const char **argv, options_t *options)
     options->text = default_text;
     options->width = 200;
     options->margin = 5;
-    options->scale = 1;
+    options->scale = MF_SCALE_ONE;
+    options->fb_format = -1;
     
     while (argv != end)
     {
@@ -80,8 +144,117 @@ static bool parse_options(int argc, const char **argv, options_t *options)
         }
         else if (strcmp(cmd, "-s") == 0 && argc)
         {
-            options->scale = atoi(*argv++);
+            options->scale = atof(*argv++) * MF_SCALE_ONE + 0.5;
+        }
+        else if (strcmp(cmd, "-b") == 0 && argc)
+        {
+            options->bold = atoi(*argv++);
+        }
+        else if (strcmp(cmd, "-l") == 0 && argc)
+        {
+            options->outline = atoi(*argv++);
+        }
+        else if (strcmp(cmd, "-D") == 0 && argc)
+        {
+            options->shadow = atoi(*argv++);
+        }
+        else if (strcmp(cmd, "-c") == 0 && argc)
+        {
+            options->cache_size = atoi(*argv++);
+        }
+        else if (strcmp(cmd, "-k") == 0 && argc)
+        {
+            options->kerning_cache_size = atoi(*argv++);
+        }
+        else if (strcmp(cmd, "-p") == 0 && argc)
+        {
+            options->wrap_buffer_size = atoi(*argv++);
+        }
+        else if (strcmp(cmd, "-i") == 0)
+        {
+            options->incremental = true;
+        }
+        else if (strcmp(cmd, "-W") == 0)
+        {
+            options->check_widths = true;
+        }
+        else if (strcmp(cmd, "-u") == 0)
+        {
+            options->check_decode = true;
+        }
+        else if (strcmp(cmd, "-x") == 0)
+        {
+            options->positions = true;
+        }
+        else if (strcmp(cmd, "-d") == 0)
+        {
+            options->expand_dict = true;
+        }
+        else if (strcmp(cmd, "-S") == 0)
+        {
+            options->smooth = true;
+        }
+        else if (strcmp(cmd, "-P") == 0)
+        {
+            options->page_blit = true;
+        }
+        else if (strcmp(cmd, "-B") == 0)
+        {
+            options->spans = true;
+        }
+        else if (strcmp(cmd, "-r") == 0)
+        {
+            options->glyph_runs = true;
         }
+#if MF_USE_CLIPPING
+        else if (strcmp(cmd, "-C") == 0 && argc)
+        {
+            struct mf_cliprect_s *r = &options->clip_rect;
+            int x0, y0, x1, y1;
+            
+            if (sscanf(*argv++, "%d,%d,%d,%d", &x0, &y0, &x1, &y1) != 4)
+            {
+                printf("Invalid clip rectangle.\n");
+                return false;
+            }
+            
+            r->x0 = x0;
+            r->y0 = y0;
+            r->x1 = x1;
+            r->y1 = y1;
+            options->clip = true;
+        }
+#endif
+#if MF_USE_FRAMEBUFFER
+        else if (strcmp(cmd, "-F") == 0 && argc)
+        {
+            const char *name = *argv++;
+            int i;
+            
+            for (i = 0; format_names[i]; i++)
+            {
+                if (strcmp(name, format_names[i]) == 0)
+                    options->fb_format = i;
+            }
+            
+            if (options->fb_format < 0)
+            {
+                printf("Invalid framebuffer format: %s\n", name);
+                return false;
+            }
+        }
+        else if (strcmp(cmd, "-g") == 0 && argc)
+        {
+            options->contrast = 1.0;
+            if (sscanf(*argv++, "%lf,%lf", &options->gamma,
+                       &options->contrast) < 1 ||
+                options->gamma <= 0 || options->contrast <= 0)
+            {
+                printf("Invalid gamma.\n");
+                return false;
+            }
+        }
+#endif
         else if (strcmp(cmd, "-h") == 0 || strcmp(cmd, "--help") == 0)
         {
             return false;
@@ -98,6 +271,19 @@ static bool parse_options(int argc, const char **argv, options_t *options)
         return false;
     }
     
+    if (options->check_widths &&
+        (options->incremental || options->wrap_buffer_size))
+    {
+        printf("Line widths are only measured by the default word wrap.\n");
+        return false;
+    }
+    
+    if (options->glyph_runs && align == 'j')
+    {
+        printf("Glyph runs cannot be justified.\n");
+        return false;
+    }
+    
     if (align == 'l')
     {
         options->alignment = MF_ALIGN_LEFT;
@@ -148,6 +334,10 @@ typedef struct {
     uint16_t height;
     uint16_t y;
     const struct mf_font_s *font;
+#if MF_USE_FRAMEBUFFER
+    struct mf_framebuffer_s *fb; /* NULL to use pixel_callback. */
+#endif
+    bool failed; /* Set if a check during rendering failed. */
 } state_t;
 
 /* Callback to write to a memory buffer. */
@@ -173,51 +363,620 @@ static void pixel_callback(int16_t x, int16_t y, uint8_t count, uint8_t alpha,
     }
 }
 
+#if MF_USE_SPAN_BATCH
+/* Callback to write a batch of spans to the memory buffer. */
+static void span_callback(const struct mf_span_s *spans, uint8_t count,
+                          void *state)
+{
+    while (count--)
+    {
+        pixel_callback(spans->x, spans->y, spans->count, spans->alpha, state);
+        spans++;
+    }
+}
+#endif
+
 /* Callback to render characters. */
 static uint8_t character_callback(int16_t x, int16_t y, mf_char character,
                                   void *state)
 {
     state_t *s = (state_t*)state;
+    
+#if MF_USE_FRAMEBUFFER
+    if (s->fb && s->options->page_blit)
+        return mf_bwfont_blit_pages(s->font, s->fb, x, y, character, false);
+    else if (s->fb)
+        return mf_framebuffer_render_character(s->font, s->fb, x, y, character);
+#endif
+    
+#if MF_USE_CLIPPING
+    if (s->options->clip)
+    {
+        return mf_render_character_clipped(s->font, x, y, character,
+                                           &s->options->clip_rect,
+                                           pixel_callback, state);
+    }
+#endif
+    
+#if MF_USE_SPAN_BATCH
+    if (s->options->spans)
+    {
+        return mf_render_character_spans(s->font, x, y, character,
+                                         span_callback, state);
+    }
+#endif
+    
     return mf_render_character(s->font, x, y, character, pixel_callback, state);
 }
 
-/* Callback to render lines. */
-static bool line_callback(const char *line, uint16_t count, void *state)
+/* Check mf_find_position() for x coordinates across the line and some
+ * distance past both ends of it. The boundary it returns must be one of
+ * the nearest ones. Returns false if it is not. */
+static bool check_find_position(const int16_t *positions, uint16_t count)
 {
-    state_t *s = (state_t*)state;
+    int16_t x, best;
+    uint16_t i, result;
+    
+    for (x = positions[0] - 20; x <= positions[count] + 20; x++)
+    {
+        result = mf_find_position(positions, count, x);
+        
+        best = 0x7FFF;
+        for (i = 0; i <= count; i++)
+        {
+            if (abs(positions[i] - x) < best)
+                best = abs(positions[i] - x);
+        }
+        
+        if (result > count || abs(positions[result] - x) != best ||
+            (x < positions[0] && result != 0) ||
+            (x > positions[count] && result != count))
+        {
+            printf("mf_find_position() returned %d for x = %d\n",
+                   result, x);
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/* Render one line of text one character at a time, using the positions
+ * computed by mf_get_justified_positions() or mf_get_aligned_positions(). */
+static void render_positions(state_t *s, const char *line, uint16_t count)
+{
+    struct mf_line_metrics_s metrics;
+    int16_t *positions;
+    uint16_t i;
+    mf_char c;
+    
+    mf_measure_line(s->font, line, count, false, &metrics);
+    positions = malloc((metrics.count + 1) * sizeof(int16_t));
     
     if (s->options->justify)
+    {
+        mf_get_justified_positions(s->font, s->options->anchor,
+                                   s->width - s->options->margin * 2,
+                                   line, &metrics,
+                                   positions, metrics.count + 1);
+    }
+    else
+    {
+        mf_get_aligned_positions(s->font, s->options->anchor,
+                                 s->options->alignment, line, &metrics,
+                                 positions, metrics.count + 1);
+    }
+    
+    if (!check_find_position(positions, metrics.count))
+        s->failed = true;
+    
+    for (i = 0; i < metrics.count; i++)
+    {
+        c = mf_getchar(&line);
+        if (c != '\t')
+        {
+            character_callback(positions[i] - s->font->baseline_x, s->y,
+                               c, s);
+        }
+    }
+    
+    free(positions);
+}
+
+/* Render one line of text. */
+static void render_line(state_t *s, const char *line, uint16_t count)
+{
+    if (s->options->positions)
+    {
+        render_positions(s, line, count);
+    }
+#if MF_USE_FRAMEBUFFER
+    else if (s->fb && !s->options->page_blit && s->options->justify)
+    {
+        mf_framebuffer_render_justified(s->font, s->fb, s->options->anchor,
+                                        s->y, s->width - s->options->margin * 2,
+                                        line, count);
+    }
+    else if (s->fb && !s->options->page_blit)
+    {
+        mf_framebuffer_render_aligned(s->font, s->fb, s->options->anchor,
+                                      s->y, s->options->alignment,
+                                      line, count);
+    }
+#endif
+    else if (s->options->justify)
     {
         mf_render_justified(s->font, s->options->anchor, s->y,
                             s->width - s->options->margin * 2,
-                            line, count, character_callback, state);
+                            line, count, character_callback, s);
     }
     else
     {
         mf_render_aligned(s->font, s->options->anchor, s->y,
                           s->options->alignment, line, count,
-                          character_callback, state);
+                          character_callback, s);
     }
     s->y += s->font->line_height;
-    return true;
 }
 
-/* Callback to just count the lines.
- * Used to decide the image height */
-bool count_lines(const char *line, uint16_t count, void *state)
+/* Find the glyph runs that were laid out for the font, or NULL if the
+ * font has none. */
+static const struct mf_glyph_run_s *const *find_glyph_runs(
+    const struct mf_font_s *font)
+{
+    int i;
+    
+    for (i = 0; glyph_run_fonts[i].fontname; i++)
+    {
+        if (strcmp(glyph_run_fonts[i].fontname, font->short_name) == 0)
+            return glyph_run_fonts[i].runs;
+    }
+    
+    return NULL;
+}
+
+#if MF_USE_FRAMEBUFFER
+/*************************
+ * Framebuffer rendering *
+ *************************/
+
+/* Allocate a framebuffer of the given format and fill it with white.
+ * The text is drawn in black. */
+static void init_framebuffer(struct mf_framebuffer_s *fb,
+                             enum mf_pixel_format_t format,
+                             uint16_t width, uint16_t height)
+{
+    uint32_t size;
+    
+    switch (format)
+    {
+        case MF_PIXFMT_A8:       fb->stride = width; break;
+        case MF_PIXFMT_A4:       fb->stride = (width + 1) / 2; break;
+        case MF_PIXFMT_1BPP:     fb->stride = (width + 7) / 8; break;
+        case MF_PIXFMT_RGB565:   fb->stride = width * 2; break;
+        case MF_PIXFMT_RGB888:   fb->stride = width * 3; break;
+        case MF_PIXFMT_PAGES:    fb->stride = width; break;
+        case MF_PIXFMT_ARGB8888: fb->stride = width * 4; break;
+    }
+    
+    if (format == MF_PIXFMT_PAGES)
+        size = (uint32_t)fb->stride * ((height + 7) / 8);
+    else
+        size = (uint32_t)fb->stride * height;
+    
+    /* All bits set is white in every format. */
+    fb->buffer = malloc(size);
+    memset(fb->buffer, 0xFF, size);
+    
+    fb->format = format;
+    fb->color = (format == MF_PIXFMT_ARGB8888) ? 0xFF000000 : 0;
+    fb->clip_x0 = 0;
+    fb->clip_y0 = 0;
+    fb->clip_x1 = width;
+    fb->clip_y1 = height;
+    fb->alpha_lut = NULL;
+}
+
+/* Fill in an alpha table for the given display gamma and contrast, the
+ * same way as the gamma_table command of the mcufont tool. */
+static void compute_alpha_lut(uint8_t *lut, double gamma, double contrast)
 {
-    int *linecount = (int*)state;
-    (*linecount)++;
+    double value;
+    int i;
+    
+    for (i = 0; i < 256; i++)
+    {
+        value = 255.0 * pow(i / 255.0, 1.0 / gamma) * contrast;
+        lut[i] = (value + 0.5 > 255) ? 255 : (uint8_t)(value + 0.5);
+    }
+}
+
+/* Convert the framebuffer contents to 8-bit grayscale in the image. */
+static void read_framebuffer(const struct mf_framebuffer_s *fb,
+                             state_t *s)
+{
+    const uint8_t *row;
+    uint16_t x, y, g;
+    uint8_t value = 0;
+    
+    for (y = 0; y < s->height; y++)
+    {
+        row = fb->buffer + (uint32_t)fb->stride * y;
+        
+        for (x = 0; x < s->width; x++)
+        {
+            switch (fb->format)
+            {
+                case MF_PIXFMT_A8:
+                    value = row[x];
+                    break;
+                
+                case MF_PIXFMT_A4:
+                    value = ((x & 1) ? row[x / 2] & 0x0F : row[x / 2] >> 4) * 17;
+                    break;
+                
+                case MF_PIXFMT_1BPP:
+                    value = (row[x / 8] & (0x80 >> (x & 7))) ? 255 : 0;
+                    break;
+                
+                case MF_PIXFMT_RGB565:
+                    g = (((const uint16_t*)row)[x] >> 5) & 0x3F;
+                    value = (g * 255 + 31) / 63;
+                    break;
+                
+                case MF_PIXFMT_RGB888:
+                    value = row[3 * x + 1];
+                    break;
+                
+                case MF_PIXFMT_PAGES:
+                    row = fb->buffer + (uint32_t)fb->stride * (y / 8);
+                    value = (row[x] & (1 << (y & 7))) ? 255 : 0;
+                    break;
+                
+                case MF_PIXFMT_ARGB8888:
+                    value = ((const uint32_t*)row)[x] >> 8;
+                    break;
+            }
+            
+            s->buffer[(uint32_t)s->width * y + x] = value;
+        }
+    }
+}
+#endif
+
+/*****************
+ * Word wrapping *
+ *****************/
+
+typedef struct {
+    struct mf_lineinfo_s *lines;
+    uint16_t count;
+} linelist_t;
+
+/* Callback to store the lines from the optimal word wrap. */
+static bool store_line(const char *line, uint16_t count, void *state)
+{
+    linelist_t *l = (linelist_t*)state;
+    l->lines[l->count].start = line;
+    l->lines[l->count].chars = count;
+    l->count++;
     return true;
 }
 
+#if MF_USE_ADVANCED_WORDWRAP && MF_USE_INCREMENTAL_WORDWRAP
+/* Build the text by inserting one character at a time at the start,
+ * updating the layout after each insertion, and then store the lines. */
+static void wrap_incremental(const struct mf_font_s *font, int16_t width,
+                             const char *text, linelist_t *list)
+{
+    struct mf_wordwrap_layout_s layout;
+    struct mf_wrapline_s *lines;
+    size_t len = strlen(text);
+    size_t pos = len;
+    char *buffer = malloc(len + 1);
+    uint16_t first, last, i;
+    
+    lines = malloc((len + 1) * sizeof(struct mf_wrapline_s));
+    buffer[0] = 0;
+    mf_wordwrap_layout(&layout, font, width, lines, len + 1, buffer);
+    
+    while (pos > 0)
+    {
+        size_t n = 1;
+        
+        pos--;
+        while (pos > 0 && (text[pos] & 0xC0) == 0x80)
+        {
+            pos--;
+            n++;
+        }
+        
+        memmove(buffer + n, buffer, len - pos - n + 1);
+        memcpy(buffer, text + pos, n);
+        mf_wordwrap_update(&layout, buffer, 0, 0, n, &first, &last);
+    }
+    
+    /* The buffer now has the same content as the original text. */
+    for (i = 0; i < layout.count; i++)
+        store_line(text + lines[i].start, lines[i].chars, list);
+    
+    free(lines);
+    free(buffer);
+}
+
+/* Check the layout after an edit against a full layout of the text. The
+ * lines outside the changed range from first to last must be the same as
+ * before the edit, apart from the offset of the edit, and must not contain
+ * any of the inserted text. */
+static bool check_update(const struct mf_wordwrap_layout_s *layout,
+                         const struct mf_wrapline_s *before,
+                         uint16_t before_count, const char *text,
+                         uint16_t position, uint16_t removed,
+                         uint16_t inserted, uint16_t first, uint16_t last)
+{
+    struct mf_wordwrap_layout_s full;
+    struct mf_wrapline_s *lines, *l = layout->lines;
+    uint16_t i, line, end;
+    size_t len = strlen(text);
+    bool ok;
+    
+    lines = malloc(layout->max_lines * sizeof(struct mf_wrapline_s));
+    mf_wordwrap_layout(&full, layout->font, layout->width, lines,
+                       layout->max_lines, text);
+    
+    ok = (full.count == layout->count && first <= last &&
+          (last <= layout->count || last <= before_count));
+    
+    for (i = 0; i < full.count && ok; i++)
+        ok = (l[i].start == lines[i].start && l[i].chars == lines[i].chars);
+    
+    for (i = 0; i < first && ok; i++)
+        ok = (l[i].start == before[i].start && l[i].chars == before[i].chars);
+    
+    for (i = last; i < layout->count && ok; i++)
+    {
+        ok = (i < before_count &&
+              l[i].start == before[i].start + inserted - removed &&
+              l[i].chars == before[i].chars);
+    }
+    
+    for (i = 0; i < layout->count && ok; i++)
+    {
+        end = (i + 1 < layout->count) ? l[i + 1].start : len;
+        if (i < first || i >= last)
+            ok = (end <= position || l[i].start >= position + inserted);
+    }
+    
+    /* The line with the edit is found, and the changed range does not
+     * start after it. */
+    line = mf_wordwrap_find_line(layout, position);
+    if (ok && layout->count)
+    {
+        ok = (l[line].start <= position && first <= line &&
+              (line + 1 == layout->count || l[line + 1].start > position));
+    }
+    
+    if (!ok)
+    {
+        printf("Incremental layout differs after editing %d units at %d, "
+               "lines %d to %d changed\n", removed, position, first, last);
+    }
+    
+    free(lines);
+    return ok;
+}
+
+/* Edit the text at pseudo-random positions, removing a piece of it,
+ * inserting other text in its place and finally putting the piece back.
+ * Each update of the layout is compared with a full layout of the edited
+ * text. Returns false if any of them differ. */
+static bool check_incremental(const struct mf_font_s *font, int16_t width,
+                              const char *text)
+{
+    static const char words[] = "new words, ";
+    struct mf_wordwrap_layout_s layout;
+    struct mf_wrapline_s *lines, *before;
+    size_t len = strlen(text);
+    size_t max_len = len + sizeof(words);
+    char *buffer = malloc(max_len);
+    uint16_t max_lines = max_len;
+    uint16_t pos, n, ins, first, last, count;
+    uint32_t seed = 1;
+    int i;
+    bool ok = true;
+    
+    lines = malloc(max_lines * sizeof(struct mf_wrapline_s));
+    before = malloc(max_lines * sizeof(struct mf_wrapline_s));
+    memcpy(buffer, text, len + 1);
+    mf_wordwrap_layout(&layout, font, width, lines, max_lines, buffer);
+    ins = sizeof(words) - 1;
+    
+    for (i = 0; i < 100 && ok; i++)
+    {
+        /* Pick a piece of the text at character boundaries. */
+        seed = seed * 1103515245 + 12345;
+        pos = (seed >> 8) % (len + 1);
+        n = (seed >> 24) % 16;
+        while (pos > 0 && (buffer[pos] & 0xC0) == 0x80)
+            pos--;
+        if (n > len - pos)
+            n = len - pos;
+        while (pos + n < len && (buffer[pos + n] & 0xC0) == 0x80)
+            n++;
+        
+        /* Remove it. */
+        count = layout.count;
+        memcpy(before, lines, count * sizeof(struct mf_wrapline_s));
+        memmove(buffer + pos, buffer + pos + n, len - pos - n + 1);
+        mf_wordwrap_update(&layout, buffer, pos, n, 0, &first, &last);
+        ok = check_update(&layout, before, count, buffer, pos, n, 0,
+                          first, last);
+        
+        /* Insert the words in its place. */
+        count = layout.count;
+        memcpy(before, lines, count * sizeof(struct mf_wrapline_s));
+        memmove(buffer + pos + ins, buffer + pos, len - n - pos + 1);
+        memcpy(buffer + pos, words, ins);
+        mf_wordwrap_update(&layout, buffer, pos, 0, ins, &first, &last);
+        ok = ok && check_update(&layout, before, count, buffer, pos, 0, ins,
+                                first, last);
+        
+        /* Replace the words with the original piece. */
+        count = layout.count;
+        memcpy(before, lines, count * sizeof(struct mf_wrapline_s));
+        memmove(buffer + pos + n, buffer + pos + ins, len - n - pos + 1);
+        memcpy(buffer + pos, text + pos, n);
+        mf_wordwrap_update(&layout, buffer, pos, ins, n, &first, &last);
+        ok = ok && check_update(&layout, before, count, buffer, pos, ins, n,
+                                first, last);
+    }
+    
+    free(before);
+    free(lines);
+    free(buffer);
+    return ok;
+}
+#endif
+
+/* Wrap the text into lines, using the optimal or incremental algorithm
+ * if requested. Returns the number of lines. */
+static uint16_t wrap_text(const struct mf_font_s *font,
+                          const options_t *options, void *wrap_buffer,
+                          struct mf_lineinfo_s *lines, uint16_t max_lines)
+{
+    int16_t width = options->width - 2 * options->margin;
+    linelist_t list;
+    
+    list.lines = lines;
+    list.count = 0;
+    
+#if MF_USE_ADVANCED_WORDWRAP && MF_USE_INCREMENTAL_WORDWRAP
+    if (options->incremental)
+    {
+        wrap_incremental(font, width, options->text, &list);
+        return list.count;
+    }
+#endif
+    
+#if MF_USE_OPTIMAL_WORDWRAP
+    if (wrap_buffer)
+    {
+        mf_wordwrap_optimal(font, width, options->text, wrap_buffer,
+                            options->wrap_buffer_size, store_line, &list);
+        return list.count;
+    }
+#endif
+    
+    return mf_wordwrap_lines(font, width, options->text, lines, max_lines);
+}
+
+/* Compare the line widths from mf_wordwrap_lines() with the widths given
+ * by mf_get_string_width(). Returns false if any of them differ. */
+static bool check_line_widths(const struct mf_font_s *font,
+                              const struct mf_lineinfo_s *lines,
+                              uint16_t count)
+{
+    struct mf_line_metrics_s metrics;
+    int16_t width;
+    uint16_t i;
+    bool ok = true;
+    
+    for (i = 0; i < count; i++)
+    {
+        width = 0;
+        if (lines[i].chars)
+        {
+            mf_measure_line(font, lines[i].start, lines[i].chars, false,
+                            &metrics);
+            if (metrics.count)
+            {
+                width = mf_get_string_width(font, lines[i].start,
+                                            metrics.count, false);
+            }
+        }
+        
+        if (lines[i].width != width)
+        {
+            printf("Line %d has width %d, expected %d\n",
+                   i, lines[i].width, width);
+            ok = false;
+        }
+    }
+    
+    return ok;
+}
+
+#if MF_ENCODING == MF_ENCODING_UTF8
+/* Decode the text in pieces with mf_decode_utf8(), using every buffer size
+ * up to the length of the text, and compare the characters with
+ * mf_getchar(). The text and the buffer are copied to allocations of the
+ * exact size, so that memory checkers notice any access past them.
+ * Returns false if the results differ. */
+static bool check_decode_utf8(const char *text)
+{
+    size_t len = strlen(text);
+    char *copy = malloc(len + 1);
+    uint16_t *buffer;
+    uint16_t size, count, i;
+    mf_str ref;
+    const char *str;
+    bool ok = true;
+    
+    memcpy(copy, text, len + 1);
+    
+    for (size = 1; size <= len + 2 && size < 0xFFFF && ok; size++)
+    {
+        buffer = malloc(size * sizeof(uint16_t));
+        str = copy;
+        ref = copy;
+        
+        do
+        {
+            count = mf_decode_utf8(&str, buffer, size);
+            
+            for (i = 0; i < count && ok; i++)
+                ok = (buffer[i] == mf_getchar(&ref));
+            
+            ok = ok && buffer[count] == 0 && str == ref;
+        } while (count > 0 && ok);
+        
+        /* With room for only the terminating 0, nothing is decoded. */
+        if (size > 1)
+            ok = ok && mf_getchar(&ref) == 0 && str == ref;
+        
+        if (!ok)
+        {
+            printf("mf_decode_utf8() differs from mf_getchar() with size %d "
+                   "at offset %d\n", size, (int)(ref - copy));
+        }
+        
+        free(buffer);
+    }
+    
+    free(copy);
+    return ok;
+}
+#endif
+
 int main(int argc, const char **argv)
 {
     int height;
+    uint16_t max_lines, count, i;
+    struct mf_lineinfo_s *lines;
     const struct mf_font_s *font;
     struct mf_scaledfont_s scaledfont;
+    struct mf_effectfont_s effectfont;
+#if MF_USE_FRAMEBUFFER
+    struct mf_framebuffer_s fb;
+    uint8_t alpha_lut[256];
+#endif
     options_t options;
     state_t state = {};
+    void *cache = NULL;
+    void *kerning_cache = NULL;
+    void *wrap_buffer = NULL;
+    void *dict = NULL;
+    const struct mf_glyph_run_s *const *runs = NULL;
     
     if (!parse_options(argc - 1, argv + 1, &options))
     {
@@ -225,6 +984,11 @@ int main(int argc, const char **argv)
         return 1;
     }
     
+#if MF_ENCODING == MF_ENCODING_UTF8
+    if (options.check_decode && !check_decode_utf8(options.text))
+        return 3;
+#endif
+    
     font = mf_find_font(options.fontname);
     
     if (!font)
@@ -233,18 +997,96 @@ int main(int argc, const char **argv)
         return 2;
     }
     
-    if (options.scale > 1)
+#if MF_USE_EXPANDED_DICTIONARY
+    if (options.expand_dict)
     {
-        mf_scale_font(&scaledfont, font, options.scale, options.scale);
+        uint32_t size = mf_rlefont_expanded_size(font);
+        dict = malloc(size);
+        if (!mf_rlefont_expand_dictionary(font, dict, size))
+            printf("Could not expand the font dictionary\n");
+        else
+            printf("Expanded dictionary: %lu bytes\n", (unsigned long)size);
+    }
+#endif
+    
+    if (options.glyph_runs)
+    {
+        runs = find_glyph_runs(font);
+        if (!runs)
+        {
+            printf("No glyph runs for font: %s\n", options.fontname);
+            return 2;
+        }
+    }
+    
+    if (options.scale != MF_SCALE_ONE)
+    {
+        mf_scale_font_fixed(&scaledfont, font, options.scale, options.scale,
+                            options.smooth);
         font = &scaledfont.font;
     }
     
-    /* Count the number of lines that we need. */
-    height = 0;
-    mf_wordwrap(font, options.width - 2 * options.margin,
-                options.text, count_lines, &height);
-    height *= font->height;
-    height += 4;
+    if (options.bold > 0)
+    {
+        mf_bold_font(&effectfont, font, options.bold);
+        font = &effectfont.font;
+    }
+    else if (options.outline > 0)
+    {
+        mf_outline_font(&effectfont, font, options.outline);
+        font = &effectfont.font;
+    }
+    else if (options.shadow > 0)
+    {
+        mf_shadow_font(&effectfont, font, options.shadow, options.shadow, 128);
+        font = &effectfont.font;
+    }
+    
+#if MF_USE_GLYPH_CACHE
+    if (options.cache_size > 0)
+    {
+        cache = malloc(options.cache_size);
+        mf_glyph_cache_init(cache, options.cache_size);
+    }
+#endif
+    
+#if MF_USE_KERNING && MF_USE_KERNING_CACHE
+    if (options.kerning_cache_size > 0)
+    {
+        kerning_cache = malloc(options.kerning_cache_size);
+        mf_kerning_cache_init(kerning_cache, options.kerning_cache_size);
+    }
+#endif
+    
+    if (options.wrap_buffer_size > 0)
+        wrap_buffer = malloc(options.wrap_buffer_size);
+    
+    /* Wrap the text once, and use the lines both to decide the image
+     * height and to render. There cannot be more lines than characters. */
+    max_lines = (strlen(options.text) < 0xFFFF) ? strlen(options.text) + 1
+                                                : 0xFFFF;
+    lines = malloc(max_lines * sizeof(struct mf_lineinfo_s));
+    count = wrap_text(font, &options, wrap_buffer, lines, max_lines);
+    
+    /* Each glyph run is one line. */
+    if (runs)
+    {
+        count = 0;
+        while (runs[count])
+            count++;
+    }
+    
+    height = count * font->height + 4;
+    
+    if (options.check_widths && !check_line_widths(font, lines, count))
+        return 3;
+    
+#if MF_USE_ADVANCED_WORDWRAP && MF_USE_INCREMENTAL_WORDWRAP
+    if (options.incremental &&
+        !check_incremental(font, options.width - 2 * options.margin,
+                           options.text))
+        return 3;
+#endif
     
     /* Allocate and clear the image buffer */
     state.options = &options;
@@ -257,15 +1099,103 @@ int main(int argc, const char **argv)
     /* Initialize image to white */
     memset(state.buffer, 255, options.width * height);
     
+#if MF_USE_FRAMEBUFFER
+    if (options.fb_format >= 0)
+    {
+        init_framebuffer(&fb, options.fb_format, state.width, state.height);
+        state.fb = &fb;
+        
+        if (options.gamma > 0)
+        {
+            compute_alpha_lut(alpha_lut, options.gamma, options.contrast);
+            fb.alpha_lut = alpha_lut;
+        }
+        
+        /* The clip rectangle of the framebuffer must lie inside it. */
+        if (options.clip)
+        {
+            const struct mf_cliprect_s *r = &options.clip_rect;
+            if (r->x0 > fb.clip_x0) fb.clip_x0 = r->x0;
+            if (r->y0 > fb.clip_y0) fb.clip_y0 = r->y0;
+            if (r->x1 < fb.clip_x1) fb.clip_x1 = r->x1;
+            if (r->y1 < fb.clip_y1) fb.clip_y1 = r->y1;
+        }
+    }
+#endif
+    
     /* Render the text */
-    mf_wordwrap(font, options.width - 2 * options.margin,
-                options.text, line_callback, &state);
+    for (i = 0; i < count; i++)
+    {
+        if (runs)
+        {
+            mf_render_glyph_run_pixels(font, options.anchor, state.y,
+                                       options.alignment, runs[i],
+                                       pixel_callback, &state);
+            state.y += font->line_height;
+        }
+        else
+        {
+            render_line(&state, lines[i].start, lines[i].chars);
+        }
+    }
+    
+#if MF_USE_FRAMEBUFFER
+    if (state.fb)
+    {
+        read_framebuffer(&fb, &state);
+        free(fb.buffer);
+    }
+#endif
+    
+    if (state.failed)
+        return 3;
     
     /* Write out the bitmap */
     write_bmp(options.filename, state.buffer, state.width, state.height);
     
     printf("Wrote %s\n", options.filename);
     
+#if MF_USE_GLYPH_CACHE
+    if (cache)
+    {
+        struct mf_glyph_cache_stats_s stats;
+        mf_get_glyph_cache_stats(&stats);
+        printf("Glyph cache: %lu hits, %lu misses, %lu evictions\n",
+               (unsigned long)stats.hits, (unsigned long)stats.misses,
+               (unsigned long)stats.evictions);
+        mf_glyph_cache_init(NULL, 0);
+    }
+#endif
+    
+    free(cache);
+    free(wrap_buffer);
+    free(lines);
+    
+#if MF_USE_KERNING && MF_USE_KERNING_CACHE
+    if (kerning_cache)
+    {
+        struct mf_kerning_cache_stats_s stats;
+        uint32_t total;
+        mf_get_kerning_cache_stats(&stats);
+        total = stats.hits + stats.misses;
+        printf("Kerning cache: %lu hits, %lu misses, %lu evictions, "
+               "%lu%% hit ratio\n",
+               (unsigned long)stats.hits, (unsigned long)stats.misses,
+               (unsigned long)stats.evictions,
+               (unsigned long)(total ? stats.hits * 100 / total : 0));
+        mf_kerning_cache_init(NULL, 0);
+    }
+#endif
+    
+    free(kerning_cache);
+    
+#if MF_USE_EXPANDED_DICTIONARY
+    if (dict)
+        mf_rlefont_expand_dictionary(mf_find_font(options.fontname), NULL, 0);
+#endif
+    
+    free(dict);
+    
     free(state.buffer);
     return 0;
 }
@@ -0,0 +1,242 @@
+/* Compares the speed and the quality of the word wrap algorithms.
+ * Each paragraph of the text is wrapped separately many times, and the
+ * time per paragraph and the raggedness of the result are reported.
+ * Editing is simulated by deleting and retyping each character of the
+ * text, and the incremental word wrap is compared against wrapping the
+ * whole text again after every edit.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <mcufont.h>
+
+#define MAX_TEXT 65536
+#define REPEATS 200
+#define MAX_LINES 1024
+
+typedef void (*wrap_func_t)(const struct mf_font_s *font, int16_t width,
+                            mf_str text, mf_line_callback_t callback,
+                            void *state);
+
+typedef struct {
+    const struct mf_font_s *font;
+    int16_t width;
+    long raggedness;
+    long last_line;
+    int overflows;
+} state_t;
+
+#if MF_USE_OPTIMAL_WORDWRAP
+/* Scratch memory for the optimal word wrap. */
+static void *scratch[64 * 24 / sizeof(void*)];
+#endif
+
+/* Callback to sum up the squared space left at the end of each line. */
+static bool line_callback(mf_str line, uint16_t count, void *state)
+{
+    state_t *s = (state_t*)state;
+    int16_t w;
+    
+    /* Trailing whitespace does not count. */
+    while (count > 0 && (line[count - 1] == ' ' || line[count - 1] == '\n'))
+        count--;
+    
+    w = mf_get_string_width(s->font, line, count, false);
+    if (w > s->width)
+        s->overflows++;
+    
+    s->last_line = (long)(s->width - w) * (s->width - w);
+    s->raggedness += s->last_line;
+    return true;
+}
+
+/* Callback that does nothing, for timing only the word wrap. */
+static bool null_callback(mf_str line, uint16_t count, void *state)
+{
+    return true;
+}
+
+static void wrap_greedy(const struct mf_font_s *font, int16_t width,
+                        mf_str text, mf_line_callback_t callback, void *state)
+{
+    mf_wordwrap(font, width, text, callback, state);
+}
+
+#if MF_USE_OPTIMAL_WORDWRAP
+static void wrap_optimal(const struct mf_font_s *font, int16_t width,
+                         mf_str text, mf_line_callback_t callback, void *state)
+{
+    mf_wordwrap_optimal(font, width, text, scratch, sizeof(scratch),
+                        callback, state);
+}
+#endif
+
+/* Raggedness of a paragraph. The last line does not count, as it is
+ * supposed to be short. */
+static long paragraph_raggedness(wrap_func_t wrap, state_t *s, mf_str text)
+{
+    s->raggedness = 0;
+    s->last_line = 0;
+    wrap(s->font, s->width, text, line_callback, s);
+    return s->raggedness - s->last_line;
+}
+
+static void run(const char *name, wrap_func_t wrap, state_t *s,
+                char **paragraphs, int count)
+{
+    clock_t start;
+    double usecs;
+    long raggedness = 0;
+    int i, j;
+    
+    s->overflows = 0;
+    
+    start = clock();
+    for (j = 0; j < REPEATS; j++)
+    {
+        for (i = 0; i < count; i++)
+            wrap(s->font, s->width, paragraphs[i], null_callback, s);
+    }
+    usecs = (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC;
+    usecs /= (double)REPEATS * count;
+    
+    for (i = 0; i < count; i++)
+        raggedness += paragraph_raggedness(wrap, s, paragraphs[i]);
+    
+    printf("%-22s %8.1f us per paragraph, raggedness %ld, %d overflows\n",
+           name, usecs, raggedness, s->overflows);
+}
+
+#if MF_USE_ADVANCED_WORDWRAP && MF_USE_INCREMENTAL_WORDWRAP
+/* Delete and retype each ASCII character of the text, updating the layout
+ * after each edit. Returns the number of edits done. */
+static int edit_text(state_t *s, char *text, size_t len,
+                     struct mf_wordwrap_layout_s *layout, long *redrawn)
+{
+    uint16_t first, last;
+    int edits = 0;
+    size_t i;
+    char c;
+    
+    for (i = 0; i < len; i++)
+    {
+        c = text[i];
+        if (c & 0x80)
+            continue;
+        
+        memmove(text + i, text + i + 1, len - i);
+        if (layout)
+        {
+            mf_wordwrap_update(layout, text, i, 1, 0, &first, &last);
+            *redrawn += last - first;
+        }
+        else
+        {
+            mf_wordwrap(s->font, s->width, text, null_callback, s);
+        }
+        
+        memmove(text + i + 1, text + i, len - i);
+        text[i] = c;
+        if (layout)
+        {
+            mf_wordwrap_update(layout, text, i, 0, 1, &first, &last);
+            *redrawn += last - first;
+        }
+        else
+        {
+            mf_wordwrap(s->font, s->width, text, null_callback, s);
+        }
+        
+        edits += 2;
+    }
+    
+    return edits;
+}
+
+static void run_editing(state_t *s, char *text, size_t len)
+{
+    static struct mf_wrapline_s lines[MAX_LINES];
+    struct mf_wordwrap_layout_s layout;
+    clock_t start;
+    double usecs;
+    long redrawn = 0;
+    int edits;
+    
+    start = clock();
+    edits = edit_text(s, text, len, NULL, NULL);
+    usecs = (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / edits;
+    
+    mf_wordwrap_layout(&layout, s->font, s->width, lines, MAX_LINES, text);
+    printf("%-22s %8.1f us per edit, %d lines\n",
+           "mf_wordwrap", usecs, layout.count);
+    
+    start = clock();
+    edits = edit_text(s, text, len, &layout, &redrawn);
+    usecs = (double)(clock() - start) * 1000000 / CLOCKS_PER_SEC / edits;
+    printf("%-22s %8.1f us per edit, %.1f lines changed\n",
+           "mf_wordwrap_update", usecs, (double)redrawn / edits);
+}
+#endif
+
+int main(int argc, const char **argv)
+{
+    static char text[MAX_TEXT];
+    char *paragraphs[256];
+    int count = 0;
+    size_t len;
+    char *p;
+    FILE *f;
+    state_t state;
+    
+    if (argc < 2)
+    {
+        printf("Usage: ./wordwrap_bench textfile [font] [width]\n");
+        return 1;
+    }
+    
+    f = fopen(argv[1], "r");
+    if (!f)
+    {
+        printf("Could not open %s\n", argv[1]);
+        return 1;
+    }
+    len = fread(text, 1, MAX_TEXT - 1, f);
+    text[len] = 0;
+    fclose(f);
+    
+    state.font = mf_find_font((argc > 2) ? argv[2] : "DejaVuSerif16");
+    state.width = (argc > 3) ? atoi(argv[3]) : 300;
+    
+    if (!state.font)
+    {
+        printf("No such font\n");
+        return 2;
+    }
+    
+#if MF_USE_ADVANCED_WORDWRAP && MF_USE_INCREMENTAL_WORDWRAP
+    printf("Font %s, width %d, editing %lu characters\n",
+           state.font->short_name, state.width, (unsigned long)len);
+    run_editing(&state, text, len);
+#endif
+    
+    /* Split the text into paragraphs. */
+    p = text;
+    while (*p && count < 256)
+    {
+        paragraphs[count++] = p;
+        p = strchr(p, '\n');
+        if (!p)
+            break;
+        *p++ = 0;
+    }
+    
+    printf("Font %s, width %d, %d paragraphs\n",
+           state.font->short_name, state.width, count);
+    run("mf_wordwrap", wrap_greedy, &state, paragraphs, count);
+#if MF_USE_OPTIMAL_WORDWRAP
+    run("mf_wordwrap_optimal", wrap_optimal, &state, paragraphs, count);
+#endif
+    return 0;
+}